@@ -17,6 +17,7 @@
 #include <fuzzy/costs.hh>
 #include <fuzzy/fuzzy_match.hh>
 #include <fuzzy/fuzzy_matcher_binarization.hh>
+#include <fuzzy/index_builder.hh>
 
 #define TICK(msg) {\
     auto current = std::chrono::system_clock::now();\
@@ -29,7 +30,10 @@
 namespace po = boost::program_options;
 namespace ios = boost::iostreams;
 
-bool import_tm(fuzzy::FuzzyMatch& fuzzyMatcher, std::string tmFile, bool addTarget, bool add_target_no_index)
+/* Indexer is FuzzyMatch, or IndexBuilder for an out-of-core index */
+template <typename Indexer>
+bool import_tm(Indexer& fuzzyMatcher, std::string tmFile, bool addTarget, bool add_target_no_index,
+               size_t num_threads, size_t batch_size)
 {
   std::istream *ofs = 0;
   size_t pos = tmFile.find(",");
@@ -52,6 +56,10 @@ bool import_tm(fuzzy::FuzzyMatch& fuzzyMatcher, std::string tmFile, bool addTarg
   std::string srcLine;
 
   int count = 0;
+  std::vector<std::string> ids;
+  std::vector<std::string> sentences;
+  ids.reserve(batch_size);
+  sentences.reserve(batch_size);
 
   while (getline(ifs, srcLine))
   {
@@ -71,8 +79,16 @@ bool import_tm(fuzzy::FuzzyMatch& fuzzyMatcher, std::string tmFile, bool addTarg
       index += "="+tgtLine;
     if (add_target_no_index)
       index = tgtLine;
-    fuzzyMatcher.add_tm(index, srcLine, /* sort */ false);
+    ids.emplace_back(std::move(index));
+    sentences.emplace_back(std::move(srcLine));
+    if (sentences.size() >= batch_size)
+    {
+      fuzzyMatcher.add_tm_batch(ids, sentences, num_threads);
+      ids.clear();
+      sentences.clear();
+    }
   }
+  fuzzyMatcher.add_tm_batch(ids, sentences, num_threads);
 
   delete ofs;
   return true;
@@ -218,10 +234,12 @@ public:
   }
   std::string match(const std::string &sentence) {
     std::vector<fuzzy::FuzzyMatch::Match> matches;
+    // the sentences are matched on the threads of process_stream
+    thread_local fuzzy::FuzzyMatch::Workspace workspace;
 
     _fuzzyMatcher.match(sentence, _fuzzy, _nmatch, _no_perfect, matches,
                         _min_subseq_length, _min_subseq_ratio, _idf_penalty, _cost,
-                        _contrastive_factor, _contrastive_reduce, _contrastive_buffer);
+                        _contrastive_factor, _contrastive_reduce, _contrastive_buffer, &workspace);
 
     std::string   out;
     for(const fuzzy::FuzzyMatch::Match &m: matches) {
@@ -233,10 +251,11 @@ public:
   }
   std::string subsequence(const std::string &sentence) {
     std::vector<fuzzy::FuzzyMatch::Match> matches;
+    thread_local fuzzy::FuzzyMatch::Workspace workspace;
 
     _fuzzyMatcher.subsequence(sentence, _nmatch, _no_perfect, matches,
                               _min_subseq_length, _min_subseq_ratio,
-                              _subseq_idf_weighting);
+                              _subseq_idf_weighting, &workspace);
 
     std::string   out;
     for(const fuzzy::FuzzyMatch::Match &m: matches) {
@@ -299,6 +318,11 @@ int main(int argc, char** argv)
   std::string index_file;
   std::string penalty_tokens;
   std::string contrastive_reduce;
+  std::string sort_algorithm;
+  std::string index_format;
+  size_t memory_budget;
+  size_t num_shards;
+  size_t cached_tokens;
   float idf_penalty;
   float insert_cost;
   float delete_cost;
@@ -335,11 +359,20 @@ int main(int argc, char** argv)
     ("delete-cost", po::value(&delete_cost)->default_value(1), "custom cost for delete in edit distance")
     ("replace-cost", po::value(&replace_cost)->default_value(1), "custom cost for replace in edit distance")
     ("subseq-idf-weighting,w", po::bool_switch(), "use idf weighting in finding longest subsequence")
+    ("sort", po::value(&sort_algorithm)->default_value("bucket"), "suffix array construction when building index (bucket|sais)")
+    ("index-format", po::value(&index_format)->default_value("1"), "format of the index file when building index (1: boost archive|2: memory mapped, loaded in place)")
+    ("memory-budget", po::value(&memory_budget)->default_value(0), "if not 0, build the index out of core with this memory budget in MB - the index is written in format 2")
+    ("fm-index", po::bool_switch(), "when building index, replace the suffix array by a smaller and slower FM-index")
+    ("prefix-cache", po::value(&cached_tokens)->default_value(0), "when building index, number of tokens following the first one of each suffix to cache for faster lookups (2 bytes each)")
+    ("length-index", po::bool_switch(), "when building index, index the sentence lengths of the suffixes for a faster candidate selection of the long patterns")
+    ("sentence-listing", po::bool_switch(), "when building index, index the distinct sentences of the suffix ranges for a faster candidate selection when n-grams are repeated in the sentences")
+    ("suffix-links", po::bool_switch(), "when building index, index the suffix links and the LCP minima of the suffixes for faster n-gram lookups of the long patterns")
+    ("shards", po::value(&num_shards)->default_value(1), "number of shards of the index, each pattern being matched on one thread per shard")
     ("max-tokens-in-pattern", po::value(&max_tokens_in_pattern)->default_value(fuzzy::DEFAULT_MAX_TOKENS_IN_PATTERN), "Patterns containing more tokens than this value are ignored")
     ("contrast", po::value(&contrastive_factor)->default_value(0.f), "Contrastive factor for contrastive fuzzy retrieval")
     ("contrast-reduce", po::value(&contrastive_reduce)->default_value("mean"), "Contrastive factor for contrastive fuzzy retrieval")
     ("contrast-buffer", po::value(&contrastive_buffer)->default_value(-1), "number of fuzzy matches to place in the buffer")    
-    ("nthreads,N", po::value(&nthreads)->default_value(4), "number of thread to use for match")
+    ("nthreads,N", po::value(&nthreads)->default_value(4), "number of threads to use for index tokenization and sorting, and for match")
     ;
 
   configFileOptions
@@ -349,6 +382,8 @@ int main(int argc, char** argv)
 
   std::vector<std::string> v_penalty_tokens;
   int pt = fuzzy::FuzzyMatch::pt_none;
+  fuzzy::SortAlgorithm sort = fuzzy::SortAlgorithm::BUCKET;
+  char format_version = fuzzy::FuzzyMatch::version;
 
   po::variables_map vm;
 
@@ -391,6 +426,27 @@ int main(int argc, char** argv)
           throw boost::program_options::validation_error(boost::program_options::validation_error::invalid_option_value,
                                                          "--penalty-tokens", "sep/jnr");        
     }
+
+    if (sort_algorithm == "sais")
+      sort = fuzzy::SortAlgorithm::SAIS;
+    else if (sort_algorithm != "bucket")
+      throw boost::program_options::validation_error(boost::program_options::validation_error::invalid_option_value,
+                                                     "--sort", sort_algorithm);
+
+    if (index_format == "2")
+      format_version = fuzzy::FuzzyMatch::mapped_version;
+    else if (index_format != "1")
+      throw boost::program_options::validation_error(boost::program_options::validation_error::invalid_option_value,
+                                                     "--index-format", index_format);
+
+    if (vm["fm-index"].as<bool>() && memory_budget > 0)
+      throw boost::program_options::error("--fm-index can not be used with --memory-budget");
+    if (vm["length-index"].as<bool>() && memory_budget > 0)
+      throw boost::program_options::error("--length-index can not be used with --memory-budget");
+    if (vm["sentence-listing"].as<bool>() && memory_budget > 0)
+      throw boost::program_options::error("--sentence-listing can not be used with --memory-budget");
+    if (vm["suffix-links"].as<bool>() && memory_budget > 0)
+      throw boost::program_options::error("--suffix-links can not be used with --memory-budget");
   } catch (boost::program_options::error &e) {
     std::cerr << "ERROR: " << e.what();
     return 1;
@@ -400,6 +456,10 @@ int main(int argc, char** argv)
   bool add_target_no_index = vm["add-target-no-index"].as<bool>();
   bool no_perfect = vm["no-perfect"].as<bool>();
   bool subseq_idf_weighting = vm["subseq-idf-weighting"].as<bool>();
+  bool fm_index = vm["fm-index"].as<bool>();
+  bool length_index = vm["length-index"].as<bool>();
+  bool sentence_listing = vm["sentence-listing"].as<bool>();
+  bool suffix_links = vm["suffix-links"].as<bool>();
 
   if (vm.count("help"))
   {
@@ -418,10 +478,32 @@ int main(int argc, char** argv)
     TICK("Loading index_file: "+index_file);
     import_binarized_fuzzy_matcher(index_file, O._fuzzyMatcher);
   }
+  else if (corpus.length() && memory_budget > 0)
+  {
+    std::string fuzzyMatchFile = corpus.substr(0, corpus.find(",")) + ".fmi";
+    TICK("Building index out of core: "+fuzzyMatchFile);
+    fuzzy::IndexBuilder builder(fuzzyMatchFile, pt, max_tokens_in_pattern, memory_budget * 1024 * 1024,
+                                cached_tokens);
+    bool ok = import_tm(builder, corpus, add_target, add_target_no_index, nthreads, 10000);
+    if (! ok)
+    {
+      std::cerr << "ERROR: " << "import_tm failed";
+      return 2;
+    }
+
+    TICK("Merging runs");
+    builder.finish(nthreads);
+    if (cached_tokens > 0)
+      std::cerr<<"PREFIX CACHE\t"<<builder.prefix_cache_bytes()<<"\tBYTES"<<std::endl;
+    std::cerr<<"BIGRAM TABLE\t"<<builder.bigram_table_bytes()<<"\tBYTES\t"
+             <<builder.bigram_table_seconds()<<"\tSECONDS"<<std::endl;
+    if (action != "index")
+      import_binarized_fuzzy_matcher(fuzzyMatchFile, O._fuzzyMatcher);
+  }
   else if (corpus.length())
   {
     TICK("Importing TM: "+corpus);
-    bool ok = import_tm(O._fuzzyMatcher, corpus, add_target, add_target_no_index);
+    bool ok = import_tm(O._fuzzyMatcher, corpus, add_target, add_target_no_index, nthreads, 10000);
     if (! ok)
     {
       std::cerr << "ERROR: " << "import_tm failed";
@@ -429,7 +511,39 @@ int main(int argc, char** argv)
     }
 
     TICK("Sorting Index");
-    O._fuzzyMatcher.sort();
+    O._fuzzyMatcher.sort(sort, nthreads);
+    if (fm_index)
+    {
+      TICK("Compressing Index");
+      O._fuzzyMatcher.compress();
+    }
+    else
+    {
+      if (cached_tokens > 0)
+      {
+        TICK("Caching suffix prefixes");
+        const size_t prefix_cache_bytes = O._fuzzyMatcher.cache_prefixes(cached_tokens);
+        std::cerr<<"PREFIX CACHE\t"<<prefix_cache_bytes<<"\tBYTES"<<std::endl;
+      }
+      if (length_index)
+      {
+        TICK("Indexing suffix lengths");
+        const size_t length_index_bytes = O._fuzzyMatcher.index_lengths();
+        std::cerr<<"LENGTH INDEX\t"<<length_index_bytes<<"\tBYTES"<<std::endl;
+      }
+      if (sentence_listing)
+      {
+        TICK("Indexing suffix sentences");
+        const size_t sentence_listing_bytes = O._fuzzyMatcher.index_sentence_listing();
+        std::cerr<<"SENTENCE LISTING\t"<<sentence_listing_bytes<<"\tBYTES"<<std::endl;
+      }
+      if (suffix_links)
+      {
+        TICK("Indexing suffix links");
+        const size_t suffix_links_bytes = O._fuzzyMatcher.index_suffix_links();
+        std::cerr<<"SUFFIX LINKS\t"<<suffix_links_bytes<<"\tBYTES"<<std::endl;
+      }
+    }
 
     // work
     if (action == "index")
@@ -439,7 +553,7 @@ int main(int argc, char** argv)
         corpus.erase(pos);
       std::string fuzzyMatchFile = corpus + ".fmi";
       TICK("Dump: "+fuzzyMatchFile);
-      export_binarized_fuzzy_matcher(fuzzyMatchFile, O._fuzzyMatcher);
+      export_binarized_fuzzy_matcher(fuzzyMatchFile, O._fuzzyMatcher, format_version);
     }
   }
   else {
@@ -447,6 +561,11 @@ int main(int argc, char** argv)
     return 3;
   }
 
+  if (num_shards > 1 && (action == "match" || action == "subseq")) {
+    TICK("Sharding index");
+    O._fuzzyMatcher.shard(num_shards);
+  }
+
   if (action == "match") {
     TICK("Matching");
     std::pair<int, int> res(O.apply_stream(std::cin, std::cout, nthreads, 1000, true));
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <bitset>
+#include <cstdint>
+
+namespace fuzzy
+{
+  inline unsigned
+  popcount64(uint64_t word)
+  {
+#if defined(__GNUC__)
+    return __builtin_popcountll(word);
+#else
+    return std::bitset<64>(word).count();
+#endif
+  }
+
+  /* number of trailing zeros of a non-zero word */
+  inline unsigned
+  ctz64(uint64_t word)
+  {
+#if defined(__GNUC__)
+    return __builtin_ctzll(word);
+#else
+    unsigned n = 0;
+    while (!(word & 1))
+    {
+      word >>= 1;
+      n++;
+    }
+    return n;
+#endif
+  }
+
+  /* position of the k-th set bit of the word, from 0 */
+  inline unsigned
+  select64(uint64_t word, unsigned k)
+  {
+    for (; k > 0; k--)
+      word &= word - 1;
+    return ctz64(word);
+  }
+}
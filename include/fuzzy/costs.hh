@@ -26,6 +26,18 @@ namespace fuzzy
     bool is_null() const {
       return (insert_cost == 0.) && (delete_cost == 0.) && (replace_cost == 0.);
     }
+
+    bool is_unit() const {
+      return (insert_cost == 1.) && (delete_cost == 1.) && (replace_cost == 1.);
+    }
+
+    /* a replacement costs at least a deletion and an insertion: the distance is the cost of the tokens
+       outside of a longest common subsequence, e.g. the coverage of the pattern with a free delete */
+    bool is_lcs() const {
+      return insert_cost >= 0. && delete_cost >= 0.
+        && std::max(insert_cost, delete_cost) > 0.
+        && insert_cost + delete_cost <= replace_cost;
+    }
   };
 
   struct Costs
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <cstdint>
 #include <limits>
+#include <vector>
 
 #include <fuzzy/sentence.hh>
 #include <fuzzy/costs.hh>
@@ -8,19 +10,156 @@
 namespace fuzzy
 {
   int   _edit_distance_char(const char *s1, int n1, const char *s2, int n2);
+  /* the same distance, computed in row */
+  int   _edit_distance_char(const char *s1, int n1, const char *s2, int n2, std::vector<int>& row);
 
-  float _edit_distance(const unsigned* thes, const Sentence &reals, int slen,
+  /* number of sentences compared at once by _edit_distances, one per lane of a vector of 32-bit integers */
+  constexpr int EDIT_DISTANCE_LANES = 8;
+
+  /* buffers of the edit distances, reused from one call to the next instead of being allocated:
+     one workspace per thread */
+  struct EditDistanceWorkspace
+  {
+    // real tokens of the sentence
+    SentenceView sentence;
+    // rows i-1 and i of the distances, and of the costs of the intermediate tokens
+    std::vector<float> previous;
+    std::vector<float> current;
+    std::vector<int> previous_tag;
+    std::vector<int> current_tag;
+    // row of _edit_distance_char
+    std::vector<int> char_distances;
+    // columns of the blocks of BitParallelPattern
+    std::vector<uint64_t> positive;
+    std::vector<uint64_t> negative;
+    // columns of the lanes of _edit_distances, one after the other
+    std::vector<int32_t> lane_columns;
+  };
+
+  /* the word ids of the index sentences are uint16_t or unsigned (see SuffixArray::token_bytes) */
+  template <typename Token>
+  float _edit_distance(const Token* thes, const Sentence &reals, int slen,
+                       const unsigned* thep, const Tokens &realptok, int plen,
+                       const std::vector<const char*>& st, const std::vector<int>& sn,
+                       const std::vector<float> &idf_penalty, float idf_weight,
+                       const EditCosts&,
+                       const Costs&,
+                       float max_fuzziness = std::numeric_limits<float>::max(),
+                       EditDistanceWorkspace* workspace = nullptr);
+  /* the same distance with the real tokens of the sentence as views, e.g. of a mapped index */
+  template <typename Token>
+  float _edit_distance(const Token* thes, const SentenceView &reals, int slen,
                        const unsigned* thep, const Tokens &realptok, int plen,
                        const std::vector<const char*>& st, const std::vector<int>& sn,
                        const std::vector<float> &idf_penalty, float idf_weight,
                        const EditCosts&,
                        const Costs&,
-                       float max_fuzziness = std::numeric_limits<float>::max());
-  float _edit_distance(const unsigned* s1, int n1,
-                       const unsigned* s2, int n2,
+                       float max_fuzziness,
+                       EditDistanceWorkspace& workspace);
+  /* the distance between two sequences of word ids without real tokens. With unit edit costs and no
+     max_fuzzyness, s2 is preprocessed into a BitParallelPattern for this call only: a convenience for a
+     single comparison - the callers comparing one sequence to many ones build the BitParallelPattern once
+     and call the overload below */
+  template <typename Token1, typename Token2>
+  float _edit_distance(const Token1* s1, int n1,
+                       const Token2* s2, int n2,
                        const EditCosts& edit_costs,
                        const Costs& costs,
-                       float max_fuzzyness = std::numeric_limits<float>::max());
+                       float max_fuzzyness = std::numeric_limits<float>::max(),
+                       EditDistanceWorkspace* workspace = nullptr);
+
+  /* Levenshtein distance to a sequence of word ids with the bit-parallel algorithm of Myers, on blocks of
+     64 tokens of the pattern for the longer ones (Hyyro): the match masks of its distinct tokens are
+     computed once, for all the sentences compared to it */
+  class BitParallelPattern
+  {
+  public:
+    template <typename Token>
+    BitParallelPattern(const Token* pattern, int length);
+
+    int length() const;
+    /* the patterns of more than one block use the columns of the workspace when given */
+    template <typename Token>
+    int distance(const Token* sentence, int length, EditDistanceWorkspace* workspace = nullptr) const;
+    /* length of a longest common subsequence with the pattern (Allison-Dix, Hyyro) */
+    template <typename Token>
+    int lcs_length(const Token* sentence, int length, EditDistanceWorkspace* workspace = nullptr) const;
+
+  private:
+    const uint64_t* match_masks(unsigned token) const;
+
+    int _length;
+    size_t _num_blocks;
+    // sorted distinct tokens of the pattern, with _num_blocks masks each in _masks
+    std::vector<unsigned> _tokens;
+    std::vector<uint64_t> _masks;
+    // masks of the tokens which are not in the pattern
+    std::vector<uint64_t> _no_matches;
+  };
+
+  /* _edit_distance(s1, n1, s2, n2) with unit edit costs and no max_fuzzyness, s2 being preprocessed */
+  template <typename Token>
+  float _edit_distance(const Token* s1, int n1,
+                       const BitParallelPattern& s2,
+                       const Costs& costs,
+                       EditDistanceWorkspace* workspace = nullptr);
+
+  /* _edit_distance(thes, reals, slen, thep, ...) for edit costs with is_lcs(), when it only counts the
+     tokens which are not in a longest common subsequence: no penalty tokens, no idf penalty, and the
+     real tokens are the same as soon as their word ids are. thep is preprocessed in p */
+  template <typename Token>
+  float _lcs_edit_distance(const Token* thes, int slen,
+                           const unsigned* thep,
+                           const BitParallelPattern& p,
+                           const EditCosts&,
+                           const Costs&,
+                           float max_fuzzyness = std::numeric_limits<float>::max(),
+                           EditDistanceWorkspace* workspace = nullptr);
+
+  /* pattern of _edit_distances: the edit costs are integer multiples of a unit, so that the costs of
+     the lanes are integers */
+  class BatchPattern
+  {
+  public:
+    /* the costs are not negative, not all 0, and multiples of a unit which divides them at most 64 times */
+    static bool supports(const EditCosts&);
+
+    template <typename Token>
+    BatchPattern(const Token* pattern, int length, const EditCosts&);
+
+    int length() const;
+
+  private:
+    template <typename Token>
+    friend void _edit_distances(const Token* const*, const int*, const float*, size_t,
+                                const BatchPattern&, float*, EditDistanceWorkspace&);
+
+    std::vector<unsigned> _tokens;
+    // each token repeated in all the lanes
+    std::vector<int32_t> _lane_tokens;
+    EditCosts _edit_costs;
+    // the edit costs in units
+    int32_t _insert_units;
+    int32_t _delete_units;
+    int32_t _replace_units;
+    // the unit in diff_word
+    float _unit;
+    // true if the costs which are not 0 are the same, the unit: a float cost is then given by its units
+    bool _uniform;
+  };
+
+  /* costs[i] = _edit_distance(sentences[i], lengths[i], pattern, ...) of count sentences without penalty
+     tokens, with the costs of Costs(pattern length, lengths[i], edit costs): a cost is exact when it is at
+     most max_costs[i], and only known to be greater otherwise.
+     The sentences are compared EDIT_DISTANCE_LANES at a time with integer costs, the lane of a sentence
+     going to the next one when its last row is done or when its row minimum is above its bound. The
+     float costs within the bounds are given by their units when the costs are uniform, and computed
+     again by _edit_distance otherwise */
+  template <typename Token>
+  void _edit_distances(const Token* const* sentences, const int* lengths, const float* max_costs, size_t count,
+                       const BatchPattern& pattern,
+                       float* costs,
+                       EditDistanceWorkspace& workspace);
 }
 
 #include <fuzzy/edit_distance.hxx>
@@ -1,36 +1,42 @@
 #pragma once
 
-#include <boost/multi_array.hpp>
+#include <algorithm>
 
 namespace fuzzy
 {
-  inline int _edit_distance_char(const char *s1, int n1, const char *s2, int n2) {
+  /* the row i of the distances replaces the row i-1 from left to right: the cell above left is kept aside */
+  inline int _edit_distance_char(const char *s1, int n1, const char *s2, int n2, std::vector<int>& row) {
     if (n1 == 0)
       return n2;
     if (n2 == 0)
       return n1;
 
-    boost::multi_array<int, 2> arr(boost::extents[n1+1][n2+1]);
-
-    arr[0][0] = 0;
-    for (int i = 1; i < n1 + 1; i++)
-      arr[i][0] = arr[i-1][0] + 1;
-    for (int j = 1; j < n2 + 1; j++)
-      arr[0][j] = arr[0][j-1] + 1;
+    row.resize(n2+1);
+    for (int j = 0; j < n2 + 1; j++)
+      row[j] = j;
 
     for (int i = 1; i < n1 + 1; i++)
     {
+      int above_left = row[0];
+      row[0] = i;
       for (int j = 1; j < n2 + 1; j++)
       {
-        arr[i][j] = std::min(
+        const int above = row[j];
+        row[j] = std::min(
           {
-            arr[i - 1][j] + 1,
-            arr[i][j - 1] + 1,
-            arr[i - 1][j - 1] + (s1[i - 1] == s2[j - 1] ? 0 : 1)
+            above + 1,
+            row[j - 1] + 1,
+            above_left + (s1[i - 1] == s2[j - 1] ? 0 : 1)
           });
+        above_left = above;
       }
     }
 
-    return arr[n1][n2];
+    return row[n2];
+  }
+
+  inline int _edit_distance_char(const char *s1, int n1, const char *s2, int n2) {
+    std::vector<int> row;
+    return _edit_distance_char(s1, n1, s2, n2, row);
   }
 }
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <boost/serialization/vector.hpp>
+#include <boost/serialization/split_member.hpp>
+#include <boost/serialization/level.hpp>
+#include <boost/serialization/tracking.hpp>
+
+namespace fuzzy
+{
+  /* array either owning its elements, or viewing them in a memory mapped index file:
+     the viewed elements are copied on the first modification, with vector() */
+  template <typename T>
+  class FlatArray
+  {
+  public:
+    size_t size() const;
+    bool empty() const;
+    const T* data() const;
+    const T* begin() const;
+    const T* end() const;
+    const T& operator[](size_t i) const;
+    const T& back() const;
+
+    std::vector<T>& vector();
+    void set_view(const T* data, size_t size);
+
+  private:
+    std::vector<T> _vector;
+    const T* _view = nullptr;
+    size_t _view_size = 0;
+
+    friend class boost::serialization::access;
+
+    /* serialized as the std::vector it replaces */
+    template<class Archive>
+    void save(Archive&, unsigned int) const;
+
+    template<class Archive>
+    void load(Archive&, unsigned int);
+
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
+  };
+
+  /* strings concatenated in a single array of characters */
+  class FlatStrings
+  {
+  public:
+    FlatStrings();
+    explicit FlatStrings(const std::vector<std::string>& strings);
+
+    size_t size() const;
+    std::string operator[](size_t i) const;
+    /* the same string, without copying it */
+    std::string_view view(size_t i) const;
+    std::vector<std::string> to_vector() const;
+
+    // offset of each string in chars, followed by the total length
+    FlatArray<uint64_t> offsets;
+    FlatArray<char>     chars;
+  };
+}
+
+namespace boost
+{
+  namespace serialization
+  {
+    /* no class information: the archive only sees the std::vector */
+    template <typename T>
+    struct implementation_level<fuzzy::FlatArray<T>>
+    {
+      typedef mpl::integral_c_tag tag;
+      typedef mpl::int_<object_serializable> type;
+      BOOST_STATIC_CONSTANT(int, value = implementation_level::type::value);
+    };
+
+    template <typename T>
+    struct tracking_level<fuzzy::FlatArray<T>>
+    {
+      typedef mpl::integral_c_tag tag;
+      typedef mpl::int_<track_never> type;
+      BOOST_STATIC_CONSTANT(int, value = tracking_level::type::value);
+    };
+  }
+}
+
+#include "fuzzy/flat_array.hxx"
@@ -0,0 +1,113 @@
+namespace fuzzy
+{
+  template <typename T>
+  inline size_t
+  FlatArray<T>::size() const
+  {
+    return _view ? _view_size : _vector.size();
+  }
+
+  template <typename T>
+  inline bool
+  FlatArray<T>::empty() const
+  {
+    return size() == 0;
+  }
+
+  template <typename T>
+  inline const T*
+  FlatArray<T>::data() const
+  {
+    return _view ? _view : _vector.data();
+  }
+
+  template <typename T>
+  inline const T*
+  FlatArray<T>::begin() const
+  {
+    return data();
+  }
+
+  template <typename T>
+  inline const T*
+  FlatArray<T>::end() const
+  {
+    return data() + size();
+  }
+
+  template <typename T>
+  inline const T&
+  FlatArray<T>::operator[](size_t i) const
+  {
+    return data()[i];
+  }
+
+  template <typename T>
+  inline const T&
+  FlatArray<T>::back() const
+  {
+    return data()[size() - 1];
+  }
+
+  template <typename T>
+  inline std::vector<T>&
+  FlatArray<T>::vector()
+  {
+    if (_view)
+    {
+      _vector.assign(_view, _view + _view_size);
+      _view = nullptr;
+      _view_size = 0;
+    }
+    return _vector;
+  }
+
+  template <typename T>
+  inline void
+  FlatArray<T>::set_view(const T* data, size_t size)
+  {
+    std::vector<T>().swap(_vector);
+    _view = data;
+    _view_size = size;
+  }
+
+  template <typename T>
+  template<class Archive>
+  void FlatArray<T>::save(Archive& archive, unsigned int) const
+  {
+    if (_view)
+    {
+      const std::vector<T> vector(begin(), end());
+      archive & vector;
+    }
+    else
+      archive & _vector;
+  }
+
+  template <typename T>
+  template<class Archive>
+  void FlatArray<T>::load(Archive& archive, unsigned int)
+  {
+    _view = nullptr;
+    _view_size = 0;
+    archive & _vector;
+  }
+
+  inline size_t
+  FlatStrings::size() const
+  {
+    return offsets.empty() ? 0 : offsets.size() - 1;
+  }
+
+  inline std::string
+  FlatStrings::operator[](size_t i) const
+  {
+    return std::string(chars.data() + offsets[i], offsets[i + 1] - offsets[i]);
+  }
+
+  inline std::string_view
+  FlatStrings::view(size_t i) const
+  {
+    return std::string_view(chars.data() + offsets[i], offsets[i + 1] - offsets[i]);
+  }
+}
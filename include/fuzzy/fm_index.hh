@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <fuzzy/flat_array.hh>
+#include <fuzzy/mapped_file.hh>
+#include <fuzzy/offset.hh>
+#include <fuzzy/wavelet_matrix.hh>
+
+#include <boost/serialization/split_member.hpp>
+#include <boost/serialization/version.hpp>
+
+namespace fuzzy
+{
+  constexpr size_t FM_INDEX_SAMPLE_RATE = 8; // one suffix out of 8 knows its text offset
+
+  /* FM-index (Ferragina & Manzini) of the sentences of a sorted suffix array: the token before each
+     suffix - its Burrows-Wheeler transform - in a wavelet matrix, and the text offsets of a sample of
+     the suffixes. There is one row per sentence separator, by sentence id, then one row per suffix,
+     in the order of the suffix array */
+  class FMIndex
+  {
+  public:
+    FMIndex() = default;
+    /* bwt[row] is the token before the suffix of the row, 0 at the start of a sentence - the rows
+       starting a sentence must be sampled, the offsets of the sampled rows being given in row order */
+    FMIndex(const std::vector<unsigned>& bwt,
+            size_t alphabet_size,
+            const std::vector<bool>& sampled,
+            std::vector<offset_t> samples);
+
+    size_t size() const;
+    size_t alphabet_size() const;
+    /* rows of the suffixes starting with ngram, prepending its tokens from the last one */
+    std::pair<size_t, size_t> backward_search(const unsigned* ngram, size_t length) const;
+    /* text offset of the suffix of the row, walking back to the closest sampled suffix */
+    size_t locate(size_t row) const;
+
+    void save_mapped(MappedFileWriter&) const;
+    void load_mapped(MappedFileReader&);
+
+  private:
+    // first row of the suffixes starting with each token
+    FlatArray<uint64_t>  _first_rows;
+    WaveletMatrix        _bwt;
+    RankBitVector        _sampled;
+    FlatArray<offset_t>  _samples;
+
+    friend class boost::serialization::access;
+
+    template<class Archive>
+    void save(Archive&, unsigned int version) const;
+
+    template<class Archive>
+    void load(Archive&, unsigned int version);
+
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
+  };
+}
+
+BOOST_CLASS_VERSION(fuzzy::FMIndex, 1)
+
+#include <fuzzy/fm_index.hxx>
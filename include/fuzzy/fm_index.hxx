@@ -0,0 +1,74 @@
+namespace fuzzy
+{
+  inline size_t
+  FMIndex::size() const
+  {
+    return _bwt.size();
+  }
+
+  inline size_t
+  FMIndex::alphabet_size() const
+  {
+    return _first_rows.empty() ? 0 : _first_rows.size() - 1;
+  }
+
+  /* the suffixes starting with a token are the rows after the ones starting with a lower token,
+     in the order of the rows of the suffix one token later (LF mapping) */
+  inline std::pair<size_t, size_t>
+  FMIndex::backward_search(const unsigned* ngram, size_t length) const
+  {
+    size_t begin = 0;
+    size_t end = size();
+    for (size_t i = length; i-- > 0 && begin < end;)
+    {
+      const auto token = ngram[i];
+      if (token == 0 || token + 1 >= _first_rows.size())
+        return std::pair<size_t, size_t>(0, 0);
+      const auto ranks = _bwt.rank(token, begin, end);
+      begin = _first_rows[token] + ranks.first;
+      end = _first_rows[token] + ranks.second;
+    }
+    return std::pair<size_t, size_t>(begin, end);
+  }
+
+  inline size_t
+  FMIndex::locate(size_t row) const
+  {
+    size_t steps = 0;
+    while (!_sampled[row])
+    {
+      const auto token = _bwt[row];
+      row = _first_rows[token] + _bwt.rank(token, row);
+      steps++;
+    }
+    return _samples[_sampled.rank1(row)] + steps;
+  }
+
+  template<class Archive>
+  void
+  FMIndex::save(Archive& archive, unsigned int) const
+  {
+    const unsigned offset_bytes = sizeof (offset_t);
+    archive
+    & _first_rows
+    & _bwt
+    & _sampled
+    & offset_bytes
+    & _samples;
+  }
+
+  /* the samples are 32-bit offsets before version 1 */
+  template<class Archive>
+  void
+  FMIndex::load(Archive& archive, unsigned int version)
+  {
+    unsigned offset_bytes = sizeof (uint32_t);
+    archive
+    & _first_rows
+    & _bwt
+    & _sampled;
+    if (version >= 1)
+      archive & offset_bytes;
+    load_offsets(archive, _samples, offset_bytes);
+  }
+}
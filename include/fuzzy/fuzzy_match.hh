@@ -5,6 +5,7 @@
 #include <fuzzy/suffix_array_index.hh>
 #include <fuzzy/sentence.hh>
 #include <fuzzy/edit_distance.hh>
+#include <fuzzy/ngram_matches.hh>
 
 namespace onmt {
   class Tokenizer;
@@ -18,6 +19,8 @@ namespace fuzzy
   {
   public:
     static const char version;
+    /* memory mapped format, used in place when imported */
+    static const char mapped_version;
 
     enum penalty_token {
       pt_none = 0,
@@ -32,9 +35,8 @@ namespace fuzzy
     struct Match
     {
       Match(
-        const unsigned* seq,
         int length
-      ) : length(length), s(seq) {}
+      ) : length(length) {}
       Match() {}
       float       score;
       float       penalty;
@@ -42,7 +44,16 @@ namespace fuzzy
       unsigned    s_id;
       std::string id;
       int length;
-      const unsigned* s;
+    };
+
+    /* buffers reused from one pattern to the next, so that matching does not allocate them for each
+       pattern - one workspace per matching thread */
+    struct Workspace
+    {
+      // the candidates of each array searched: the shards, then the delta
+      std::vector<CandidateTable> candidate_tables;
+      // the edit distance buffers of each array, the first one being also used after the search
+      std::vector<EditDistanceWorkspace> edit_distances;
     };
 
     FuzzyMatch(int pt = penalty_token::pt_none,
@@ -53,8 +64,39 @@ namespace fuzzy
     bool add_tm(const std::string& id, const Sentence& source, const Tokens& norm, bool sort = true);
     /* integrated tokenization */
     bool add_tm(const std::string& id, const std::string &sentence, bool sort = true);
-
-    void sort();
+    /* integrated tokenization of a batch of sentences on num_threads threads - sentences are added
+       in input order, empty segments are skipped. Returns the number of sentences added */
+    size_t add_tm_batch(const std::vector<std::string>& ids,
+                        const std::vector<std::string>& sentences,
+                        size_t num_threads = 1,
+                        bool sort = false);
+
+    void sort(SortAlgorithm algorithm = SortAlgorithm::BUCKET, size_t num_threads = 1);
+    /* sentences added once the index is sorted are kept in a sorted delta, automatically merged
+       when it grows too large - this forces the merge */
+    void merge_delta();
+    /* split the index in num_shards shards, each pattern being matched on one thread per shard with
+       the same results */
+    void shard(size_t num_shards);
+    /* smaller index, with the same matches found more slowly */
+    void compress();
+    /* faster lookups with cached_tokens more tokens of each suffix in the index (see SuffixArray::cache_prefixes),
+       returns the size of the cache in bytes */
+    size_t cache_prefixes(size_t cached_tokens);
+    /* faster candidate selection of the long patterns with an index of the sentence lengths of the
+       suffixes (see SuffixArray::index_lengths), returns its size in bytes */
+    size_t index_lengths(bool enable = true);
+    /* faster candidate selection when the n-grams are repeated in the sentences, with the list of the distinct
+       sentences of each suffix range (see SuffixArray::index_sentence_listing), returns its size in bytes */
+    size_t index_sentence_listing(bool enable = true);
+    /* faster n-gram lookups of the long patterns, with the suffix links of the suffixes and the minima of
+       their LCP (see SuffixArray::index_suffix_links), returns their size in bytes */
+    size_t index_suffix_links(bool enable = true);
+    /* remove the sentences with this id from the matches, returns their number - they are only
+       marked as removed until compact() physically removes them and renumbers the sentence ids.
+       Each call scans all the sentence ids, after copying a memory mapped index */
+    size_t remove_tm(const std::string& id);
+    void compact();
     /* backward compatibility */
     bool match(const Tokens& pattern,
                float fuzzy,
@@ -79,7 +121,8 @@ namespace fuzzy
                const EditCosts& edit_costs=EditCosts(),
                float contrastive_factor=0,
                ContrastReduce reduce=ContrastReduce::MEAN,
-               int contrast_buffer=-1) const;
+               int contrast_buffer=-1,
+               Workspace* workspace=nullptr) const;
     /* simplified, include tokenization */
     bool match(const std::string &sentence,
                float fuzzy,
@@ -92,14 +135,16 @@ namespace fuzzy
                const EditCosts& edit_costs=EditCosts(),
                float contrastive_factor=0,
                ContrastReduce reduce=ContrastReduce::MEAN,
-               int contrast_buffer=-1) const;
+               int contrast_buffer=-1,
+               Workspace* workspace=nullptr) const;
     bool subsequence(const std::string &sentence,
                unsigned number_of_matches,
                bool no_perfect,
                std::vector<Match>& matches,
                int min_subseq_length=3,
                float min_subseq_ratio=0.3,
-               bool idf_weighting=false) const;
+               bool idf_weighting=false,
+               Workspace* workspace=nullptr) const;
     /* tokenize and normalize a sentence - with options defined when creating the
        fuzzyMatcher */
     void _tokenize_and_normalize(const std::string &sentence,
@@ -121,9 +166,15 @@ namespace fuzzy
   private:
     friend class boost::serialization::access;
     friend void import_binarized_fuzzy_matcher(const std::string& binarized_tm_filename, FuzzyMatch& fuzzy_matcher);
+    friend void export_binarized_fuzzy_matcher(const std::string& binarized_tm_filename,
+                                               const FuzzyMatch& fuzzy_matcher,
+                                               char format_version);
 
     void _update_tokenizer();
 
+    void save_mapped(MappedFileWriter&) const;
+    void load_mapped(MappedFileReader&, std::shared_ptr<const void> mapping);
+
     template<class Archive>
     void save(Archive&, unsigned int version) const;
 
@@ -134,6 +185,11 @@ namespace fuzzy
 
     float compute_max_idf_penalty() const;
 
+    void _register_ngram_matches(const SuffixArray& suffix_array,
+                                 const std::vector<unsigned>& pattern_wids,
+                                 const EditCosts& edit_costs,
+                                 NGramMatches& ngram_matches) const;
+
     std::vector<float>
     compute_idf_penalty(const std::vector<unsigned int>& pattern_wids,
                         float unknown_vocab_word_penalty = 0) const;
@@ -1,11 +1,17 @@
 #pragma once
 
+#include <ostream>
 #include <string>
 #include <fuzzy/fuzzy_match.hh>
 
 namespace fuzzy
 {
-  void export_binarized_fuzzy_matcher(const std::string& binarized_tm_filename, const FuzzyMatch& fuzzy_matcher);
+  /// format_version is FuzzyMatch::version (boost archive) or FuzzyMatch::mapped_version (memory mapped)
+  void export_binarized_fuzzy_matcher(const std::string& binarized_tm_filename,
+                                      const FuzzyMatch& fuzzy_matcher,
+                                      char format_version = FuzzyMatch::version);
+  /// writes the signature of a memory mapped index: the sections of FuzzyMatch::save_mapped follow
+  MappedFileWriter begin_mapped_fuzzy_matcher(std::ostream& os);
   /// @throw std::exception if can't read file, or file is not an FMI
   void import_binarized_fuzzy_matcher(const std::string& binarized_tm_filename, FuzzyMatch& fuzzy_matcher);
 }
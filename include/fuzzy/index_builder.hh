@@ -0,0 +1,91 @@
+#pragma once
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fuzzy/fuzzy_match.hh>
+#include <fuzzy/mapped_file.hh>
+
+namespace fuzzy
+{
+  constexpr size_t DEFAULT_MEMORY_BUDGET = 1024 * 1024 * 1024;
+
+  class SpillFile;
+  class SpillStrings;
+
+  /* builds a memory mapped index (FMI2) of a corpus larger than the memory: the sentences are
+     indexed by chunks fitting in memory_budget bytes, whose sorted suffixes are written to temporary
+     run files next to the index, and merged when the index is written. Apart from the vocabulary
+     and the merge buffers, everything stays on disk. The index is the one FuzzyMatch would build. */
+  class IndexBuilder
+  {
+  public:
+    IndexBuilder(const std::string& index_filename,
+                 int pt = FuzzyMatch::pt_none,
+                 size_t max_tokens_in_pattern = DEFAULT_MAX_TOKENS_IN_PATTERN,
+                 size_t memory_budget = DEFAULT_MEMORY_BUDGET,
+                 size_t cached_tokens = 0);
+    ~IndexBuilder();
+
+    /* same as FuzzyMatch::add_tm_batch */
+    size_t add_tm_batch(const std::vector<std::string>& ids,
+                        const std::vector<std::string>& sentences,
+                        size_t num_threads = 1);
+    /* merges the runs and writes the index - the temporary files are removed */
+    void finish(size_t num_threads = 1);
+
+    size_t num_runs() const;
+    /* size of the prefix cache written in the index (see SuffixArray::cache_prefixes) */
+    size_t prefix_cache_bytes() const;
+    /* size of the bigram table written in the index and time spent building it after the merge
+       (see SuffixArray::compute_bigram_table) */
+    size_t bigram_table_bytes() const;
+    double bigram_table_seconds() const;
+
+  private:
+    void add_tm(const std::string& id, const Sentence& real, const Tokens& norm);
+    void flush_chunk(size_t num_threads);
+    void merge_runs();
+    void compute_bigram_table();
+    void write_index();
+    std::string temp_filename(const std::string& name) const;
+
+    std::string  _index_filename;
+    int          _pt;
+    size_t       _max_tokens_in_pattern;
+    size_t       _memory_budget;
+    size_t       _cached_tokens;
+    FuzzyMatch   _tokenizer;
+    VocabIndexer _vocabIndexer;
+
+    // sentences not yet written in a run
+    SuffixArray  _chunk;
+    size_t       _chunk_tokens = 0;
+    size_t       _chunk_offset = 0;
+    size_t       _num_sentences = 0;
+    size_t       _buffer_size = 0;
+    uint64_t     _num_itoks = 0;
+    std::vector<offset_t> _quickVocabAccess;
+
+    std::unique_ptr<SpillFile>    _sentence_buffer;
+    std::unique_ptr<SpillFile>    _sentence_pos;
+    std::unique_ptr<SpillStrings> _ids;
+    std::unique_ptr<SpillStrings> _tokens;
+    std::unique_ptr<SpillFile>    _itoks_begin;
+    std::unique_ptr<SpillFile>    _itoks_pos;
+    std::unique_ptr<SpillStrings> _itoks;
+    std::vector<std::unique_ptr<SpillFile>> _runs;
+    std::unique_ptr<SpillFile>    _suffixes;
+    std::unique_ptr<SpillFile>    _lcp;
+    std::unique_ptr<SpillFile>    _llcp;
+    std::unique_ptr<SpillFile>    _rlcp;
+    std::unique_ptr<SpillFile>    _prefix_cache;
+    size_t                        _prefix_cache_bytes = 0;
+    std::vector<offset_t>         _bigram_index;
+    std::vector<unsigned>         _bigram_second_words;
+    std::vector<offset_t>         _bigram_starts;
+    double                        _bigram_table_seconds = 0;
+  };
+}
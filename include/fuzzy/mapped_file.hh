@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+#include <fuzzy/flat_array.hh>
+
+namespace fuzzy
+{
+  /* memory mapped index files are a sequence of sections, each one being its size in bytes
+     as a 64 bits integer followed by the data padded to 8 bytes: the arrays are used in place */
+  constexpr size_t MAPPED_ALIGNMENT = 8;
+
+  class MappedFileWriter
+  {
+  public:
+    /* position is the number of bytes already written in the file */
+    MappedFileWriter(std::ostream& os, size_t position = 0);
+
+    template <typename T>
+    void write(const T* data, size_t size);
+    template <typename T>
+    void write(const FlatArray<T>& array);
+    template <typename T>
+    void write_value(const T& value);
+    void write(const FlatStrings& strings);
+
+    /* section written in several parts */
+    void begin_section(size_t num_bytes);
+    void append(const void* data, size_t num_bytes);
+    void end_section();
+
+  private:
+    void pad();
+
+    std::ostream& _os;
+    size_t _position;
+    size_t _section_end = 0;
+  };
+
+  class MappedFileReader
+  {
+  public:
+    /* data must be aligned to MAPPED_ALIGNMENT, position is the offset of the first section */
+    MappedFileReader(const char* data, size_t size, size_t position = 0);
+
+    template <typename T>
+    void read(FlatArray<T>& array);
+    template <typename T>
+    T read_value();
+    void read(FlatStrings& strings);
+
+    const char* section(size_t* num_bytes);
+
+  private:
+    const char* _data;
+    size_t _size;
+    size_t _position;
+  };
+}
+
+#include "fuzzy/mapped_file.hxx"
@@ -0,0 +1,52 @@
+#include <cstring>
+#include <stdexcept>
+
+namespace fuzzy
+{
+  template <typename T>
+  void
+  MappedFileWriter::write(const T* data, size_t size)
+  {
+    begin_section(size * sizeof (T));
+    append(data, size * sizeof (T));
+    end_section();
+  }
+
+  template <typename T>
+  void
+  MappedFileWriter::write(const FlatArray<T>& array)
+  {
+    write(array.data(), array.size());
+  }
+
+  template <typename T>
+  void
+  MappedFileWriter::write_value(const T& value)
+  {
+    write(&value, 1);
+  }
+
+  template <typename T>
+  void
+  MappedFileReader::read(FlatArray<T>& array)
+  {
+    size_t num_bytes = 0;
+    const char* data = section(&num_bytes);
+    if (num_bytes % sizeof (T))
+      throw std::runtime_error("corrupted FMI file: invalid array size");
+    array.set_view(reinterpret_cast<const T*>(data), num_bytes / sizeof (T));
+  }
+
+  template <typename T>
+  T
+  MappedFileReader::read_value()
+  {
+    size_t num_bytes = 0;
+    const char* data = section(&num_bytes);
+    if (num_bytes != sizeof (T))
+      throw std::runtime_error("corrupted FMI file: invalid value size");
+    T value;
+    std::memcpy(&value, data, sizeof (T));
+    return value;
+  }
+}
@@ -19,13 +19,40 @@ namespace fuzzy
   // Sentence ID -> longest N-gram match
   using LongestMatches = tsl::hopscotch_map<unsigned, unsigned, IntHash>;
 
+  /* Sentence ID -> longest N-gram match in a dense array reused from one pattern to the next: an entry
+     is only valid when stamped with the current epoch, so that clearing the table is incrementing the
+     epoch, and the sentences of the valid entries are listed in the order they were touched */
+  class CandidateTable
+  {
+  public:
+    CandidateTable() = default;
+
+    // Starts a new pattern on an array of num_sentences sentences
+    void reset(size_t num_sentences);
+    void update(unsigned sentence_id, unsigned match_length);
+    unsigned longest_match(unsigned sentence_id) const;
+    const std::vector<unsigned>& touched() const;
+
+  private:
+    // Starts at this epoch, for the tests of its wraparound
+    explicit CandidateTable(uint32_t epoch);
+    friend struct CandidateTableTest;
+
+    std::vector<unsigned> _longest_matches;
+    std::vector<uint32_t> _epochs;
+    std::vector<unsigned> _touched;
+    uint32_t _epoch = 0;
+  };
+
   class NGramMatches
   {
   public:
     NGramMatches(float fuzzy,
                  unsigned p_length,
                  unsigned min_seq_len,
-                 const SuffixArray&);
+                 const SuffixArray&,
+                 unsigned sentence_id_offset = 0,
+                 CandidateTable* candidate_table = nullptr);
 
     // Registers a match for this range of suffixes.
     void register_suffix_range_match(
@@ -43,9 +70,28 @@ namespace fuzzy
     unsigned min_exact_match; // Any suffix without an subsequence of at least this with the pattern won't be accepted later
 
   private:
+    void set_rejection_costs(const EditCosts& edit_costs);
+    bool length_rejection(size_t s_length, const EditCosts& edit_costs);
+    const std::vector<std::pair<unsigned, unsigned>>& accepted_lengths(unsigned max_length,
+                                                                       const EditCosts& edit_costs);
+    void register_sentence(unsigned local_sentence_id, unsigned match_length);
+    void register_sentences(const unsigned* local_sentence_ids,
+                            size_t count,
+                            unsigned match_length,
+                            const EditCosts& edit_costs);
+
     unsigned _p_length;
     unsigned _min_seq_len;
     const SuffixArray& _suffixArray;
+    unsigned _sentence_id_offset;
     LongestMatches _longest_matches;
+    // if set, the matches go there instead of _longest_matches
+    CandidateTable* _candidate_table;
+    // theoretical_rejection of each sentence length, computed once for these costs
+    std::vector<signed char> _length_rejections;
+    // intervals of the lengths up to _accepted_max_length which are not rejected
+    std::vector<std::pair<unsigned, unsigned>> _accepted_lengths;
+    unsigned _accepted_max_length = 0;
+    float _rejection_costs[3] = {-1, -1, -1};
   };
 }
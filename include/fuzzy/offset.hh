@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include <fuzzy/flat_array.hh>
+
+namespace fuzzy
+{
+  /* offsets in the sentence buffer and suffix ids: 32 bits, or 64 bits when built with LARGE_INDEX
+     for the indexes of more than 4 billion tokens */
+#ifdef FUZZY_LARGE_INDEX
+  typedef uint64_t offset_t;
+#else
+  typedef uint32_t offset_t;
+#endif
+
+  /* offsets saved in an archive with offset_bytes bytes each, converted to offset_t */
+  template <class Archive>
+  void load_offsets(Archive& archive, FlatArray<offset_t>& offsets, unsigned offset_bytes)
+  {
+    if (offset_bytes == sizeof (offset_t))
+    {
+      archive & offsets;
+      return;
+    }
+
+    if (offset_bytes == sizeof (uint32_t))
+    {
+      std::vector<uint32_t> saved;
+      archive & saved;
+      offsets.vector().assign(saved.begin(), saved.end());
+    }
+    else if (offset_bytes == sizeof (uint64_t))
+    {
+      std::vector<uint64_t> saved;
+      archive & saved;
+      for (const auto offset : saved)
+        if (offset > std::numeric_limits<offset_t>::max())
+          throw std::length_error("Too many tokens in the index: build with LARGE_INDEX to load it");
+      offsets.vector().assign(saved.begin(), saved.end());
+    }
+    else
+      throw std::invalid_argument("Unsupported FMI format");
+  }
+}
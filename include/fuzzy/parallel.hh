@@ -0,0 +1,55 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace fuzzy
+{
+  /* call function(i) for each task i in [0, num_tasks) using up to num_threads threads (including the caller);
+     tasks are picked in increasing order, the first exception thrown by a task is rethrown to the caller */
+  template <typename Function>
+  void parallel_for(size_t num_tasks, size_t num_threads, const Function& function)
+  {
+    num_threads = std::min(num_threads, num_tasks);
+    if (num_threads <= 1)
+    {
+      for (size_t i = 0; i < num_tasks; i++)
+        function(i);
+      return;
+    }
+
+    std::atomic<size_t> next_task(0);
+    std::exception_ptr error;
+    std::mutex error_mutex;
+
+    auto work_loop = [&]() {
+      try
+      {
+        for (size_t i = next_task++; i < num_tasks; i = next_task++)
+          function(i);
+      }
+      catch (...)
+      {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!error)
+          error = std::current_exception();
+        next_task = num_tasks;
+      }
+    };
+
+    std::vector<std::thread> workers;
+    workers.reserve(num_threads - 1);
+    for (size_t i = 1; i < num_threads; i++)
+      workers.emplace_back(work_loop);
+    work_loop();
+    for (auto& worker : workers)
+      worker.join();
+
+    if (error)
+      std::rethrow_exception(error);
+  }
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <fuzzy/flat_array.hh>
+#include <fuzzy/mapped_file.hh>
+#include <fuzzy/offset.hh>
+
+namespace fuzzy
+{
+  /* number of values, or minima, covered by each minimum of the level above */
+  constexpr size_t RANGE_MINIMUM_BLOCK = 32;
+
+  /* sequence of offsets with the minimum of each block of RANGE_MINIMUM_BLOCK values, the minimum of each
+     block of these minima, and so on: the values below a bound in a range are found by only scanning the
+     blocks whose minimum is below it */
+  class RangeMinimum
+  {
+  public:
+    RangeMinimum() = default;
+    RangeMinimum(std::vector<offset_t> values);
+
+    size_t size() const;
+    offset_t operator[](size_t i) const;
+    /* function(position) for the positions of [begin, end) whose value is below bound, in increasing order:
+       in time proportional to their number, times the block size for each level */
+    template <typename Function>
+    void report_below(size_t begin, size_t end, offset_t bound, Function&& function) const;
+    /* first position from begin, and last one before end, whose value is below bound - size() if none:
+       the blocks are skipped from the levels above */
+    size_t next_below(size_t begin, offset_t bound) const;
+    size_t previous_below(size_t end, offset_t bound) const;
+    size_t num_bytes() const;
+
+    void save_mapped(MappedFileWriter&) const;
+    void load_mapped(MappedFileReader&);
+
+  private:
+    size_t num_levels() const;
+    size_t level_size(size_t level) const;
+    /* the values at level 0, the minima of the blocks of the level below at the other ones */
+    offset_t value(size_t level, size_t i) const;
+    template <typename Function>
+    void visit(size_t level, size_t begin, size_t end, offset_t bound, Function& function) const;
+    template <typename Function>
+    void scan(size_t level, size_t begin, size_t end, offset_t bound, Function& function) const;
+
+    FlatArray<offset_t> _values;
+    // the levels of minima one after the other, from the one of the blocks of values
+    FlatArray<offset_t> _minima;
+    // start of each level of minima in _minima, followed by the end
+    FlatArray<uint64_t> _level_starts;
+  };
+}
+
+#include <fuzzy/range_minimum.hxx>
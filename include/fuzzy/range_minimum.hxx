@@ -0,0 +1,156 @@
+#include <algorithm>
+
+namespace fuzzy
+{
+  inline size_t
+  RangeMinimum::size() const
+  {
+    return _values.size();
+  }
+
+  inline offset_t
+  RangeMinimum::operator[](size_t i) const
+  {
+    return _values[i];
+  }
+
+  inline size_t
+  RangeMinimum::num_levels() const
+  {
+    return _level_starts.empty() ? 1 : _level_starts.size();
+  }
+
+  inline size_t
+  RangeMinimum::level_size(size_t level) const
+  {
+    if (level == 0)
+      return _values.size();
+    return _level_starts[level] - _level_starts[level - 1];
+  }
+
+  inline offset_t
+  RangeMinimum::value(size_t level, size_t i) const
+  {
+    if (level == 0)
+      return _values[i];
+    return _minima[_level_starts[level - 1] + i];
+  }
+
+  /* the blocks fully within [begin, end) are visited from the level above */
+  template <typename Function>
+  inline void
+  RangeMinimum::visit(size_t level, size_t begin, size_t end, offset_t bound, Function& function) const
+  {
+    if (level + 1 < num_levels())
+    {
+      const size_t first_block = (begin + RANGE_MINIMUM_BLOCK - 1) / RANGE_MINIMUM_BLOCK;
+      const size_t last_block = end / RANGE_MINIMUM_BLOCK;
+      if (first_block < last_block)
+      {
+        scan(level, begin, first_block * RANGE_MINIMUM_BLOCK, bound, function);
+        visit(level + 1, first_block, last_block, bound, function);
+        scan(level, last_block * RANGE_MINIMUM_BLOCK, end, bound, function);
+        return;
+      }
+    }
+    scan(level, begin, end, bound, function);
+  }
+
+  template <typename Function>
+  inline void
+  RangeMinimum::scan(size_t level, size_t begin, size_t end, offset_t bound, Function& function) const
+  {
+    for (size_t i = begin; i < end; i++)
+    {
+      if (value(level, i) >= bound)
+        continue;
+      if (level == 0)
+        function(i);
+      else
+        scan(level - 1,
+             i * RANGE_MINIMUM_BLOCK,
+             std::min((i + 1) * RANGE_MINIMUM_BLOCK, level_size(level - 1)),
+             bound,
+             function);
+    }
+  }
+
+  template <typename Function>
+  inline void
+  RangeMinimum::report_below(size_t begin, size_t end, offset_t bound, Function&& function) const
+  {
+    if (begin < end)
+      visit(0, begin, end, bound, function);
+  }
+
+  /* the rest of the block is scanned at each level until a value is below bound, then its block is
+     scanned at each level below */
+  inline size_t
+  RangeMinimum::next_below(size_t begin, offset_t bound) const
+  {
+    size_t level = 0;
+    size_t i = begin;
+    while (true)
+    {
+      const size_t end = level_size(level);
+      const size_t block_end = (level + 1 < num_levels()
+                                ? std::min(end, (i / RANGE_MINIMUM_BLOCK + 1) * RANGE_MINIMUM_BLOCK)
+                                : end);
+      while (i < block_end && value(level, i) >= bound)
+        i++;
+      if (i < block_end)
+        break;
+      if (block_end == end)
+        return size();
+      i = block_end / RANGE_MINIMUM_BLOCK;
+      level++;
+    }
+    while (level > 0)
+    {
+      level--;
+      i *= RANGE_MINIMUM_BLOCK;
+      while (value(level, i) >= bound)
+        i++;
+    }
+    return i;
+  }
+
+  inline size_t
+  RangeMinimum::previous_below(size_t end, offset_t bound) const
+  {
+    if (end == 0)
+      return size();
+    size_t level = 0;
+    size_t i = end;
+    while (true)
+    {
+      const size_t block_begin = (level + 1 < num_levels()
+                                  ? (i - 1) / RANGE_MINIMUM_BLOCK * RANGE_MINIMUM_BLOCK
+                                  : 0);
+      while (i > block_begin && value(level, i - 1) >= bound)
+        i--;
+      if (i > block_begin)
+        break;
+      if (block_begin == 0)
+        return size();
+      i = block_begin / RANGE_MINIMUM_BLOCK;
+      level++;
+    }
+    i--;
+    while (level > 0)
+    {
+      level--;
+      i = std::min((i + 1) * RANGE_MINIMUM_BLOCK, level_size(level));
+      while (value(level, i - 1) >= bound)
+        i--;
+      i--;
+    }
+    return i;
+  }
+
+  inline size_t
+  RangeMinimum::num_bytes() const
+  {
+    return (_values.size() + _minima.size()) * sizeof (offset_t) + _level_starts.size() * sizeof (uint64_t);
+  }
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstddef>
+
+namespace fuzzy
+{
+  /* linear-time suffix array construction by induced sorting (SA-IS, Nong, Zhang & Chan 2009)
+     text[0..n) is a sequence over the alphabet [0, alphabet_size) ending with a unique smallest
+     sentinel (text[n-1] == 0); sa[0..n) receives the positions of the sorted suffixes */
+  void sais(const unsigned* text, unsigned* sa, size_t n, size_t alphabet_size);
+}
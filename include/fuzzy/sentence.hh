@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <unordered_map>
 
@@ -37,6 +38,10 @@ namespace fuzzy
     /* push intermediate token - considered only through penalty token */
     void set_itok(size_t idx, const std::string &itok);
     void get_itoks(std::vector<const char*>& st, std::vector<int>& sn) const;
+
+    /* tab separated tokens and intermediate tokens, as stored in the index */
+    const std::string& tokstring() const;
+    const std::unordered_map<size_t, std::string>& itoks() const;
   private:
     friend class boost::serialization::access;
 
@@ -46,6 +51,21 @@ namespace fuzzy
     std::string _tokstring;
     std::unordered_map<size_t, std::string> _itoks;
   };
+
+  /* tokens and intermediate tokens of a sentence as views of its strings: assigned from one sentence to
+     the next without allocating, once the vectors are large enough */
+  struct SentenceView
+  {
+    /* the tab separated tokens, without intermediate tokens at the positions [0, length] */
+    void assign(std::string_view tokstring, size_t length);
+    void assign(const Sentence& sentence, size_t length);
+    void set_itok(size_t idx, std::string_view itok);
+
+    std::vector<std::string_view> tokens;
+    // the intermediate tokens and their lengths, as set by Sentence::get_itoks
+    std::vector<const char*> st;
+    std::vector<int> sn;
+  };
 }
 
 #include "fuzzy/sentence.hxx"
\ No newline at end of file
@@ -14,12 +14,25 @@ namespace fuzzy
     _itoks[idx] += itok;
   }
 
+  inline const std::string& Sentence::tokstring() const {
+    return _tokstring;
+  }
+
+  inline const std::unordered_map<size_t, std::string>& Sentence::itoks() const {
+    return _itoks;
+  }
+
   inline void Sentence::push_back(const std::string &s) {
     if (!_tokstring.empty())
       _tokstring += "\t";
     _tokstring += s;
   }
 
+  inline void SentenceView::set_itok(size_t idx, std::string_view itok) {
+    st[idx] = itok.data();
+    sn[idx] = itok.size();
+  }
+
   template<class Archive>
   void
   Sentence::serialize(Archive& ar, const unsigned int)
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstddef>
 #include <string>
 #include <vector>
 #include <iostream>
@@ -9,8 +10,23 @@
 #include <boost/serialization/split_member.hpp>
 #include <boost/serialization/version.hpp>
 
+#include <fuzzy/flat_array.hh>
+#include <fuzzy/fm_index.hh>
+#include <fuzzy/mapped_file.hh>
+#include <fuzzy/offset.hh>
+#include <fuzzy/range_minimum.hh>
+
 namespace fuzzy
 {
+  /* suffix array construction: per-first-word buckets sorted by comparison, or linear-time induced sorting */
+  enum class SortAlgorithm { BUCKET, SAIS };
+
+  /* cached token whose id does not fit on 2 bytes: the sentence buffer is read instead */
+  constexpr uint16_t PREFIX_CACHE_UNKNOWN = 0xFFFF;
+  /* first word buckets with at least this number of suffixes have their bigrams in the bigram table */
+  constexpr size_t BIGRAM_TABLE_MIN_BUCKET = 1024;
+
+  /* position of a suffix in its sentence - the suffix array only stores its offset in the sentence buffer */
   struct SuffixView
   {
     unsigned sentence_id;
@@ -25,40 +41,222 @@ namespace fuzzy
   {
   public:
     unsigned add_sentence(const std::vector<unsigned>& sentence);
-    void sort(size_t vocab_size);
+    void sort(size_t vocab_size, SortAlgorithm algorithm = SortAlgorithm::BUCKET, size_t num_threads = 1);
+    /* fold the sentences of another sorted suffix array into this sorted one, in time linear to the number of suffixes:
+       they are appended with sentence ids starting at num_sentences() */
+    void merge(const SuffixArray& other, size_t vocab_size);
+    bool is_sorted() const;
+
+    /* replace the sorted suffixes and their LCP by an FM-index, about 2 times smaller with slower
+       lookups - the suffixes are rebuilt when the suffix array is modified */
+    void compress(size_t vocab_size);
+    void decompress();
+    bool is_compressed() const;
+    /* 2 once sorted if the word ids and sentence lengths fit, 4 otherwise: the sentence buffer is
+       stored on 4 bytes per token again when the suffix array is modified */
+    unsigned token_bytes() const;
+
+    /* keep the tokens 2 to cached_tokens + 1 of each sorted suffix in an array next to the suffixes, on 2 bytes
+       each: the binary searches of equal_range then read the suffix offset and the sentence buffer only when
+       these tokens do not decide - the first token is given by the bucket. 0 disables the cache */
+    void cache_prefixes(size_t cached_tokens);
+    size_t cached_tokens() const;
+    size_t prefix_cache_bytes() const;
+    /* fills cache with the cached_tokens tokens following the first one of the suffix, 0 after its end */
+    template <typename Token>
+    static void cache_prefix(const Token* suffix, size_t cached_tokens, uint16_t* cache);
+
+    /* wavelet matrix of the sentence lengths of the sorted suffixes, for about log2(max length) bits per
+       suffix: the suffixes of a range whose sentence length is in a window are counted, and listed,
+       without reading the other ones. It is rebuilt when the suffix array is modified */
+    void index_lengths(bool enable = true);
+    bool has_length_index() const;
+    const WaveletMatrix& length_index() const;
+    size_t length_index_bytes() const;
+
+    /* for each sorted suffix, the position + 1 of the previous suffix of its sentence (0 if none), with the
+       minima of its blocks: the first suffix of each sentence in a range is the one whose previous suffix
+       is before the range, so that the distinct sentences of a range are listed in time proportional to
+       their number. It takes about an offset per suffix, and is rebuilt when the suffix array is modified */
+    void index_sentence_listing(bool enable = true);
+    bool has_sentence_listing() const;
+    size_t sentence_listing_bytes() const;
+    /* function(sentence_id) once for each sentence of the suffixes [begin, end), with the sentence listing */
+    template <typename Function>
+    void visit_distinct_sentences(size_t begin, size_t end, Function&& function) const;
+
+    /* for each sorted suffix, the position of the suffix starting one token later (num_suffixes() after the
+       last token of a sentence), with the minima of the blocks of the LCP array: the ranges of the n-grams
+       starting at the next position of a pattern are found from the ones of the current position, without
+       binary searches (see visit_longest_prefixes). It takes about two offsets per suffix, and is rebuilt
+       when the suffix array is modified */
+    void index_suffix_links(bool enable = true);
+    bool has_suffix_links() const;
+    size_t suffix_links_bytes() const;
+
+    /* the bigrams of the large first word buckets, so that equal_range starts from the range of the first
+       two words of the n-gram: for each first word, bigram_index gives the range of its entries in
+       second_words, the sorted second words of its suffixes (0 if the suffix has one token), and
+       bigram_starts the suffix id where each one starts */
+    size_t bigram_table_bytes() const;
+    template <typename Token>
+    static void compute_bigram_table(const Token* tokens,
+                                     const offset_t* suffixes,
+                                     const offset_t* quick_vocab_access,
+                                     size_t vocab_size,
+                                     std::vector<offset_t>& bigram_index,
+                                     std::vector<unsigned>& second_words,
+                                     std::vector<offset_t>& bigram_starts);
+
+    /* removed sentences are only marked, and stay in the suffix array until it is compacted:
+       compaction renumbers the remaining sentences in their order */
+    void remove_sentence(size_t sentence_id);
+    bool is_removed(size_t sentence_id) const;
+    size_t num_removed() const;
+    void compact(size_t vocab_size);
+    /* sorted suffix array of the sentences [begin, end) of this sorted one, renumbered from 0 */
+    SuffixArray extract(size_t begin, size_t end, size_t vocab_size) const;
 
     std::ostream& dump(std::ostream&) const;
 
+    /* memory mapped index: the arrays are used in place, and copied on the first modification */
+    void save_mapped(MappedFileWriter&) const;
+    void load_mapped(MappedFileReader&);
+
     size_t num_sentences() const;
+    size_t num_suffixes() const;
 
-    const unsigned* get_sentence(size_t sentence_id, size_t* length = nullptr) const;
-    const unsigned* get_suffix(const SuffixView& p, size_t* length = nullptr) const;
-    const SuffixView& get_suffix_view(size_t suffix_id) const;
+    /* Token is uint16_t or unsigned, following token_bytes() */
+    template <typename Token>
+    const Token* get_sentence(size_t sentence_id, size_t* length = nullptr) const;
+    template <typename Token>
+    const Token* get_suffix(const SuffixView& p, size_t* length = nullptr) const;
+    /* function(tokens, length) with the tokens of the sentence, whichever their size */
+    template <typename Function>
+    auto visit_sentence(size_t sentence_id, Function&& function) const;
+    size_t sentence_length(size_t sentence_id) const;
+    SuffixView get_suffix_view(size_t suffix_id) const;
+    /* offset of the first token of the suffix in the sentence buffer */
+    size_t get_suffix_offset(size_t suffix_id) const;
+    /* true if the suffix a of this array is before the suffix b of other, whose sentences come after the ones of this array */
+    bool precedes(const SuffixView& a, const SuffixArray& other, const SuffixView& b) const;
     unsigned short get_sentence_length(size_t suffix_id) const;
+    /* sentence ids of the suffixes [begin, end), and the lengths of count sentences: the memory read
+       for each one is prefetched for all of them first, so that their cache misses overlap */
+    void get_sentence_ids(size_t begin, size_t end, unsigned* sentence_ids) const;
+    void get_sentence_lengths(const unsigned* sentence_ids, size_t count, unsigned* lengths) const;
 
-    /** range of suffixe starting with ngram; return an open range so the number of elemem is just reS.second-res.first **/
+    /** range of suffixe starting with ngram; return an open range so the number of elemem is just reS.second-res.first
+        when narrowing a previous range [min, max), matched_length is the number of leading tokens of ngram
+        shared by all its suffixes: these tokens are not compared again **/
     std::pair<size_t, size_t> equal_range(const unsigned* ngram,
                                           size_t length,
                                           size_t min = 0,
-                                          size_t max = 0) const;
+                                          size_t max = 0,
+                                          size_t matched_length = 0) const;
+    /** number of leading tokens of ngram shared by all the suffixes of the non empty range [min, max),
+        knowing that they share at least matched_length tokens **/
+    size_t shared_prefix_length(const unsigned* ngram,
+                                size_t length,
+                                size_t min,
+                                size_t max,
+                                size_t matched_length = 0) const;
+
+    /** for each start position of the pattern in increasing order, function(begin, end, length) with the
+        (possibly empty) ranges [begin, end) of the suffixes whose longest common prefix with the pattern
+        from this position is length, at least 2: first the ones where the n-gram ranges narrow, from the
+        shortest n-grams, then the range of the longest n-gram found. With the suffix links, the longest
+        n-gram range of each position is found from the one of the previous position, and the wider ranges
+        from the LCP array - binary searches otherwise **/
+    template <typename Function>
+    void visit_longest_prefixes(const unsigned* pattern, size_t length, Function&& function) const;
+
+    /* LLCP/RLCP of the binary search steps in a first word bucket, given the LCP array of its suffixes */
+    static void compute_lr_lcp(const unsigned short* lcp, size_t bucket_size,
+                               unsigned short* llcp, unsigned short* rlcp);
 
   private:
-    int comp(const SuffixView& a, const SuffixView& b) const;
-    void compute_sentence_length();
+    void sort_buckets(size_t vocab_size, size_t num_threads);
+    void sort_sais(size_t vocab_size);
+    void compute_quick_vocab_access(size_t vocab_size);
+    void shorten_tokens(size_t vocab_size);
+    void widen_tokens();
+    size_t buffer_size() const;
+    template <typename Token>
+    const Token* tokens() const;
+    template <typename Function>
+    auto visit_tokens(Function&& function) const;
+    int comp(offset_t a, offset_t b) const;
+    size_t get_sentence_id(size_t offset) const;
+    void compute_sentence_starts();
+    void compute_lcp();
+    void compute_lr_lcp();
+    void compute_prefix_cache();
+    void compute_bigram_table();
+    void compute_length_index();
+    void compute_sentence_listing();
+    void compute_suffix_links();
+    std::pair<size_t, size_t> lcp_interval(size_t begin, size_t end, size_t length) const;
+    size_t extend_prefix(const unsigned* pattern, size_t length, size_t matched_length,
+                         std::pair<size_t, size_t>& range) const;
+    bool bigram_range(const unsigned* ngram, size_t& min, size_t& max) const;
+    bool cached_before_bound(size_t suffix_id, const unsigned* ngram, size_t length, bool upper,
+                             size_t& lcp, bool& before) const;
+    static unsigned short compute_lr_lcp(const unsigned short* lcp, unsigned short* llcp, unsigned short* rlcp,
+                                         ptrdiff_t left, ptrdiff_t right, ptrdiff_t bucket_size);
+    template <typename Token>
+    size_t bucket_bound(const Token* tokens, const unsigned* ngram, size_t length,
+                        size_t begin, size_t end, bool upper) const;
+    template <typename Token>
+    size_t bound(const Token* tokens, const unsigned* ngram, size_t length, size_t begin, size_t end,
+                 size_t matched_length, bool upper) const;
     int start_by(const SuffixView& p, const unsigned* ngram, size_t length) const;
 
     bool _sorted = false;
 
-    // ordered sequence of sentence id, pos in sentence
-    std::vector<SuffixView>              _suffixes;
-    // the concatenated sentences, as 0-terminated sequences of vocab
-    std::vector<unsigned>         _sentence_buffer;
+    // ordered sequence of the suffix offsets in the sentence buffer
+    FlatArray<offset_t>         _suffixes;
+    // the concatenated sentences, as 0-terminated sequences of vocab - in _short_sentence_buffer instead
+    // when the tokens are stored on 2 bytes
+    FlatArray<unsigned>         _sentence_buffer;
+    FlatArray<uint16_t>         _short_sentence_buffer;
+    bool                        _short_tokens = false;
     // sentence id > position in sentence buffer
-    std::vector<unsigned>         _sentence_pos;
+    FlatArray<offset_t>         _sentence_pos;
     /* index first word in _sentences */
-    std::vector<unsigned>         _quickVocabAccess;
-    // cache friendly access to the sentence length associated with the prefix (used to speed up NGramMatches::register_ranges)
-    std::vector<unsigned short> _sentence_length;
+    FlatArray<offset_t>         _quickVocabAccess;
+    // one bit per offset in the sentence buffer, set at the start of each sentence: the sentence id of a suffix is
+    // the rank of its offset - only up to date when the array is sorted
+    RankBitVector               _sentence_starts;
+    // longest common prefix between the suffixes i-1 and i (0 for the first suffix)
+    FlatArray<unsigned short>   _lcp;
+    // longest common prefix between the middle suffix of a binary search step and its left/right boundary,
+    // the binary search tree being rooted at each first word bucket (see bucket_bound)
+    FlatArray<unsigned short>   _llcp;
+    FlatArray<unsigned short>   _rlcp;
+    // tokens 2 to _cached_tokens + 1 of each suffix, see cache_prefixes
+    uint64_t                    _cached_tokens = 0;
+    FlatArray<uint16_t>         _prefix_cache;
+    // see compute_bigram_table
+    FlatArray<offset_t>         _bigram_index;
+    FlatArray<unsigned>         _bigram_second_words;
+    FlatArray<offset_t>         _bigram_starts;
+    // see index_lengths
+    bool                        _index_lengths = false;
+    WaveletMatrix               _length_index;
+    // see index_sentence_listing
+    bool                        _index_sentence_listing = false;
+    RangeMinimum                _previous_suffixes;
+    // see index_suffix_links
+    bool                        _index_suffix_links = false;
+    FlatArray<offset_t>         _suffix_links;
+    RangeMinimum                _lcp_minima;
+    // tombstones of the removed sentences - empty if none
+    std::vector<bool>           _removed;
+    size_t                      _num_removed = 0;
+    // replaces _suffixes, _quickVocabAccess and the LCP arrays once compressed
+    FMIndex                     _fm_index;
+    bool                        _compressed = false;
 
     friend class boost::serialization::access;
 
@@ -72,6 +270,6 @@ namespace fuzzy
   };
 }
 
-BOOST_CLASS_VERSION(fuzzy::SuffixArray, 1)
+BOOST_CLASS_VERSION(fuzzy::SuffixArray, 2)
 
 #include "fuzzy/suffix_array.hxx"
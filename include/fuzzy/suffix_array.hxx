@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cassert>
 #include <stdexcept>
 
 namespace fuzzy
@@ -8,61 +10,476 @@ namespace fuzzy
     return _sentence_pos.size();
   }
 
+  inline size_t
+  SuffixArray::num_suffixes() const
+  {
+    return _compressed ? _fm_index.size() - _sentence_pos.size() : _suffixes.size();
+  }
+
+  inline bool
+  SuffixArray::is_sorted() const
+  {
+    return _sorted;
+  }
+
+  inline bool
+  SuffixArray::is_compressed() const
+  {
+    return _compressed;
+  }
+
+  inline bool
+  SuffixArray::is_removed(size_t sentence_id) const
+  {
+    return !_removed.empty() && _removed[sentence_id];
+  }
+
+  inline size_t
+  SuffixArray::num_removed() const
+  {
+    return _num_removed;
+  }
+
+  inline unsigned
+  SuffixArray::token_bytes() const
+  {
+    return _short_tokens ? sizeof (uint16_t) : sizeof (unsigned);
+  }
+
+  inline size_t
+  SuffixArray::cached_tokens() const
+  {
+    return _cached_tokens;
+  }
+
+  inline size_t
+  SuffixArray::prefix_cache_bytes() const
+  {
+    return _prefix_cache.size() * sizeof (uint16_t);
+  }
+
+  /* the suffix ends with the separator 0 */
+  template <typename Token>
+  inline void
+  SuffixArray::cache_prefix(const Token* suffix, size_t cached_tokens, uint16_t* cache)
+  {
+    std::fill(cache, cache + cached_tokens, 0);
+    for (size_t i = 1; i <= cached_tokens && suffix[i - 1] != 0; i++)
+      cache[i - 1] = std::min<unsigned>(suffix[i], PREFIX_CACHE_UNKNOWN);
+  }
+
+  inline bool
+  SuffixArray::has_length_index() const
+  {
+    return _length_index.size() > 0;
+  }
+
+  inline const WaveletMatrix&
+  SuffixArray::length_index() const
+  {
+    return _length_index;
+  }
+
+  inline size_t
+  SuffixArray::length_index_bytes() const
+  {
+    return _length_index.num_bytes();
+  }
+
+  inline bool
+  SuffixArray::has_sentence_listing() const
+  {
+    return _previous_suffixes.size() > 0;
+  }
+
+  inline size_t
+  SuffixArray::sentence_listing_bytes() const
+  {
+    return _previous_suffixes.num_bytes();
+  }
+
+  inline bool
+  SuffixArray::has_suffix_links() const
+  {
+    return _suffix_links.size() > 0;
+  }
+
+  inline size_t
+  SuffixArray::suffix_links_bytes() const
+  {
+    return _suffix_links.size() * sizeof (offset_t) + _lcp_minima.num_bytes();
+  }
+
+  /* the first suffix of a sentence in [begin, end) is the one whose previous suffix + 1 is below begin + 1 */
+  template <typename Function>
+  inline void
+  SuffixArray::visit_distinct_sentences(size_t begin, size_t end, Function&& function) const
+  {
+    _previous_suffixes.report_below(begin, end, begin + 1, [this, &function](size_t suffix_id) {
+      function(get_sentence_id(_suffixes[suffix_id]));
+    });
+  }
+
+  inline size_t
+  SuffixArray::bigram_table_bytes() const
+  {
+    return (_bigram_index.size() * sizeof (offset_t)
+            + _bigram_second_words.size() * sizeof (unsigned)
+            + _bigram_starts.size() * sizeof (offset_t));
+  }
+
+  /* the suffixes of a bucket are sorted on their second word, a suffix of one token being first */
+  template <typename Token>
+  inline void
+  SuffixArray::compute_bigram_table(const Token* tokens,
+                                    const offset_t* suffixes,
+                                    const offset_t* quick_vocab_access,
+                                    size_t vocab_size,
+                                    std::vector<offset_t>& bigram_index,
+                                    std::vector<unsigned>& second_words,
+                                    std::vector<offset_t>& bigram_starts)
+  {
+    bigram_index.assign(vocab_size + 1, 0);
+    second_words.clear();
+    bigram_starts.clear();
+    for (size_t wid = 0; wid < vocab_size; wid++)
+    {
+      bigram_index[wid] = second_words.size();
+      const size_t begin = quick_vocab_access[wid];
+      const size_t end = quick_vocab_access[wid + 1];
+      if (end - begin < BIGRAM_TABLE_MIN_BUCKET)
+        continue;
+      for (size_t suffix_id = begin; suffix_id < end; suffix_id++)
+      {
+        const unsigned second_word = tokens[suffixes[suffix_id] + 1];
+        if (suffix_id == begin || second_word != second_words.back())
+        {
+          second_words.push_back(second_word);
+          bigram_starts.push_back(suffix_id);
+        }
+      }
+    }
+    bigram_index[vocab_size] = second_words.size();
+  }
+
+  inline size_t
+  SuffixArray::buffer_size() const
+  {
+    return _short_tokens ? _short_sentence_buffer.size() : _sentence_buffer.size();
+  }
+
+  template<>
   inline const unsigned*
+  SuffixArray::tokens<unsigned>() const
+  {
+    assert(!_short_tokens);
+    return _sentence_buffer.data();
+  }
+
+  template<>
+  inline const uint16_t*
+  SuffixArray::tokens<uint16_t>() const
+  {
+    assert(_short_tokens);
+    return _short_sentence_buffer.data();
+  }
+
+  /* a single branch on the token size, the function being instantiated for both */
+  template <typename Function>
+  inline auto
+  SuffixArray::visit_tokens(Function&& function) const
+  {
+    if (_short_tokens)
+      return function(_short_sentence_buffer.data());
+    return function(_sentence_buffer.data());
+  }
+
+  template <typename Token>
+  inline const Token*
   SuffixArray::get_sentence(size_t sentence_id, size_t* length) const
   {
     const auto offset = _sentence_pos[sentence_id];
-    const auto* sentence = _sentence_buffer.data() + offset;
+    const auto* sentence = tokens<Token>() + offset;
     if (length)
       *length = *sentence;
     return sentence + 1;
   }
 
-  inline const unsigned*
+  template <typename Function>
+  inline auto
+  SuffixArray::visit_sentence(size_t sentence_id, Function&& function) const
+  {
+    return visit_tokens([this, sentence_id, &function](const auto* tokens) {
+      const auto* sentence = tokens + _sentence_pos[sentence_id];
+      return function(sentence + 1, size_t(*sentence));
+    });
+  }
+
+  inline size_t
+  SuffixArray::sentence_length(size_t sentence_id) const
+  {
+    const auto offset = _sentence_pos[sentence_id];
+    return _short_tokens ? _short_sentence_buffer[offset] : _sentence_buffer[offset];
+  }
+
+  template <typename Token>
+  inline const Token*
   SuffixArray::get_suffix(const SuffixView& p, size_t* length) const
   {
-    const auto* sentence = get_sentence(p.sentence_id, length);
+    const auto* sentence = get_sentence<Token>(p.sentence_id, length);
     const auto prefix_length = p.subsentence_pos - 1;
     if (length)
       *length -= prefix_length;
     return sentence + prefix_length;
   }
 
-  inline const SuffixView&
-  SuffixArray::get_suffix_view(size_t suffix_id) const
+  /* the rows of the FM-index start with one row per sentence separator */
+  inline size_t
+  SuffixArray::get_suffix_offset(size_t suffix_id) const
   {
+    if (_compressed)
+      return _fm_index.locate(suffix_id + _sentence_pos.size());
     return _suffixes[suffix_id];
   }
 
+  /* the sentence starts are not indexed while sentences are added to an unsorted array */
+  inline size_t
+  SuffixArray::get_sentence_id(size_t offset) const
+  {
+    if (_sentence_starts.size() == buffer_size())
+      return _sentence_starts.rank1(offset) - 1;
+    return std::upper_bound(_sentence_pos.begin(), _sentence_pos.end(), offset) - _sentence_pos.begin() - 1;
+  }
+
+  inline void
+  SuffixArray::get_sentence_ids(size_t begin, size_t end, unsigned* sentence_ids) const
+  {
+    if (_compressed || _sentence_starts.size() != buffer_size())
+    {
+      for (size_t suffix_id = begin; suffix_id < end; suffix_id++)
+        sentence_ids[suffix_id - begin] = get_sentence_id(get_suffix_offset(suffix_id));
+      return;
+    }
+    for (size_t suffix_id = begin; suffix_id < end; suffix_id++)
+      _sentence_starts.prefetch_rank1(_suffixes[suffix_id]);
+    for (size_t suffix_id = begin; suffix_id < end; suffix_id++)
+      sentence_ids[suffix_id - begin] = _sentence_starts.rank1(_suffixes[suffix_id]) - 1;
+  }
+
+  inline void
+  SuffixArray::get_sentence_lengths(const unsigned* sentence_ids, size_t count, unsigned* lengths) const
+  {
+    for (size_t i = 0; i < count; i++)
+      prefetch(_sentence_pos.data() + sentence_ids[i]);
+    visit_tokens([&](const auto* tokens) {
+      for (size_t i = 0; i < count; i++)
+        prefetch(tokens + _sentence_pos[sentence_ids[i]]);
+      for (size_t i = 0; i < count; i++)
+        lengths[i] = tokens[_sentence_pos[sentence_ids[i]]];
+    });
+  }
+
+  inline SuffixView
+  SuffixArray::get_suffix_view(size_t suffix_id) const
+  {
+    const auto offset = get_suffix_offset(suffix_id);
+    const auto sentence_id = get_sentence_id(offset);
+    return SuffixView{unsigned(sentence_id), (unsigned short)(offset - _sentence_pos[sentence_id])};
+  }
+
   inline unsigned short
   SuffixArray::get_sentence_length(size_t suffix_id) const
   {
-    return _sentence_length[suffix_id];
+    return sentence_length(get_sentence_id(get_suffix_offset(suffix_id)));
   }
 
 
+  template <typename Function>
+  inline void
+  SuffixArray::visit_longest_prefixes(const unsigned* pattern, size_t length, Function&& function) const
+  {
+    if (!has_suffix_links())
+    {
+      for (size_t it = 0; it < length; it++)
+      {
+        std::pair<size_t, size_t> previous_range(0, 0);
+        size_t subseq_length = 0;
+
+        while (it + subseq_length < length)
+        {
+          /* while all the suffixes of the range share the next tokens of the pattern (i.e. within a LCP interval),
+             the (n+1)-gram range is the n-gram range and there is nothing to visit: skip to the next branching */
+          if (subseq_length > 0)
+          {
+            subseq_length = shared_prefix_length(pattern + it, length - it,
+                                                 previous_range.first, previous_range.second, subseq_length);
+            if (it + subseq_length == length)
+              break;
+          }
+
+          ++subseq_length;
+          /*
+            the set of solution will be a decreasing range
+            pos-i     ngram
+            pos-i+1   ngram
+            pos-i+2   ngram   (n+1)gram
+            pos-i+3   ngram   (n+1)gram   (n+2)gram
+            pos-i+4   ngram   (n+1)gram
+            pos-i+5   ngram
+
+            and we will only keep the matches:
+            pos-i     ngram
+            pos-i+1   ngram
+            pos-i+2   (n+1)gram
+            pos-i+3   (n+2)gram
+            pos-i+4   (n+1)gram
+            pos-i+5   ngram
+          */
+          /* the previous range shares the first subseq_length-1 tokens: only the new one is compared */
+          std::pair<size_t, size_t> range = equal_range(pattern + it, subseq_length,
+                                                        previous_range.first, previous_range.second,
+                                                        subseq_length - 1);
+
+          if (range.first != range.second)
+          {
+            /* no unigrams */
+            if (subseq_length > 2)
+            {
+              /* (n-1) grams */
+              function(previous_range.first, range.first, subseq_length - 1);
+              function(range.second, previous_range.second, subseq_length - 1);
+            }
+
+            previous_range = std::move(range);
+          }
+          else
+          {
+            --subseq_length;
+            break;
+          }
+        }
+        if (subseq_length >= 2)
+          function(previous_range.first, previous_range.second, subseq_length);
+      }
+      return;
+    }
+
+    /* the longest n-gram range, and the LCP intervals around it down to the bigrams with their length */
+    std::vector<std::pair<size_t, size_t>> ranges;
+    std::vector<size_t> lengths;
+    std::pair<size_t, size_t> range(0, 0);
+    size_t matched_length = 0;
+    for (size_t it = 0; it < length; it++)
+    {
+      /* the suffix following the first one of the previous longest range starts with its n-gram
+         without the first token: its LCP interval is the range of this (n-1)-gram */
+      if (matched_length >= 2)
+      {
+        const size_t next_suffix = _suffix_links[range.first];
+        range = lcp_interval(next_suffix, next_suffix + 1, --matched_length);
+      }
+      else
+      {
+        range = equal_range(pattern + it, 1);
+        matched_length = range.first != range.second ? 1 : 0;
+      }
+      if (matched_length > 0)
+        matched_length = extend_prefix(pattern + it, length - it, matched_length, range);
+      if (matched_length < 2)
+        continue;
+
+      /* the suffixes before and after the range share fewer tokens, given by the LCP at its bounds */
+      ranges.assign(1, range);
+      lengths.clear();
+      while (true)
+      {
+        const auto child = ranges.back();
+        const size_t shared = std::max<size_t>(_lcp[child.first],
+                                               child.second < _lcp.size() ? _lcp[child.second] : 0);
+        if (shared < 2)
+          break;
+        ranges.push_back(lcp_interval(child.first, child.second, shared));
+        lengths.push_back(shared);
+      }
+      for (size_t i = lengths.size(); i-- > 0;)
+      {
+        function(ranges[i + 1].first, ranges[i].first, lengths[i]);
+        function(ranges[i].second, ranges[i + 1].second, lengths[i]);
+      }
+      function(range.first, range.second, matched_length);
+    }
+  }
+
   template<class Archive>
   void SuffixArray::save(Archive& archive, unsigned int) const
   {
+    const unsigned offset_bytes = sizeof (offset_t);
+    const unsigned token_bytes = this->token_bytes();
     archive
     & _sorted
-    & _suffixes
-    & _sentence_buffer
+    & offset_bytes
+    & token_bytes
+    & _suffixes;
+    if (_short_tokens)
+      archive & _short_sentence_buffer;
+    else
+      archive & _sentence_buffer;
+    archive
     & _sentence_pos
-    & _quickVocabAccess;
+    & _quickVocabAccess
+    & _lcp
+    & _removed
+    & _fm_index
+    & _cached_tokens
+    & _index_lengths
+    & _index_sentence_listing
+    & _index_suffix_links;
   }
 
   template<class Archive>
   void SuffixArray::load(Archive& archive, unsigned int version)
   {
-    if (version == 1)
+    _compressed = false;
+    _short_tokens = false;
+    // suffixes saved as SuffixView, with 32-bit offsets and 4-byte tokens, in the versions 0 and 1
+    std::vector<SuffixView> suffix_views;
+    unsigned offset_bytes = sizeof (uint32_t);
+    unsigned token_bytes = sizeof (unsigned);
+    if (version == 2)
+    {
+      archive
+      & _sorted
+      & offset_bytes
+      & token_bytes;
+      load_offsets(archive, _suffixes, offset_bytes);
+      _short_tokens = token_bytes == sizeof (uint16_t);
+      if (_short_tokens)
+        archive & _short_sentence_buffer;
+      else if (token_bytes == sizeof (unsigned))
+        archive & _sentence_buffer;
+      else
+        throw std::invalid_argument("Unsupported FMI format");
+      load_offsets(archive, _sentence_pos, offset_bytes);
+      load_offsets(archive, _quickVocabAccess, offset_bytes);
+      archive
+      & _lcp
+      & _removed
+      & _fm_index
+      & _cached_tokens
+      & _index_lengths
+      & _index_sentence_listing
+      & _index_suffix_links;
+      _num_removed = std::count(_removed.begin(), _removed.end(), true);
+      _compressed = _fm_index.size() > 0;
+    }
+    else if (version == 1)
     {
       archive
       & _sorted
-      & _suffixes
-      & _sentence_buffer
-      & _sentence_pos
-      & _quickVocabAccess;
+      & suffix_views
+      & _sentence_buffer;
+      load_offsets(archive, _sentence_pos, offset_bytes);
+      load_offsets(archive, _quickVocabAccess, offset_bytes);
     }
     else if (version == 0) // Old format using std::pair
     {
@@ -71,23 +488,44 @@ namespace fuzzy
       archive
       & _sorted
       & suffixes
-      & _sentence_buffer
-      & _sentence_pos
-      & _quickVocabAccess;
+      & _sentence_buffer;
+      load_offsets(archive, _sentence_pos, offset_bytes);
+      load_offsets(archive, _quickVocabAccess, offset_bytes);
 
-      _suffixes.reserve(suffixes.size());
+      suffix_views.reserve(suffixes.size());
       for (const auto& suffix : suffixes)
       {
         SuffixView suffixView;
         suffixView.sentence_id = suffix.first;
         suffixView.subsentence_pos = suffix.second;
-        _suffixes.push_back(suffixView);
+        suffix_views.push_back(suffixView);
       }
     }
     else
       throw std::invalid_argument("Unsupported FMI format");
 
-    compute_sentence_length();
+    if (!suffix_views.empty())
+    {
+      auto& suffixes = _suffixes.vector();
+      suffixes.reserve(suffix_views.size());
+      for (const auto& suffix : suffix_views)
+        suffixes.push_back(_sentence_pos[suffix.sentence_id] + suffix.subsentence_pos);
+    }
+
+    compute_sentence_starts();
+    if (_compressed)
+      return;
+    if (_sorted && _lcp.size() != _suffixes.size())
+      compute_lcp();
+    if (_sorted)
+    {
+      compute_lr_lcp();
+      compute_prefix_cache();
+      compute_bigram_table();
+      compute_length_index();
+      compute_sentence_listing();
+      compute_suffix_links();
+    }
   }
 
   template<class Archive>
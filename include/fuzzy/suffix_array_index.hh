@@ -1,6 +1,7 @@
 #pragma once
 
 #include <fstream>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -13,13 +14,22 @@
 namespace fuzzy
 {
   constexpr size_t DEFAULT_MAX_TOKENS_IN_PATTERN = 300; // if you change this value, update README.md
+  constexpr size_t DELTA_MERGE_RATIO = 8; // the delta is merged when it has more than 1/8 of the main array suffixes
   
   class SuffixArrayIndex
   {
   public:
     SuffixArrayIndex(size_t max_tokens_in_pattern = DEFAULT_MAX_TOKENS_IN_PATTERN);
 
-    const SuffixArray &get_SuffixArray() const;
+    /* the main suffix array can be split in shards of consecutive sentences, searched in parallel:
+       the sentence ids of a shard start at shard_offset(shard) */
+    size_t             num_shards() const;
+    const SuffixArray &get_shard(size_t shard) const;
+    size_t             shard_offset(size_t shard) const;
+    /* sentences added once the main suffix array is sorted go to a small sorted delta suffix array,
+       whose sentence ids start at delta_offset() - all the arrays must be searched */
+    const SuffixArray &get_delta_SuffixArray() const;
+    size_t             delta_offset() const;
     const VocabIndexer& get_VocabIndexer() const;
 
     int                add_tm(const std::string& id,
@@ -27,16 +37,60 @@ namespace fuzzy
                               const Tokens& norm_tokens,
                               bool sort = true);
 
-    void               sort();
-    const std::string& id(unsigned int index);
+    void               sort(SortAlgorithm algorithm = SortAlgorithm::BUCKET, size_t num_threads = 1);
+    void               merge_delta();
+    /* split the sorted sentences in num_shards shards of about the same number of tokens - the delta
+       is merged first, and the sentences added later go to the delta of the last shard. The files are
+       not sharded: the shards are merged again when the index is saved */
+    void               shard(size_t num_shards);
+    /* replace the sorted shards by FM-indexes, which stay compressed when they are merged or
+       sharded again - the delta is not compressed */
+    void               compress();
+    bool               is_compressed() const;
+    /* prefix cache of the shards, kept when they are merged or sharded again - the delta has
+       none. Returns the size of the caches in bytes */
+    size_t             cache_prefixes(size_t cached_tokens);
+    /* length index of the shards, as the prefix cache. Returns its size in bytes */
+    size_t             index_lengths(bool enable = true);
+    /* sentence listing of the shards, as the prefix cache. Returns its size in bytes */
+    size_t             index_sentence_listing(bool enable = true);
+    /* suffix links of the shards, as the prefix cache. Returns their size in bytes */
+    size_t             index_suffix_links(bool enable = true);
+    /* mark the sentences with this id as removed, returns their number - all the sentence ids are
+       compared, and a memory mapped index is first copied (see load_mapped) */
+    size_t             remove_tm(const std::string& id);
+    bool               is_removed(size_t s_id) const;
+    size_t             num_removed() const;
+    /* physically remove the marked sentences - the remaining sentence ids are renumbered */
+    void               compact();
+    std::string        id(unsigned int index) const;
     size_t             size() const;
-    const Sentence    &real_tokens(size_t s_id) const;
+    /* function(tokens, length) with the word ids of the sentence, on 2 or 4 bytes (see SuffixArray::token_bytes) */
+    template <typename Function>
+    auto               visit_sentence(size_t s_id, Function&& function) const;
+    size_t             sentence_length(size_t s_id) const;
+    Sentence           real_tokens(size_t s_id) const;
+    /* the same tokens as views of the index strings, without copying them */
+    void               real_tokens(size_t s_id, SentenceView& view) const;
+    /* true if the real tokens of the sentence have intermediate tokens (see Sentence::set_itok) */
+    bool               has_itoks(size_t s_id) const;
     std::string        sentence(size_t s_id) const;
     std::ostream&      dump(std::ostream& os) const;
 
     size_t max_tokens_in_pattern() const;
 
+    /* memory mapped index: the arrays are used in place in the mapping, which is kept alive with
+       the index - ids and real tokens are copied to _ids and _real_tokens on the first modification */
+    void save_mapped(MappedFileWriter&) const;
+    void load_mapped(MappedFileReader&, std::shared_ptr<const void> mapping);
+
   private:
+    void update_shard_offsets();
+    size_t find_shard(size_t s_id) const;
+    SuffixArray merged_shards() const;
+    void materialize();
+    void copy_mapped(std::vector<std::string>& ids, std::vector<Sentence>& real_tokens) const;
+
     friend class boost::serialization::access;
 
     template<class Archive>
@@ -48,10 +102,22 @@ namespace fuzzy
     BOOST_SERIALIZATION_SPLIT_MEMBER()
 
     VocabIndexer _vocabIndexer;
-    SuffixArray  _suffixArray;
+    std::vector<SuffixArray> _shards;
+    // _shard_offsets[i] is the first sentence id of shard i, the last one being the delta offset
+    std::vector<size_t>      _shard_offsets;
+    SuffixArray  _delta;
     std::vector<std::string> _ids;
     std::vector<Sentence>    _real_tokens;
     size_t _max_tokens_in_pattern;
+
+    bool                     _mapped = false;
+    std::shared_ptr<const void> _mapping;
+    FlatStrings              _mapped_ids;
+    FlatStrings              _mapped_tokens;
+    // intermediate tokens of sentence i are in [_mapped_itoks_begin[i], _mapped_itoks_begin[i+1])
+    FlatArray<uint64_t>      _mapped_itoks_begin;
+    FlatArray<uint64_t>      _mapped_itoks_pos;
+    FlatStrings              _mapped_itoks;
   };
 }
 
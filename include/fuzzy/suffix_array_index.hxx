@@ -1,9 +1,44 @@
+#include <algorithm>
+#include <utility>
+
 namespace fuzzy
 {
+  inline size_t
+  SuffixArrayIndex::num_shards() const
+  {
+    return _shards.size();
+  }
+
+  inline const SuffixArray&
+  SuffixArrayIndex::get_shard(size_t shard) const
+  {
+    return _shards[shard];
+  }
+
+  inline size_t
+  SuffixArrayIndex::shard_offset(size_t shard) const
+  {
+    return _shard_offsets[shard];
+  }
+
   inline const SuffixArray&
-  SuffixArrayIndex::get_SuffixArray() const
+  SuffixArrayIndex::get_delta_SuffixArray() const
+  {
+    return _delta;
+  }
+
+  inline size_t
+  SuffixArrayIndex::delta_offset() const
+  {
+    return _shard_offsets.back();
+  }
+
+  inline size_t
+  SuffixArrayIndex::find_shard(size_t s_id) const
   {
-    return _suffixArray;
+    if (_shards.size() == 1)
+      return s_id < _shard_offsets[1] ? 0 : 1;
+    return std::upper_bound(_shard_offsets.begin(), _shard_offsets.end(), s_id) - _shard_offsets.begin() - 1;
   }
 
   inline const VocabIndexer&
@@ -12,16 +47,47 @@ namespace fuzzy
     return _vocabIndexer;
   }
 
-  inline void
-  SuffixArrayIndex::sort()
+  inline size_t
+  SuffixArrayIndex::size() const
   {
-    _suffixArray.sort(_vocabIndexer.size());
+    return _mapped ? _mapped_ids.size() : _ids.size();
+  }
+
+  template <typename Function>
+  inline auto
+  SuffixArrayIndex::visit_sentence(size_t s_id, Function&& function) const
+  {
+    const auto shard = find_shard(s_id);
+    if (shard < _shards.size())
+      return _shards[shard].visit_sentence(s_id - _shard_offsets[shard], std::forward<Function>(function));
+    return _delta.visit_sentence(s_id - delta_offset(), std::forward<Function>(function));
   }
 
   inline size_t
-  SuffixArrayIndex::size() const
+  SuffixArrayIndex::sentence_length(size_t s_id) const
   {
-    return _ids.size();
+    const auto shard = find_shard(s_id);
+    if (shard < _shards.size())
+      return _shards[shard].sentence_length(s_id - _shard_offsets[shard]);
+    return _delta.sentence_length(s_id - delta_offset());
+  }
+
+  inline bool
+  SuffixArrayIndex::is_removed(size_t s_id) const
+  {
+    const auto shard = find_shard(s_id);
+    if (shard < _shards.size())
+      return _shards[shard].is_removed(s_id - _shard_offsets[shard]);
+    return _delta.is_removed(s_id - delta_offset());
+  }
+
+  inline size_t
+  SuffixArrayIndex::num_removed() const
+  {
+    size_t num_removed = _delta.num_removed();
+    for (const auto& shard : _shards)
+      num_removed += shard.num_removed();
+    return num_removed;
   }
 
   inline size_t
@@ -34,28 +100,43 @@ namespace fuzzy
   void
   SuffixArrayIndex::save(Archive& ar, unsigned int) const
   {
+    std::vector<std::string> mapped_ids;
+    std::vector<Sentence> mapped_real_tokens;
+    if (_mapped)
+      copy_mapped(mapped_ids, mapped_real_tokens);
+    SuffixArray merged;
+    if (_shards.size() > 1)
+      merged = merged_shards();
+
     ar
       & _vocabIndexer
-      & _suffixArray
-      & _ids
-      & _real_tokens
-      & _max_tokens_in_pattern;
+      & (_shards.size() > 1 ? merged : _shards[0])
+      & (_mapped ? mapped_ids : _ids)
+      & (_mapped ? mapped_real_tokens : _real_tokens)
+      & _max_tokens_in_pattern
+      & _delta;
   }
 
   template<class Archive>
   void
   SuffixArrayIndex::load(Archive& ar, unsigned int version)
   {
+    _mapped = false;
+    _shards.assign(1, SuffixArray());
+    _delta = SuffixArray();
     ar
       & _vocabIndexer
-      & _suffixArray
+      & _shards[0]
       & _ids
       & _real_tokens;
 
     if (version >= 1)
       ar & _max_tokens_in_pattern;
+    if (version >= 2)
+      ar & _delta;
+    update_shard_offsets();
   }
 
 }
 
-BOOST_CLASS_VERSION(fuzzy::SuffixArrayIndex, 1)
+BOOST_CLASS_VERSION(fuzzy::SuffixArrayIndex, 2)
@@ -6,6 +6,10 @@
 #include <ostream>
 
 #include <boost/serialization/serialization.hpp>
+#include <boost/serialization/split_member.hpp>
+
+#include <fuzzy/flat_array.hh>
+#include <fuzzy/mapped_file.hh>
 
 namespace fuzzy
 {
@@ -24,31 +28,66 @@ namespace fuzzy
 
     VocabIndexer::index_t                 addWord(const std::string& word);
     std::vector<VocabIndexer::index_t>    addWords(const std::vector<std::string>& ngram);
+    /* a sentence is removed: its words are no longer counted in sfreq */
+    void                                  removeWords(const std::vector<VocabIndexer::index_t>& ngram);
+    /* forget the forms of the words no longer in any sentence - their index is not reused */
+    void                                  purgeUnusedWords();
 
     VocabIndexer::index_t                 getIndex(const std::string& word) const;
     std::vector<VocabIndexer::index_t>    getIndex(const std::vector<std::string>& ngram) const;
 
-    const std::string&                    getWord(VocabIndexer::index_t) const;
+    std::string                           getWord(VocabIndexer::index_t) const;
 
     std::ostream&                         dump(std::ostream& os, size_t) const;
-    const std::vector<unsigned> &         getSFreq() const;
+    const FlatArray<unsigned> &           getSFreq() const;
+
+    /* a memory mapped vocabulary is looked up in an open addressing hash table, and is copied
+       to forms and form2index on the first modification */
+    void                                  save_mapped(MappedFileWriter&) const;
+    void                                  load_mapped(MappedFileReader&);
 
   private:
+    void                                  materialize();
+
     /* reverse index - only for debugging */
     std::vector<std::string>  forms;
     /* use for idf count, number of sentences where each word appear */
-    std::vector<unsigned>     sfreq;
+    FlatArray<unsigned>       sfreq;
     std::unordered_map<std::string, index_t> form2index;
 
+    bool                      _mapped = false;
+    FlatStrings               _mapped_forms;
+    // index + 1 of the word hashed in each slot, 0 if empty - the number of slots is a power of 2
+    FlatArray<index_t>        _mapped_slots;
+
     friend class boost::serialization::access;
 
     template<class Archive>
-    void serialize(Archive& ar, const unsigned int)
+    void save(Archive& ar, const unsigned int) const
     {
+      if (_mapped)
+      {
+        VocabIndexer vocab(*this);
+        vocab.materialize();
+        vocab.save(ar, 0);
+        return;
+      }
       ar &
       forms &
       sfreq &
       form2index;
     }
+
+    template<class Archive>
+    void load(Archive& ar, const unsigned int)
+    {
+      _mapped = false;
+      ar &
+      forms &
+      sfreq &
+      form2index;
+    }
+
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
   };
 }
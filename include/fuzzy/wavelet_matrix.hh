@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <boost/serialization/access.hpp>
+
+#include <fuzzy/bits.hh>
+#include <fuzzy/flat_array.hh>
+#include <fuzzy/mapped_file.hh>
+
+namespace fuzzy
+{
+  /* bit vector with constant time rank: the number of ones before each block of 512 bits is stored */
+  class RankBitVector
+  {
+  public:
+    RankBitVector(const std::vector<bool>& bits = {});
+    RankBitVector(std::vector<uint64_t> words, size_t size);
+
+    size_t size() const;
+    bool operator[](size_t i) const;
+    /* number of ones in [0, i) */
+    size_t rank1(size_t i) const;
+    /* loads in the cache what rank1(i) reads */
+    void prefetch_rank1(size_t i) const;
+    /* position of the k-th one (or zero), from 0: a binary search on the stored ranks */
+    size_t select1(size_t k) const;
+    size_t select0(size_t k) const;
+    size_t num_bytes() const;
+
+    void save_mapped(MappedFileWriter&) const;
+    void load_mapped(MappedFileReader&);
+
+  private:
+    void compute_ranks();
+
+    uint64_t            _size = 0;
+    FlatArray<uint64_t> _words;
+    FlatArray<uint64_t> _ranks;
+
+    friend class boost::serialization::access;
+
+    template<class Archive>
+    void serialize(Archive&, unsigned int version);
+  };
+
+  /* sequence of values of bits_per_value bits with access and rank in O(bits_per_value): the level l
+     holds the bit l (from the most significant one) of the values, stably sorted on their previous bits */
+  class WaveletMatrix
+  {
+  public:
+    WaveletMatrix() = default;
+    WaveletMatrix(const std::vector<unsigned>& values, unsigned bits_per_value);
+
+    size_t size() const;
+    unsigned bits_per_value() const;
+    unsigned operator[](size_t i) const;
+    /* number of occurrences of value in [0, i) */
+    size_t rank(unsigned value, size_t i) const;
+    /* both ranks of value at begin and end */
+    std::pair<size_t, size_t> rank(unsigned value, size_t begin, size_t end) const;
+    /* number of values in [min_value, max_value] at the positions [begin, end) */
+    size_t count(size_t begin, size_t end, unsigned min_value, unsigned max_value) const;
+    /* function(position) for each of these values, in no particular order: in time proportional to
+       their number, times the levels to go up to find their position */
+    template <typename Function>
+    void report(size_t begin, size_t end, unsigned min_value, unsigned max_value, Function&& function) const;
+    size_t num_bytes() const;
+
+    void save_mapped(MappedFileWriter&) const;
+    void load_mapped(MappedFileReader&);
+
+  private:
+    size_t rank1(size_t level, size_t i) const;
+    /* position in the level above of the position i of the level */
+    size_t parent_position(size_t level, size_t i) const;
+    template <typename Function>
+    void visit_nodes(size_t level, size_t begin, size_t end, uint64_t prefix,
+                     unsigned min_value, unsigned max_value, Function& function) const;
+
+    uint64_t            _size = 0;
+    uint64_t            _bits = 0;
+    // the levels one after the other
+    RankBitVector       _levels;
+    // number of ones before each level, and number of zeros in each level
+    FlatArray<uint64_t> _level_ones;
+    FlatArray<uint64_t> _zeros;
+
+    friend class boost::serialization::access;
+
+    template<class Archive>
+    void serialize(Archive&, unsigned int version);
+  };
+}
+
+#include <fuzzy/wavelet_matrix.hxx>
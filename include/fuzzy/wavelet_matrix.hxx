@@ -0,0 +1,247 @@
+#include <algorithm>
+
+namespace fuzzy
+{
+  inline void
+  prefetch(const void* address)
+  {
+#if defined(__GNUC__)
+    __builtin_prefetch(address);
+#else
+    (void)address;
+#endif
+  }
+
+  inline size_t
+  RankBitVector::size() const
+  {
+    return _size;
+  }
+
+  inline bool
+  RankBitVector::operator[](size_t i) const
+  {
+    return (_words[i / 64] >> (i % 64)) & 1;
+  }
+
+  inline size_t
+  RankBitVector::rank1(size_t i) const
+  {
+    size_t rank = _ranks[i / 512];
+    for (size_t word = i / 512 * 8; word < i / 64; word++)
+      rank += popcount64(_words[word]);
+    if (i % 64)
+      rank += popcount64(_words[i / 64] & ((uint64_t(1) << (i % 64)) - 1));
+    return rank;
+  }
+
+  inline void
+  RankBitVector::prefetch_rank1(size_t i) const
+  {
+    prefetch(_ranks.data() + i / 512);
+    prefetch(_words.data() + i / 512 * 8);
+    prefetch(_words.data() + i / 64);
+  }
+
+  inline size_t
+  RankBitVector::select1(size_t k) const
+  {
+    size_t block = std::upper_bound(_ranks.begin(), _ranks.end(), k) - _ranks.begin() - 1;
+    k -= _ranks[block];
+    for (size_t word = block * 8;; word++)
+    {
+      const unsigned ones = popcount64(_words[word]);
+      if (k < ones)
+        return word * 64 + select64(_words[word], k);
+      k -= ones;
+    }
+  }
+
+  /* the zeros before a block are its start minus its rank */
+  inline size_t
+  RankBitVector::select0(size_t k) const
+  {
+    size_t left = 0;
+    size_t right = _ranks.size();
+    while (right - left > 1)
+    {
+      const size_t mid = (left + right) / 2;
+      if (mid * 512 - _ranks[mid] <= k)
+        left = mid;
+      else
+        right = mid;
+    }
+    k -= left * 512 - _ranks[left];
+    for (size_t word = left * 8;; word++)
+    {
+      const unsigned zeros = 64 - popcount64(_words[word]);
+      if (k < zeros)
+        return word * 64 + select64(~_words[word], k);
+      k -= zeros;
+    }
+  }
+
+  inline size_t
+  RankBitVector::num_bytes() const
+  {
+    return (_words.size() + _ranks.size()) * sizeof (uint64_t);
+  }
+
+  template<class Archive>
+  void
+  RankBitVector::serialize(Archive& archive, unsigned int)
+  {
+    archive
+    & _size
+    & _words
+    & _ranks;
+  }
+
+  inline size_t
+  WaveletMatrix::size() const
+  {
+    return _size;
+  }
+
+  inline unsigned
+  WaveletMatrix::bits_per_value() const
+  {
+    return _bits;
+  }
+
+  inline size_t
+  WaveletMatrix::rank1(size_t level, size_t i) const
+  {
+    return _levels.rank1(level * _size + i) - _level_ones[level];
+  }
+
+  inline unsigned
+  WaveletMatrix::operator[](size_t i) const
+  {
+    unsigned value = 0;
+    for (size_t level = 0; level < _bits; level++)
+    {
+      const bool bit = _levels[level * _size + i];
+      const auto ones = rank1(level, i);
+      i = bit ? _zeros[level] + ones : i - ones;
+      value = (value << 1) | bit;
+    }
+    return value;
+  }
+
+  inline size_t
+  WaveletMatrix::rank(unsigned value, size_t i) const
+  {
+    return rank(value, 0, i).second;
+  }
+
+  /* the values before begin, equal to value, are the ones before start in the last level */
+  inline std::pair<size_t, size_t>
+  WaveletMatrix::rank(unsigned value, size_t begin, size_t end) const
+  {
+    if (_bits < 32 && (value >> _bits) != 0)
+      return std::pair<size_t, size_t>(0, 0);
+
+    size_t start = 0;
+    for (size_t level = 0; level < _bits; level++)
+    {
+      const bool bit = (value >> (_bits - 1 - level)) & 1;
+      const auto start_ones = rank1(level, start);
+      const auto begin_ones = rank1(level, begin);
+      const auto end_ones = rank1(level, end);
+      if (bit)
+      {
+        start = _zeros[level] + start_ones;
+        begin = _zeros[level] + begin_ones;
+        end = _zeros[level] + end_ones;
+      }
+      else
+      {
+        start -= start_ones;
+        begin -= begin_ones;
+        end -= end_ones;
+      }
+    }
+    return std::pair<size_t, size_t>(begin - start, end - start);
+  }
+
+  inline size_t
+  WaveletMatrix::parent_position(size_t level, size_t i) const
+  {
+    if (i < _zeros[level])
+      return _levels.select0(level * _size - _level_ones[level] + i) - level * _size;
+    return _levels.select1(_level_ones[level] + i - _zeros[level]) - level * _size;
+  }
+
+  /* the node of prefix at level covers the values [prefix << (bits - level), (prefix + 1) << (bits - level)):
+     function(level, begin, end) is called for the nodes within [min_value, max_value] */
+  template <typename Function>
+  inline void
+  WaveletMatrix::visit_nodes(size_t level, size_t begin, size_t end, uint64_t prefix,
+                             unsigned min_value, unsigned max_value, Function& function) const
+  {
+    if (begin == end)
+      return;
+    const uint64_t first = prefix << (_bits - level);
+    const uint64_t last = first + (uint64_t(1) << (_bits - level)) - 1;
+    if (last < min_value || first > max_value)
+      return;
+    if (min_value <= first && last <= max_value)
+    {
+      function(level, begin, end);
+      return;
+    }
+    const auto begin_ones = rank1(level, begin);
+    const auto end_ones = rank1(level, end);
+    visit_nodes(level + 1, begin - begin_ones, end - end_ones, prefix << 1,
+                min_value, max_value, function);
+    visit_nodes(level + 1, _zeros[level] + begin_ones, _zeros[level] + end_ones, (prefix << 1) | 1,
+                min_value, max_value, function);
+  }
+
+  inline size_t
+  WaveletMatrix::count(size_t begin, size_t end, unsigned min_value, unsigned max_value) const
+  {
+    size_t count = 0;
+    auto add = [&count](size_t, size_t begin, size_t end) {
+      count += end - begin;
+    };
+    visit_nodes(0, begin, end, 0, min_value, max_value, add);
+    return count;
+  }
+
+  template <typename Function>
+  inline void
+  WaveletMatrix::report(size_t begin, size_t end, unsigned min_value, unsigned max_value,
+                        Function&& function) const
+  {
+    auto report_node = [this, &function](size_t level, size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++)
+      {
+        size_t position = i;
+        for (size_t l = level; l > 0; l--)
+          position = parent_position(l - 1, position);
+        function(position);
+      }
+    };
+    visit_nodes(0, begin, end, 0, min_value, max_value, report_node);
+  }
+
+  inline size_t
+  WaveletMatrix::num_bytes() const
+  {
+    return _levels.num_bytes() + (_level_ones.size() + _zeros.size()) * sizeof (uint64_t);
+  }
+
+  template<class Archive>
+  void
+  WaveletMatrix::serialize(Archive& archive, unsigned int)
+  {
+    archive
+    & _size
+    & _bits
+    & _levels
+    & _level_ones
+    & _zeros;
+  }
+}
@@ -1,47 +1,135 @@
 #include <fuzzy/edit_distance.hh>
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+#include <fuzzy/bits.hh>
+
 namespace fuzzy
 {
+  /* diagonals i - j of the cells on the paths which may cost at most max_cost (Ukkonen): a path through
+     the diagonal d makes d deletions (or -d insertions) to get to it, and n1 - n2 - d more to get to the
+     last cell. The bound is widened by the rounding of the float sums of the steps. The band is empty
+     (first > second) when the length difference alone costs more */
+  static std::pair<int, int>
+  diagonal_band(int n1, int n2, float delete_step, float insert_step, float max_cost)
+  {
+    if (max_cost == std::numeric_limits<float>::max() || delete_step < 0 || insert_step < 0)
+      return std::make_pair(-n2, n1);
+    const double bound = max_cost * (1 + (n1 + n2 + 2) * double(std::numeric_limits<float>::epsilon()));
+    const auto steps_cost = [delete_step, insert_step](int d) {
+      return d > 0 ? d * double(delete_step) : -d * double(insert_step);
+    };
+    std::pair<int, int> band(n1 + 1, -n2 - 1);
+    for (int d = -n2; d <= n1; d++)
+      if (steps_cost(d) + steps_cost(n1 - n2 - d) <= bound)
+      {
+        band.first = std::min(band.first, d);
+        band.second = d;
+      }
+    return band;
+  }
+
+  /* cost of the length difference, which the paths outside of an empty band cost at least */
+  static float
+  length_difference_cost(int n1, int n2, float delete_step, float insert_step)
+  {
+    return n1 > n2 ? (n1 - n2) * delete_step : (n2 - n1) * insert_step;
+  }
+
+  /* the rows are computed one after the other, on the columns of the band: the cells around it are set
+     to infinity for the next row, except the first column which is always computed */
+  template <typename Token>
   float
-  _edit_distance(const unsigned* s1, const Sentence &real1, int n1,
+  _edit_distance(const Token* s1, const Sentence &real1, int n1,
                  const unsigned* s2, const Tokens &real2tok, int n2,
                  const std::vector<const char*>& st2, const std::vector<int>& sn2,
                  const std::vector<float> &idf_penalty, float idf_weight,
                  const EditCosts& edit_costs,
                  const Costs& costs,
-                 float max_fuzzyness)
+                 float max_fuzzyness,
+                 EditDistanceWorkspace* workspace)
   {
-    boost::multi_array<float, 2> arr(boost::extents[n1+1][n2+1]);
-    boost::multi_array<int, 2> cost_tag(boost::extents[n1+1][n2+1]);
+    EditDistanceWorkspace local_workspace;
+    if (!workspace)
+      workspace = &local_workspace;
+    workspace->sentence.assign(real1, n1);
+    return _edit_distance(s1, workspace->sentence, n1, s2, real2tok, n2, st2, sn2,
+                          idf_penalty, idf_weight, edit_costs, costs, max_fuzzyness, *workspace);
+  }
+
+  template <typename Token>
+  float
+  _edit_distance(const Token* s1, const SentenceView &real1, int n1,
+                 const unsigned* s2, const Tokens &real2tok, int n2,
+                 const std::vector<const char*>& st2, const std::vector<int>& sn2,
+                 const std::vector<float> &idf_penalty, float idf_weight,
+                 const EditCosts& edit_costs,
+                 const Costs& costs,
+                 float max_fuzzyness,
+                 EditDistanceWorkspace& workspace)
+  {
+    const float delete_step = costs.diff_word * edit_costs.delete_cost;
+    const float insert_step = costs.diff_word * edit_costs.insert_cost;
+    /* a negative idf weight makes the insertions cheaper: no band */
+    const auto band = diagonal_band(n1, n2, delete_step, insert_step,
+                                    idf_weight < 0 ? std::numeric_limits<float>::max() : max_fuzzyness);
+    if (band.first > band.second)
+      return length_difference_cost(n1, n2, delete_step, insert_step);
+
+    /* arr[i-1] and arr[i] of the distance matrix, and the same rows of the intermediate token costs:
+       the cells read are the ones written for this sentence */
+    auto& previous = workspace.previous;
+    auto& current = workspace.current;
+    auto& previous_tag = workspace.previous_tag;
+    auto& current_tag = workspace.current_tag;
+    auto& char_distances = workspace.char_distances;
+    previous.resize(n2+1);
+    current.resize(n2+1);
+    previous_tag.resize(n2+1);
+    current_tag.resize(n2+1);
     /* idf_penalty(w) = log(nbre seqs / nbre occ w) */ 
     /* idf_weight = weight * costs.diff_word / log(nbre seqs) */ 
 
-    std::vector<const char*> st1(n1+1, nullptr);
-    std::vector<int> sn1(n1+1, 0);
-    real1.get_itoks(st1, sn1);
-    Tokens real1tok = (Tokens)real1;
+    const auto& st1 = real1.st;
+    const auto& sn1 = real1.sn;
+    const auto& real1tok = real1.tokens;
 
     /* we have a fixed cost corresponding to trailing penalty_tokens */
-    arr[0][0] = _edit_distance_char(st1[n1], sn1[n1], st2[n2], sn2[n2]);
-    cost_tag[0][0] = _edit_distance_char(st1[0], sn1[0], st2[0], sn2[0]);
+    previous[0] = _edit_distance_char(st1[n1], sn1[n1], st2[n2], sn2[n2], char_distances);
+    previous_tag[0] = _edit_distance_char(st1[0], sn1[0], st2[0], sn2[0], char_distances);
 
-    for (int i = 1; i < n1 + 1; i++) {
-      /* initialize distance source side (real1) */
-      arr[i][0] = arr[i-1][0] + costs.diff_word * edit_costs.delete_cost + sn1[i];
-      cost_tag[i][0] = _edit_distance_char(st1[i], sn1[i], st2[0], sn2[0]);
-    }
     for (int j = 1; j < n2 + 1; j++) {
       /* initialize distance target side (real2tok) */
-      arr[0][j] = arr[0][j-1] + costs.diff_word * edit_costs.insert_cost + sn2[j];
+      previous[j] = previous[j-1] + costs.diff_word * edit_costs.insert_cost + sn2[j];
       if (idf_weight)
-        arr[0][j] += idf_penalty[j-1] * idf_weight;
-      cost_tag[0][j] = _edit_distance_char(st1[0], sn1[0], st2[j], sn2[j]);
+        previous[j] += idf_penalty[j-1] * idf_weight;
+      previous_tag[j] = _edit_distance_char(st1[0], sn1[0], st2[j], sn2[j], char_distances);
     }
 
     for (int i = 1; i < n1 + 1; i++)
     {
-      float min = std::numeric_limits<float>::max();
-      for (int j = 1; j < n2 + 1; j++)
+      /* distance source side (real1) */
+      current[0] = previous[0] + costs.diff_word * edit_costs.delete_cost + sn1[i];
+      current_tag[0] = _edit_distance_char(st1[i], sn1[i], st2[0], sn2[0], char_distances);
+      // the paths may also come from the first column
+      float min = current[0];
+
+      const int first = std::max(1, i - band.second);
+      const int last = std::min(n2, i - band.first);
+      if (first <= last)
+      {
+        if (first > 1)
+          current[first - 1] = std::numeric_limits<float>::infinity();
+        if (last < n2)
+          current[last + 1] = std::numeric_limits<float>::infinity();
+      }
+      for (int j = first; j <= last; j++)
       {
         float diff = 0;
         float penalty_j1 = 0;
@@ -52,52 +140,82 @@ namespace fuzzy
         }
         else if (real1tok[i-1] != real2tok[j-1]) {
           /* is difference only a case difference */
-          if (strchr("LUMC", real1tok[i-1][0]))
+          if (strchr("LUMC", real1tok[i-1].empty() ? '\0' : real1tok[i-1][0]))
             diff = edit_costs.replace_cost * costs.diff_case;
           else {
             diff = edit_costs.replace_cost * costs.diff_real;
           }
         }
 
-        cost_tag[i][j] = _edit_distance_char(st1[i], sn1[i], st2[j], sn2[j]);
+        current_tag[j] = _edit_distance_char(st1[i], sn1[i], st2[j], sn2[j], char_distances);
         const auto distance = std::min(
           {
-            arr[i - 1][j] + edit_costs.delete_cost * costs.diff_word + cost_tag[i - 1][j],
-            arr[i][j - 1] + edit_costs.insert_cost * costs.diff_word + cost_tag[i][j - 1] + penalty_j1,
-            arr[i - 1][j - 1] + diff + cost_tag[i - 1][j - 1]
+            previous[j] + edit_costs.delete_cost * costs.diff_word + previous_tag[j],
+            current[j - 1] + edit_costs.insert_cost * costs.diff_word + current_tag[j - 1] + penalty_j1,
+            previous[j - 1] + diff + previous_tag[j - 1]
           });
 
-        arr[i][j] = distance;
+        current[j] = distance;
         min = std::min(min, distance);
       }
       if (min > max_fuzzyness)
         return min;
+      previous.swap(current);
+      previous_tag.swap(current_tag);
     }
-    return arr[n1][n2];
+    return previous[n2];
   }
 
+  template <typename Token1, typename Token2>
   float
-  _edit_distance(const unsigned* s1, int n1,
-                 const unsigned* s2, int n2,
+  _edit_distance(const Token1* s1, int n1,
+                 const Token2* s2, int n2,
                  const EditCosts& edit_costs,
                  const Costs& costs,
-                 float max_fuzzyness)
+                 float max_fuzzyness,
+                 EditDistanceWorkspace* workspace)
   {
-    boost::multi_array<float, 2> arr(boost::extents[n1+1][n2+1]);
+    /* a single comparison: the pattern is not reused */
+    if (edit_costs.is_unit() && max_fuzzyness == std::numeric_limits<float>::max())
+      return _edit_distance(s1, n1, BitParallelPattern(s2, n2), costs, workspace);
 
-    for (int i = 1; i < n1 + 1; i++) {
-      /* initialize distance source side (real1) */
-      arr[i][0] = arr[i-1][0] + costs.diff_word * edit_costs.delete_cost;
-    }
+    const float delete_step = costs.diff_word * edit_costs.delete_cost;
+    const float insert_step = costs.diff_word * edit_costs.insert_cost;
+    const auto band = diagonal_band(n1, n2, delete_step, insert_step, max_fuzzyness);
+    if (band.first > band.second)
+      return length_difference_cost(n1, n2, delete_step, insert_step);
+
+    EditDistanceWorkspace local_workspace;
+    if (!workspace)
+      workspace = &local_workspace;
+    auto& previous = workspace->previous;
+    auto& current = workspace->current;
+    previous.resize(n2+1);
+    current.resize(n2+1);
+
+    previous[0] = 0;
     for (int j = 1; j < n2 + 1; j++) {
       /* initialize distance target side (real2tok) */
-      arr[0][j] = arr[0][j-1] + costs.diff_word * edit_costs.insert_cost;
+      previous[j] = previous[j-1] + costs.diff_word * edit_costs.insert_cost;
     }
 
     for (int i = 1; i < n1 + 1; i++)
     {
-      float min = std::numeric_limits<float>::max();
-      for (int j = 1; j < n2 + 1; j++)
+      /* distance source side (real1) */
+      current[0] = previous[0] + costs.diff_word * edit_costs.delete_cost;
+      // the paths may also come from the first column
+      float min = current[0];
+
+      const int first = std::max(1, i - band.second);
+      const int last = std::min(n2, i - band.first);
+      if (first <= last)
+      {
+        if (first > 1)
+          current[first - 1] = std::numeric_limits<float>::infinity();
+        if (last < n2)
+          current[last + 1] = std::numeric_limits<float>::infinity();
+      }
+      for (int j = first; j <= last; j++)
       {
         float diff = 0;
 
@@ -107,17 +225,560 @@ namespace fuzzy
 
         const auto distance = std::min(
           {
-            arr[i - 1][j] + edit_costs.delete_cost * costs.diff_word,
-            arr[i][j - 1] + edit_costs.insert_cost * costs.diff_word,
-            arr[i - 1][j - 1] + diff
+            previous[j] + edit_costs.delete_cost * costs.diff_word,
+            current[j - 1] + edit_costs.insert_cost * costs.diff_word,
+            previous[j - 1] + diff
           });
 
-        arr[i][j] = distance;
+        current[j] = distance;
         min = std::min(min, distance);
       }
       if (min > max_fuzzyness)
         return min;
+      previous.swap(current);
+    }
+    return previous[n2];
+  }
+
+  template <typename Token>
+  BitParallelPattern::BitParallelPattern(const Token* pattern, int length)
+    : _length(length)
+    , _num_blocks((length + 63) / 64)
+    , _tokens(pattern, pattern + length)
+    , _no_matches(_num_blocks, 0)
+  {
+    std::sort(_tokens.begin(), _tokens.end());
+    _tokens.erase(std::unique(_tokens.begin(), _tokens.end()), _tokens.end());
+    _masks.assign(_tokens.size() * _num_blocks, 0);
+    for (int i = 0; i < length; i++)
+    {
+      const size_t token = std::lower_bound(_tokens.begin(), _tokens.end(), pattern[i]) - _tokens.begin();
+      _masks[token * _num_blocks + i / 64] |= uint64_t(1) << (i % 64);
+    }
+  }
+
+  int
+  BitParallelPattern::length() const
+  {
+    return _length;
+  }
+
+  inline const uint64_t*
+  BitParallelPattern::match_masks(unsigned token) const
+  {
+    const auto it = std::lower_bound(_tokens.begin(), _tokens.end(), token);
+    if (it == _tokens.end() || *it != token)
+      return _no_matches.data();
+    return _masks.data() + (it - _tokens.begin()) * _num_blocks;
+  }
+
+  /* one column of the distance matrix on a block of 64 rows: its vertical differences are the bits of
+     positive (+1) and negative (-1), updated from the rows matching the sentence token and the horizontal
+     difference above the block (-1, 0 or 1). The horizontal differences of the rows are set, the one of the
+     last row being the difference above the next block */
+  static inline void
+  advance_block(uint64_t& positive, uint64_t& negative, uint64_t matches, int difference_above,
+                uint64_t& h_positive, uint64_t& h_negative)
+  {
+    const uint64_t above_negative = difference_above < 0;
+    const uint64_t above_positive = difference_above > 0;
+    const uint64_t x_v = matches | negative;
+    matches |= above_negative;
+    const uint64_t x_h = (((matches & positive) + positive) ^ positive) | matches;
+    h_positive = negative | ~(x_h | positive);
+    h_negative = positive & x_h;
+    const uint64_t shifted_positive = (h_positive << 1) | above_positive;
+    const uint64_t shifted_negative = (h_negative << 1) | above_negative;
+    positive = shifted_negative | ~(x_v | shifted_positive);
+    negative = shifted_positive & x_v;
+  }
+
+  /* the first column is 0..length (all the vertical differences are +1), and the first row goes up by 1
+     at each column: the distance is the last row, followed from its horizontal differences */
+  template <typename Token>
+  int
+  BitParallelPattern::distance(const Token* sentence, int length, EditDistanceWorkspace* workspace) const
+  {
+    const unsigned last_row = (_length + 63) % 64;
+    int distance = _length;
+
+    if (_num_blocks == 1)
+    {
+      uint64_t positive = ~uint64_t(0);
+      uint64_t negative = 0;
+      for (int j = 0; j < length; j++)
+      {
+        uint64_t h_positive = 0;
+        uint64_t h_negative = 0;
+        advance_block(positive, negative, match_masks(sentence[j])[0], 1, h_positive, h_negative);
+        distance += int((h_positive >> last_row) & 1) - int((h_negative >> last_row) & 1);
+      }
+      return distance;
+    }
+    if (_num_blocks == 0)
+      return length;
+
+    EditDistanceWorkspace local_workspace;
+    if (!workspace)
+      workspace = &local_workspace;
+    auto& positive = workspace->positive;
+    auto& negative = workspace->negative;
+    positive.assign(_num_blocks, ~uint64_t(0));
+    negative.assign(_num_blocks, 0);
+    for (int j = 0; j < length; j++)
+    {
+      const uint64_t* masks = match_masks(sentence[j]);
+      int difference = 1;
+      uint64_t h_positive = 0;
+      uint64_t h_negative = 0;
+      for (size_t block = 0; block < _num_blocks; block++)
+      {
+        advance_block(positive[block], negative[block], masks[block], difference, h_positive, h_negative);
+        difference = int(h_positive >> 63) - int(h_negative >> 63);
+      }
+      distance += int((h_positive >> last_row) & 1) - int((h_negative >> last_row) & 1);
+    }
+    return distance;
+  }
+
+  /* the bits of the pattern positions which are not in a longest common subsequence of the sentence
+     prefix are set, the matches of each sentence token being pushed to the next set bit of their runs
+     of 1s by an addition, carried from one block to the next */
+  template <typename Token>
+  int
+  BitParallelPattern::lcs_length(const Token* sentence, int length, EditDistanceWorkspace* workspace) const
+  {
+    if (_num_blocks == 0)
+      return 0;
+    const unsigned last_row = (_length + 63) % 64;
+    const uint64_t last_mask = last_row == 63 ? ~uint64_t(0) : (uint64_t(1) << (last_row + 1)) - 1;
+
+    if (_num_blocks == 1)
+    {
+      uint64_t v = ~uint64_t(0);
+      for (int j = 0; j < length; j++)
+      {
+        const uint64_t u = v & match_masks(sentence[j])[0];
+        v = (v + u) | (v - u);
+      }
+      return _length - popcount64(v & last_mask);
+    }
+
+    EditDistanceWorkspace local_workspace;
+    if (!workspace)
+      workspace = &local_workspace;
+    auto& v = workspace->positive;
+    v.assign(_num_blocks, ~uint64_t(0));
+    for (int j = 0; j < length; j++)
+    {
+      const uint64_t* masks = match_masks(sentence[j]);
+      uint64_t carry = 0;
+      for (size_t block = 0; block < _num_blocks; block++)
+      {
+        const uint64_t u = v[block] & masks[block];
+        const uint64_t sum = v[block] + u + carry;
+        carry = sum < v[block] || (carry && sum == v[block]);
+        v[block] = sum | (v[block] - u);
+      }
+    }
+    int not_common = 0;
+    for (size_t block = 0; block + 1 < _num_blocks; block++)
+      not_common += popcount64(v[block]);
+    return _length - not_common - popcount64(v.back() & last_mask);
+  }
+
+  /* the dynamic programming adds diff_word once per edit: the sum is the same, to the last bit */
+  template <typename Token>
+  float
+  _edit_distance(const Token* s1, int n1,
+                 const BitParallelPattern& s2,
+                 const Costs& costs,
+                 EditDistanceWorkspace* workspace)
+  {
+    const int num_edits = s2.distance(s1, n1, workspace);
+    float cost = 0;
+    for (int i = 0; i < num_edits; i++)
+      cost += costs.diff_word;
+    return cost;
+  }
+
+  /* the dynamic programming adds the steps of a cheapest path one at a time: when its deletions, insertions
+     and replacements all cost the same, or one of them is free, their sum does not depend on their order and is
+     computed here. Otherwise the sum is rounded differently along each path, so that only a cost above the
+     bound, widened by the rounding, is computed from the subsequence - the other ones are computed by the
+     dynamic programming, on the band of the bound */
+  template <typename Token>
+  float
+  _lcs_edit_distance(const Token* thes, int slen,
+                     const unsigned* thep,
+                     const BitParallelPattern& p,
+                     const EditCosts& edit_costs,
+                     const Costs& costs,
+                     float max_fuzzyness,
+                     EditDistanceWorkspace* workspace)
+  {
+    const int lcs_length = p.lcs_length(thes, slen, workspace);
+    const int deletions = slen - lcs_length;
+    const int insertions = p.length() - lcs_length;
+    const float delete_step = costs.diff_word * edit_costs.delete_cost;
+    const float insert_step = costs.diff_word * edit_costs.insert_cost;
+    const bool same_steps = (deletions == 0 || insertions == 0 || delete_step == 0 || insert_step == 0
+                             || (delete_step == insert_step
+                                 && edit_costs.replace_cost > edit_costs.insert_cost + edit_costs.delete_cost));
+    if (!same_steps)
+    {
+      const double cost = deletions * double(delete_step) + insertions * double(insert_step);
+      if (max_fuzzyness != std::numeric_limits<float>::max()
+          && cost > max_fuzzyness * (1 + (slen + p.length() + 2) * double(std::numeric_limits<float>::epsilon())))
+        return float(cost);
+      return _edit_distance(thes, slen, thep, p.length(), edit_costs, costs, max_fuzzyness, workspace);
+    }
+    float cost = 0;
+    for (int i = 0; i < deletions; i++)
+      cost += delete_step;
+    for (int j = 0; j < insertions; j++)
+      cost += insert_step;
+    return cost;
+  }
+
+  /* the lanes are only passed by reference to the functions below, which write their result in their
+     first argument: a vector of the AVX2 clone is never passed or returned by value to the default target.
+     They are always inlined, so that they are compiled for the target of their caller */
+#if defined(__GNUC__)
+#  define FUZZY_LANES_INLINE inline __attribute__((always_inline))
+  typedef int32_t Lanes __attribute__((vector_size(EDIT_DISTANCE_LANES * sizeof (int32_t))));
+
+  static FUZZY_LANES_INLINE void
+  lanes_min(Lanes& min, const Lanes& a, const Lanes& b)
+  {
+    min = a < b ? a : b;
+  }
+
+  static FUZZY_LANES_INLINE void
+  lanes_broadcast(Lanes& lanes, int32_t value)
+  {
+    lanes = Lanes{} + value;
+  }
+
+  /* cost in the lanes whose token is not token, 0 in the others */
+  static FUZZY_LANES_INLINE void
+  lanes_mismatch_cost(Lanes& mismatch, const Lanes& tokens, const Lanes& token, const Lanes& cost)
+  {
+    mismatch = cost & (tokens != token);
+  }
+#else
+#  define FUZZY_LANES_INLINE inline
+
+  struct Lanes
+  {
+    int32_t lane[EDIT_DISTANCE_LANES];
+
+    int32_t& operator[](int i) { return lane[i]; }
+    int32_t operator[](int i) const { return lane[i]; }
+  };
+
+  static FUZZY_LANES_INLINE Lanes
+  operator+(const Lanes& a, const Lanes& b)
+  {
+    Lanes sum;
+    for (int i = 0; i < EDIT_DISTANCE_LANES; i++)
+      sum[i] = a[i] + b[i];
+    return sum;
+  }
+
+  static FUZZY_LANES_INLINE void
+  lanes_min(Lanes& min, const Lanes& a, const Lanes& b)
+  {
+    for (int i = 0; i < EDIT_DISTANCE_LANES; i++)
+      min[i] = std::min(a[i], b[i]);
+  }
+
+  static FUZZY_LANES_INLINE void
+  lanes_broadcast(Lanes& lanes, int32_t value)
+  {
+    for (int i = 0; i < EDIT_DISTANCE_LANES; i++)
+      lanes[i] = value;
+  }
+
+  static FUZZY_LANES_INLINE void
+  lanes_mismatch_cost(Lanes& mismatch, const Lanes& tokens, const Lanes& token, const Lanes& cost)
+  {
+    for (int i = 0; i < EDIT_DISTANCE_LANES; i++)
+      mismatch[i] = tokens[i] != token[i] ? cost[i] : 0;
+  }
+#endif
+
+  /* the lanes are loaded and stored by copy, lane_columns not being aligned on their size */
+  static FUZZY_LANES_INLINE void
+  load_lanes(Lanes& lanes, const int32_t* data)
+  {
+    std::memcpy(&lanes, data, sizeof (Lanes));
+  }
+
+  static FUZZY_LANES_INLINE void
+  store_lanes(int32_t* data, const Lanes& lanes)
+  {
+    std::memcpy(data, &lanes, sizeof (Lanes));
+  }
+
+  /* on x86-64 Linux, the function is also compiled for AVX2 and chosen when loading the library */
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__)
+#  define FUZZY_LANES_TARGETS __attribute__((target_clones("avx2", "default")))
+#else
+#  define FUZZY_LANES_TARGETS
+#endif
+
+  /* the next row of each lane, whose sentence token is in tokens: columns[j] holds the lanes of the
+     column j of the previous row, replaced by the ones of the new row, and row_minimum their minimum.
+     pattern holds each pattern token in all the lanes */
+  FUZZY_LANES_TARGETS
+  static void
+  advance_lanes(int32_t* columns, const int32_t* pattern, int length, const int32_t* tokens,
+                int32_t insert_units, int32_t delete_units, int32_t replace_units,
+                int32_t* row_minimum)
+  {
+    Lanes sentence_tokens;
+    Lanes insert_cost;
+    Lanes delete_cost;
+    Lanes replace_cost;
+    load_lanes(sentence_tokens, tokens);
+    lanes_broadcast(insert_cost, insert_units);
+    lanes_broadcast(delete_cost, delete_units);
+    lanes_broadcast(replace_cost, replace_units);
+
+    Lanes diagonal;
+    load_lanes(diagonal, columns);
+    Lanes left = diagonal + delete_cost;
+    Lanes minimum = left;
+    store_lanes(columns, left);
+    for (int j = 1; j <= length; j++)
+    {
+      int32_t* column = columns + j * EDIT_DISTANCE_LANES;
+      Lanes above;
+      Lanes pattern_tokens;
+      Lanes mismatch;
+      load_lanes(above, column);
+      load_lanes(pattern_tokens, pattern + (j - 1) * EDIT_DISTANCE_LANES);
+      lanes_mismatch_cost(mismatch, sentence_tokens, pattern_tokens, replace_cost);
+      lanes_min(left, above + delete_cost, left + insert_cost);
+      lanes_min(left, left, diagonal + mismatch);
+      lanes_min(minimum, minimum, left);
+      store_lanes(column, left);
+      diagonal = above;
     }
-    return arr[n1][n2];
+    store_lanes(row_minimum, minimum);
   }
+
+  bool
+  BatchPattern::supports(const EditCosts& edit_costs)
+  {
+    if (edit_costs.insert_cost < 0 || edit_costs.delete_cost < 0 || edit_costs.replace_cost < 0
+        || edit_costs.is_null())
+      return false;
+    for (int scale = 1; scale <= 64; scale++)
+    {
+      bool integers = true;
+      for (const float cost : {edit_costs.insert_cost, edit_costs.delete_cost, edit_costs.replace_cost})
+        integers = integers && cost * scale == std::round(cost * scale) && cost * scale <= 64;
+      if (integers)
+        return true;
+    }
+    return false;
+  }
+
+  /* the unit is the smallest one which divides the costs, or the cost when they are uniform */
+  template <typename Token>
+  BatchPattern::BatchPattern(const Token* pattern, int length, const EditCosts& edit_costs)
+    : _tokens(pattern, pattern + length)
+    , _edit_costs(edit_costs)
+  {
+    _lane_tokens.reserve(length * EDIT_DISTANCE_LANES);
+    for (int j = 0; j < length; j++)
+      _lane_tokens.insert(_lane_tokens.end(), EDIT_DISTANCE_LANES, int32_t(pattern[j]));
+    const float max_cost = std::max({edit_costs.insert_cost, edit_costs.delete_cost, edit_costs.replace_cost});
+    _uniform = true;
+    for (const float cost : {edit_costs.insert_cost, edit_costs.delete_cost, edit_costs.replace_cost})
+      _uniform = _uniform && (cost == 0 || cost == max_cost);
+    if (_uniform)
+    {
+      _insert_units = edit_costs.insert_cost != 0;
+      _delete_units = edit_costs.delete_cost != 0;
+      _replace_units = edit_costs.replace_cost != 0;
+      _unit = max_cost;
+      return;
+    }
+    for (int scale = 1; scale <= 64; scale++)
+    {
+      bool integers = true;
+      for (const float cost : {edit_costs.insert_cost, edit_costs.delete_cost, edit_costs.replace_cost})
+        integers = integers && cost * scale == std::round(cost * scale);
+      if (integers)
+      {
+        _insert_units = std::lround(edit_costs.insert_cost * scale);
+        _delete_units = std::lround(edit_costs.delete_cost * scale);
+        _replace_units = std::lround(edit_costs.replace_cost * scale);
+        _unit = 1.f / scale;
+        return;
+      }
+    }
+    throw std::invalid_argument("the edit costs are not multiples of a unit");
+  }
+
+  int
+  BatchPattern::length() const
+  {
+    return _tokens.size();
+  }
+
+  /* the bound of a lane is in units, widened by the rounding of the float costs of the steps and of their
+     sums: a cost above the bound in units is above max_costs[i] in floats */
+  template <typename Token>
+  void
+  _edit_distances(const Token* const* sentences, const int* lengths, const float* max_costs, size_t count,
+                  const BatchPattern& pattern,
+                  float* costs,
+                  EditDistanceWorkspace& workspace)
+  {
+    const int n2 = pattern.length();
+    auto& columns = workspace.lane_columns;
+    columns.resize((n2 + 1) * EDIT_DISTANCE_LANES);
+
+    // the sentence of each lane (count when none), its row, and its bound in units
+    size_t lane_sentences[EDIT_DISTANCE_LANES];
+    int rows[EDIT_DISTANCE_LANES];
+    int32_t bounds[EDIT_DISTANCE_LANES];
+    int32_t tokens[EDIT_DISTANCE_LANES] = {};
+    int32_t row_minimum[EDIT_DISTANCE_LANES];
+
+    const auto unit_cost = [&](size_t i) {
+      const Costs sentence_costs(n2, lengths[i], pattern._edit_costs);
+      return double(pattern._unit) * sentence_costs.diff_word;
+    };
+
+    const auto finish = [&](size_t i, int32_t units, int32_t bound) {
+      const int n1 = lengths[i];
+      const Costs sentence_costs(n2, n1, pattern._edit_costs);
+      if (units > bound)
+        costs[i] = units * unit_cost(i);
+      else if (pattern._uniform)
+      {
+        /* the dynamic programming adds the same step once per edit */
+        const float step = pattern._unit * sentence_costs.diff_word;
+        float cost = 0;
+        for (int32_t k = 0; k < units; k++)
+          cost += step;
+        costs[i] = cost;
+      }
+      else
+        costs[i] = _edit_distance(sentences[i], n1, pattern._tokens.data(), n2,
+                                  pattern._edit_costs, sentence_costs, max_costs[i], &workspace);
+    };
+
+    size_t next = 0;
+    const auto load = [&](int lane) {
+      for (; next < count; next++)
+      {
+        const size_t i = next;
+        bounds[lane] = std::numeric_limits<int32_t>::max() / 2;
+        if (max_costs[i] != std::numeric_limits<float>::max())
+        {
+          const double margin = (lengths[i] + n2 + 4) * 2 * double(std::numeric_limits<float>::epsilon());
+          bounds[lane] = int32_t(std::min(max_costs[i] * (1 + margin) / unit_cost(i), double(bounds[lane])));
+        }
+        if (lengths[i] == 0)
+        {
+          finish(i, n2 * pattern._insert_units, bounds[lane]);
+          continue;
+        }
+        lane_sentences[lane] = i;
+        rows[lane] = 0;
+        for (int j = 0; j <= n2; j++)
+          columns[j * EDIT_DISTANCE_LANES + lane] = j * pattern._insert_units;
+        next++;
+        return;
+      }
+      lane_sentences[lane] = count;
+    };
+
+    for (int lane = 0; lane < EDIT_DISTANCE_LANES; lane++)
+      load(lane);
+    while (true)
+    {
+      bool active = false;
+      for (int lane = 0; lane < EDIT_DISTANCE_LANES; lane++)
+        if (lane_sentences[lane] < count)
+        {
+          tokens[lane] = sentences[lane_sentences[lane]][rows[lane]];
+          active = true;
+        }
+      if (!active)
+        break;
+      advance_lanes(columns.data(), pattern._lane_tokens.data(), n2, tokens,
+                    pattern._insert_units, pattern._delete_units, pattern._replace_units,
+                    row_minimum);
+      for (int lane = 0; lane < EDIT_DISTANCE_LANES; lane++)
+      {
+        const size_t i = lane_sentences[lane];
+        if (i == count)
+          continue;
+        if (++rows[lane] == lengths[i])
+          finish(i, columns[n2 * EDIT_DISTANCE_LANES + lane], bounds[lane]);
+        else if (row_minimum[lane] > bounds[lane])
+          finish(i, row_minimum[lane], bounds[lane]);
+        else
+          continue;
+        load(lane);
+      }
+    }
+  }
+
+  template BitParallelPattern::BitParallelPattern(const unsigned*, int);
+  template BitParallelPattern::BitParallelPattern(const uint16_t*, int);
+  template int BitParallelPattern::distance(const unsigned*, int, EditDistanceWorkspace*) const;
+  template int BitParallelPattern::distance(const uint16_t*, int, EditDistanceWorkspace*) const;
+  template int BitParallelPattern::lcs_length(const unsigned*, int, EditDistanceWorkspace*) const;
+  template int BitParallelPattern::lcs_length(const uint16_t*, int, EditDistanceWorkspace*) const;
+  template float _edit_distance(const unsigned*, int, const BitParallelPattern&, const Costs&,
+                                EditDistanceWorkspace*);
+  template float _edit_distance(const uint16_t*, int, const BitParallelPattern&, const Costs&,
+                                EditDistanceWorkspace*);
+  template float _lcs_edit_distance(const unsigned*, int, const unsigned*, const BitParallelPattern&,
+                                    const EditCosts&, const Costs&, float, EditDistanceWorkspace*);
+  template float _lcs_edit_distance(const uint16_t*, int, const unsigned*, const BitParallelPattern&,
+                                    const EditCosts&, const Costs&, float, EditDistanceWorkspace*);
+
+  template BatchPattern::BatchPattern(const unsigned*, int, const EditCosts&);
+  template void _edit_distances(const unsigned* const*, const int*, const float*, size_t,
+                                const BatchPattern&, float*, EditDistanceWorkspace&);
+  template void _edit_distances(const uint16_t* const*, const int*, const float*, size_t,
+                                const BatchPattern&, float*, EditDistanceWorkspace&);
+
+  template float _edit_distance(const unsigned*, const Sentence&, int,
+                                const unsigned*, const Tokens&, int,
+                                const std::vector<const char*>&, const std::vector<int>&,
+                                const std::vector<float>&, float,
+                                const EditCosts&, const Costs&, float, EditDistanceWorkspace*);
+  template float _edit_distance(const uint16_t*, const Sentence&, int,
+                                const unsigned*, const Tokens&, int,
+                                const std::vector<const char*>&, const std::vector<int>&,
+                                const std::vector<float>&, float,
+                                const EditCosts&, const Costs&, float, EditDistanceWorkspace*);
+  template float _edit_distance(const unsigned*, const SentenceView&, int,
+                                const unsigned*, const Tokens&, int,
+                                const std::vector<const char*>&, const std::vector<int>&,
+                                const std::vector<float>&, float,
+                                const EditCosts&, const Costs&, float, EditDistanceWorkspace&);
+  template float _edit_distance(const uint16_t*, const SentenceView&, int,
+                                const unsigned*, const Tokens&, int,
+                                const std::vector<const char*>&, const std::vector<int>&,
+                                const std::vector<float>&, float,
+                                const EditCosts&, const Costs&, float, EditDistanceWorkspace&);
+  template float _edit_distance(const unsigned*, int, const unsigned*, int,
+                                const EditCosts&, const Costs&, float, EditDistanceWorkspace*);
+  template float _edit_distance(const unsigned*, int, const uint16_t*, int,
+                                const EditCosts&, const Costs&, float, EditDistanceWorkspace*);
+  template float _edit_distance(const uint16_t*, int, const unsigned*, int,
+                                const EditCosts&, const Costs&, float, EditDistanceWorkspace*);
+  template float _edit_distance(const uint16_t*, int, const uint16_t*, int,
+                                const EditCosts&, const Costs&, float, EditDistanceWorkspace*);
 }
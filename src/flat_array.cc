@@ -0,0 +1,31 @@
+#include <fuzzy/flat_array.hh>
+
+namespace fuzzy
+{
+  FlatStrings::FlatStrings()
+  {
+  }
+
+  FlatStrings::FlatStrings(const std::vector<std::string>& strings)
+  {
+    auto& offsets_vector = offsets.vector();
+    auto& chars_vector = chars.vector();
+    offsets_vector.reserve(strings.size() + 1);
+    offsets_vector.push_back(0);
+    for (const auto& string : strings)
+    {
+      chars_vector.insert(chars_vector.end(), string.begin(), string.end());
+      offsets_vector.push_back(chars_vector.size());
+    }
+  }
+
+  std::vector<std::string>
+  FlatStrings::to_vector() const
+  {
+    std::vector<std::string> strings;
+    strings.reserve(size());
+    for (size_t i = 0; i < size(); i++)
+      strings.push_back((*this)[i]);
+    return strings;
+  }
+}
@@ -0,0 +1,50 @@
+#include <fuzzy/fm_index.hh>
+
+#include <stdexcept>
+
+namespace fuzzy
+{
+  FMIndex::FMIndex(const std::vector<unsigned>& bwt,
+                   size_t alphabet_size,
+                   const std::vector<bool>& sampled,
+                   std::vector<offset_t> samples)
+    : _sampled(sampled)
+  {
+    unsigned bits = 1;
+    while (bits < 32 && (size_t(1) << bits) < alphabet_size)
+      bits++;
+    _bwt = WaveletMatrix(bwt, bits);
+
+    /* each row but the separator ones starts with the token before another row */
+    auto& first_rows = _first_rows.vector();
+    first_rows.assign(alphabet_size + 1, 0);
+    for (const auto token : bwt)
+      first_rows[token + 1]++;
+    for (size_t token = 0; token < alphabet_size; token++)
+      first_rows[token + 1] += first_rows[token];
+
+    _samples.vector().swap(samples);
+  }
+
+  void
+  FMIndex::save_mapped(MappedFileWriter& writer) const
+  {
+    writer.write(_first_rows);
+    _bwt.save_mapped(writer);
+    _sampled.save_mapped(writer);
+    writer.write(_samples);
+  }
+
+  void
+  FMIndex::load_mapped(MappedFileReader& reader)
+  {
+    reader.read(_first_rows);
+    _bwt.load_mapped(reader);
+    _sampled.load_mapped(reader);
+    reader.read(_samples);
+    if (_sampled.size() != _bwt.size()
+        || _samples.size() != _sampled.rank1(_sampled.size())
+        || (_bwt.size() > 0 && (_first_rows.empty() || _first_rows.back() != _bwt.size())))
+      throw std::runtime_error("corrupted FMI file: invalid FM-index");
+  }
+}
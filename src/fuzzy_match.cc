@@ -5,14 +5,15 @@
 #include <list>
 #include <cmath>
 #include <set>
-#include <numeric>
 #include <algorithm>
+#include <stdexcept>
 
 #include <unicode/normalizer2.h>
 
 #include <fuzzy/ngram_matches.hh>
 #include <fuzzy/edit_distance.hh>
 #include <fuzzy/pattern_coverage.hh>
+#include <fuzzy/parallel.hh>
 
 #include <onmt/Tokenizer.h>
 #include <onmt/unicode/Unicode.h>
@@ -21,6 +22,7 @@
 namespace fuzzy
 {
   const char FuzzyMatch::version = '1';
+  const char FuzzyMatch::mapped_version = '2';
 
   class CompareMatch
   {
@@ -32,12 +34,50 @@ namespace fuzzy
     }
   };
 
-  struct PairHasher {
-    std::size_t operator()(const std::pair<int, int>& p) const {
-      std::size_t h1 = std::hash<int>()(p.first);
-      std::size_t h2 = std::hash<int>()(p.second);
-      return h1 ^ (h2 << 1);
+  /* We track the lowest costs in order the call the edit distance with an upper bound
+     and possibly return earlier. The default upper bound is FLT_MAX (i.e. no restriction).
+     The restriction will only start when we pop this value from the heap. */
+  class LowestCosts
+  {
+  public:
+    LowestCosts(float fuzzy, int contrast_buffer)
+      : _fuzzy(fuzzy)
+      , _contrast_buffer(contrast_buffer)
+    {
+      _lowest_costs.push(std::numeric_limits<float>::max());
+    }
+
+    float top() const
+    {
+      return _lowest_costs.top();
     }
+
+    /* returns the score of the cost */
+    float push(float cost)
+    {
+      const float score = int(10000-cost*100)/10000.0;
+      _lowest_costs.push(cost);
+      if (score < _fuzzy || (_contrast_buffer > 0 && _lowest_costs.size() > size_t(_contrast_buffer)))
+        _lowest_costs.pop();
+      return score;
+    }
+
+  private:
+    float _fuzzy;
+    int _contrast_buffer;
+    std::priority_queue<float> _lowest_costs;
+  };
+
+  /* number of candidates compared with a batch pattern at once: their upper bound is lowered between groups */
+  constexpr size_t BATCH_GROUP_SIZE = 4 * EDIT_DISTANCE_LANES;
+
+  /* a sentence whose edit distance was computed with this upper bound */
+  struct Candidate
+  {
+    unsigned s_id;
+    unsigned longest_match;
+    float cost;
+    float cost_upper_bound;
   };
 
   static std::string normalize(const std::string& text_utf8) {
@@ -223,6 +263,39 @@ namespace fuzzy
     return true;
   }
 
+  size_t FuzzyMatch::add_tm_batch(const std::vector<std::string>& ids,
+                                  const std::vector<std::string>& sentences,
+                                  size_t num_threads,
+                                  bool sort)
+  {
+    if (ids.size() != sentences.size())
+      throw std::invalid_argument("add_tm_batch: ids and sentences must have the same size");
+
+    /* tokenization and normalization are independent for each sentence */
+    std::vector<Sentence> reals(sentences.size());
+    std::vector<Tokens> norms(sentences.size());
+    parallel_for(sentences.size(), num_threads, [this, &sentences, &reals, &norms](size_t i) {
+      _tokenize_and_normalize(sentences[i], reals[i], norms[i]);
+    });
+
+    /* while indexing is sequential to keep sentence and vocab ids deterministic */
+    size_t count = 0;
+    for (size_t i = 0; i < sentences.size(); i++)
+    {
+      if (norms[i].size()==0) {
+        std::cerr<<"WARNING: cannot index empty segment: "<<sentences[i]<<" ("<<ids[i]<<")"<<std::endl;
+        continue;
+      }
+      _suffixArrayIndex->add_tm(ids[i], reals[i], norms[i], false);
+      count++;
+    }
+
+    if (sort)
+      _suffixArrayIndex->sort(SortAlgorithm::BUCKET, num_threads);
+
+    return count;
+  }
+
 #ifndef NDEBUG
   std::ostream& FuzzyMatch::dump(std::ostream& os) const {
     return _suffixArrayIndex->dump(os);
@@ -230,9 +303,78 @@ namespace fuzzy
 #endif
 
   void
-  FuzzyMatch::sort()
+  FuzzyMatch::sort(SortAlgorithm algorithm, size_t num_threads)
+  {
+    _suffixArrayIndex->sort(algorithm, num_threads);
+  }
+
+  void
+  FuzzyMatch::merge_delta()
+  {
+    _suffixArrayIndex->merge_delta();
+  }
+
+  void
+  FuzzyMatch::shard(size_t num_shards)
+  {
+    _suffixArrayIndex->shard(num_shards);
+  }
+
+  void
+  FuzzyMatch::compress()
+  {
+    _suffixArrayIndex->compress();
+  }
+
+  size_t
+  FuzzyMatch::cache_prefixes(size_t cached_tokens)
+  {
+    return _suffixArrayIndex->cache_prefixes(cached_tokens);
+  }
+
+  size_t
+  FuzzyMatch::index_lengths(bool enable)
+  {
+    return _suffixArrayIndex->index_lengths(enable);
+  }
+
+  size_t
+  FuzzyMatch::index_sentence_listing(bool enable)
+  {
+    return _suffixArrayIndex->index_sentence_listing(enable);
+  }
+
+  size_t
+  FuzzyMatch::index_suffix_links(bool enable)
+  {
+    return _suffixArrayIndex->index_suffix_links(enable);
+  }
+
+  size_t
+  FuzzyMatch::remove_tm(const std::string& id)
+  {
+    return _suffixArrayIndex->remove_tm(id);
+  }
+
+  void
+  FuzzyMatch::compact()
+  {
+    _suffixArrayIndex->compact();
+  }
+
+  void
+  FuzzyMatch::save_mapped(MappedFileWriter& writer) const
+  {
+    writer.write_value<int64_t>(_pt);
+    _suffixArrayIndex->save_mapped(writer);
+  }
+
+  void
+  FuzzyMatch::load_mapped(MappedFileReader& reader, std::shared_ptr<const void> mapping)
   {
-    _suffixArrayIndex->sort();
+    _pt = reader.read_value<int64_t>();
+    _suffixArrayIndex = boost::make_unique<SuffixArrayIndex>();
+    _suffixArrayIndex->load_mapped(reader, std::move(mapping));
   }
 
   struct Subseq {
@@ -253,7 +395,8 @@ namespace fuzzy
                          std::vector<Match>& matches,
                          int min_subseq_length,
                          float min_subseq_ratio,
-                         bool idf_weighting) const {
+                         bool idf_weighting,
+                         Workspace* workspace) const {
 
     Sentence real;
     Tokens pattern;
@@ -302,32 +445,62 @@ namespace fuzzy
     Tokens realtok = (Tokens)real;
     real.get_itoks(st, sn);
 
+    EditDistanceWorkspace local_edit_distance;
+    if (workspace && workspace->edit_distances.empty())
+      workspace->edit_distances.resize(1);
+    EditDistanceWorkspace& edit_distance = workspace ? workspace->edit_distances[0] : local_edit_distance;
+
     while(!subseq_queue.empty() &&
           max_distance == 10000) {
       auto &subseq = subseq_queue.top();
 
-      size_t current_min_suffixid = 0;
-      size_t current_max_suffixid = 0;
-      std::pair<size_t, size_t> range_suffixid = SAI.get_SuffixArray().equal_range(pidx.data() + subseq.position, subseq.length, current_min_suffixid, current_max_suffixid);
-
-      for(auto suffixIt=range_suffixid.first; suffixIt < range_suffixid.second &&
-                                            candidates.size()<number_of_matches; suffixIt++) {
-        size_t s_id = SAI.get_SuffixArray().get_suffix_view(suffixIt).sentence_id;
+      /* the shards and the delta, whose sentence ids follow each other */
+      std::vector<const SuffixArray*> arrays;
+      std::vector<size_t> offsets;
+      for (size_t shard = 0; shard < SAI.num_shards(); shard++)
+      {
+        arrays.push_back(&SAI.get_shard(shard));
+        offsets.push_back(SAI.shard_offset(shard));
+      }
+      if (SAI.get_delta_SuffixArray().num_suffixes() > 0)
+      {
+        arrays.push_back(&SAI.get_delta_SuffixArray());
+        offsets.push_back(SAI.delta_offset());
+      }
+      std::vector<std::pair<size_t, size_t>> ranges;
+      for (const auto* suffix_array : arrays)
+        ranges.push_back(suffix_array->equal_range(pidx.data() + subseq.position, subseq.length));
+
+      /* visit the suffixes of the arrays in the order of the merged array */
+      while (candidates.size()<number_of_matches) {
+        size_t next = arrays.size();
+        for (size_t i = 0; i < arrays.size(); i++)
+        {
+          if (ranges[i].first == ranges[i].second)
+            continue;
+          if (next == arrays.size() ||
+              !arrays[next]->precedes(arrays[next]->get_suffix_view(ranges[next].first),
+                                      *arrays[i], arrays[i]->get_suffix_view(ranges[i].first)))
+            next = i;
+        }
+        if (next == arrays.size())
+          break;
+        const size_t s_id = offsets[next] + arrays[next]->get_suffix_view(ranges[next].first++).sentence_id;
         if (candidates.find(s_id) == candidates.end() &&
-            perfect.find(s_id) == perfect.end()) {
-          size_t s_length = 0;
-          const auto* thes = SAI.get_SuffixArray().get_sentence(s_id, &s_length);
-
-          const EditCosts edit_costs;
-          const Costs costs(p_length, s_length, edit_costs);
-
+            perfect.find(s_id) == perfect.end() &&
+            !SAI.is_removed(s_id)) {
           /* let us calculate edit_distance  */
-          float cost = _edit_distance(thes, SAI.real_tokens(s_id), s_length,
-                                      pidx.data(), realtok, p_length,
-                                      st, sn,
-                                      idf_penalty, 0, 
-                                      edit_costs,
-                                      costs, max_distance);
+          float cost = SAI.visit_sentence(s_id, [&](const auto* thes, size_t s_length) {
+            const EditCosts edit_costs;
+            const Costs costs(p_length, s_length, edit_costs);
+            SAI.real_tokens(s_id, edit_distance.sentence);
+            return _edit_distance(thes, edit_distance.sentence, s_length,
+                                  pidx.data(), realtok, p_length,
+                                  st, sn,
+                                  idf_penalty, 0,
+                                  edit_costs,
+                                  costs, max_distance, edit_distance);
+          });
           if (cost==0 && no_perfect) {
             perfect.insert(s_id);
             continue;
@@ -365,7 +538,7 @@ namespace fuzzy
   }
 
   float FuzzyMatch::compute_max_idf_penalty() const {
-    const unsigned num_sentences = _suffixArrayIndex->get_SuffixArray().num_sentences();
+    const unsigned num_sentences = _suffixArrayIndex->size() - _suffixArrayIndex->num_removed();
     return std::log(num_sentences);
   }
 
@@ -374,13 +547,13 @@ namespace fuzzy
     std::vector<float> idf_penalty;
     idf_penalty.reserve(pattern_wids.size());
 
-    const unsigned num_sentences = _suffixArrayIndex->get_SuffixArray().num_sentences();
+    const unsigned num_sentences = _suffixArrayIndex->size() - _suffixArrayIndex->num_removed();
 
-    const std::vector<unsigned>& word_frequency_in_sentences = _suffixArrayIndex->get_VocabIndexer().getSFreq();
+    const auto& word_frequency_in_sentences = _suffixArrayIndex->get_VocabIndexer().getSFreq();
 
     for (const auto wid : pattern_wids) {
-      // https://en.wikipedia.org/wiki/TF-IDF
-      if (wid != fuzzy::VocabIndexer::VOCAB_UNK)
+      // https://en.wikipedia.org/wiki/TF-IDF - words only in removed sentences are unknown
+      if (wid != fuzzy::VocabIndexer::VOCAB_UNK && word_frequency_in_sentences[wid] > 0)
         idf_penalty.push_back(std::log((float)num_sentences/(float)word_frequency_in_sentences[wid]));
       else
         idf_penalty.push_back(unknown_vocab_word_penalty);
@@ -401,14 +574,15 @@ namespace fuzzy
                          const EditCosts& edit_costs,
                          float contrastive_factor,
                          ContrastReduce reduce,
-                         int contrast_buffer) const {
+                         int contrast_buffer,
+                         Workspace* workspace) const {
 
     Sentence real;
     Tokens norm;
     _tokenize_and_normalize(sentence, real, norm);
     return match(real, norm, fuzzy, number_of_matches, no_perfect, matches,
                  min_subseq_length, min_subseq_ratio, vocab_idf_penalty,
-                 edit_costs, contrastive_factor, reduce, contrast_buffer);
+                 edit_costs, contrastive_factor, reduce, contrast_buffer, workspace);
   }
 
   /* backward compatibility */
@@ -431,6 +605,31 @@ namespace fuzzy
                  edit_costs, contrastive_factor, reduce, contrast_buffer);
   }
 
+  /* register the longest n-grams of the pattern found in the suffix array */
+  void
+  FuzzyMatch::_register_ngram_matches(const SuffixArray& suffix_array,
+                                      const std::vector<unsigned>& pattern_wids,
+                                      const EditCosts& edit_costs,
+                                      NGramMatches& ngram_matches) const
+  {
+    const size_t p_length = pattern_wids.size();
+
+    if (p_length == 1)
+    {
+      std::pair<size_t, size_t> range_suffixid = suffix_array.equal_range(pattern_wids.data(), p_length);
+
+      if (range_suffixid.first != range_suffixid.second)
+        ngram_matches.register_suffix_range_match(range_suffixid.first,
+                                                 range_suffixid.second,
+                                                 p_length,
+                                                 edit_costs);
+    }
+
+    suffix_array.visit_longest_prefixes(pattern_wids.data(), p_length, [&](size_t begin, size_t end, size_t length) {
+      ngram_matches.register_suffix_range_match(begin, end, length, edit_costs);
+    });
+  }
+
   /* check for the pattern in the suffix-array index SAI */ 
   bool
   FuzzyMatch::match(const Sentence& real,
@@ -445,7 +644,8 @@ namespace fuzzy
                     const EditCosts& edit_costs,
                     float contrastive_factor,
                     ContrastReduce reduce,
-                    int contrast_buffer) const
+                    int contrast_buffer,
+                    Workspace* workspace) const
   {
     size_t p_length = pattern.size();
     if (contrast_buffer == -1)
@@ -479,191 +679,257 @@ namespace fuzzy
     /* result map - normalized error => sentence */
     std::priority_queue<Match, std::vector<Match>, CompareMatch> result;
 
-    NGramMatches nGramMatches(fuzzy, p_length, min_subseq_length, _suffixArrayIndex->get_SuffixArray());
+    PatternCoverage pattern_coverage(pattern_wids);
+    std::vector<const char*> st(p_length+1);
+    std::vector<int> sn(p_length+1);
+    Tokens pattern_realtok = (Tokens)real;
 
-    if (p_length == 1)
-    {
-      std::pair<size_t, size_t> range_suffixid = _suffixArrayIndex->get_SuffixArray().equal_range(pattern_wids.data(), p_length);
+    real.get_itoks(st, sn);
 
-      if (range_suffixid.first != range_suffixid.second)
-        nGramMatches.register_suffix_range_match(range_suffixid.first,
-                                                 range_suffixid.second,
-                                                 p_length,
-                                                 edit_costs);
+    /* the edit distance only depends on the word ids when the real tokens do not add costs: no
+       intermediate tokens, and the pattern tokens are their real forms, which are also the ones of the
+       index tokens with the same word ids. When a replacement costs at least a deletion and an insertion,
+       it then only counts the tokens outside of a longest common subsequence, and otherwise the sentences
+       are compared in batches */
+    std::unique_ptr<BitParallelPattern> lcs_pattern;
+    std::unique_ptr<BatchPattern> batch_pattern;
+    if (!vocab_idf_penalty
+        && !(_pt & (pt_cas | pt_nbr))
+        && std::all_of(sn.begin(), sn.end(), [](int n) { return n == 0; }))
+    {
+      bool plain_pattern = true;
+      for (size_t j = 0; j < p_length && plain_pattern; j++)
+        plain_pattern = (pattern_realtok[j] == pattern[j]
+                         && pattern[j].compare(0, onmt::Tokenizer::ph_marker_open.size(),
+                                               onmt::Tokenizer::ph_marker_open) != 0);
+      if (plain_pattern && edit_costs.is_lcs())
+        lcs_pattern = boost::make_unique<BitParallelPattern>(pattern_wids.data(), p_length);
+      else if (plain_pattern && BatchPattern::supports(edit_costs))
+        batch_pattern = boost::make_unique<BatchPattern>(pattern_wids.data(), p_length, edit_costs);
     }
 
-    for (size_t it=0; it < p_length; it++)
-    {
-      std::pair<size_t, size_t> previous_range_suffixid(0, 0);
-      size_t subseq_length = 0;
+    const auto edit_distance = [&](size_t s_id, float cost_upper_bound, EditDistanceWorkspace& workspace) {
+      return _suffixArrayIndex->visit_sentence(s_id, [&](const auto* sentence_wids, size_t s_length) {
+        const Costs costs(p_length, s_length, edit_costs);
+        if (lcs_pattern && !_suffixArrayIndex->has_itoks(s_id))
+          return _lcs_edit_distance(sentence_wids, s_length, pattern_wids.data(), *lcs_pattern,
+                                    edit_costs, costs, cost_upper_bound, &workspace);
+        _suffixArrayIndex->real_tokens(s_id, workspace.sentence);
+        return _edit_distance(sentence_wids, workspace.sentence, s_length,
+                              pattern_wids.data(), pattern_realtok, p_length,
+                              st, sn,
+                              idf_penalty, costs.diff_word*vocab_idf_penalty/idf_max,
+                              edit_costs,
+                              costs, cost_upper_bound, workspace);
+      });
+    };
+
+    /* the shards and the delta (sentences added since the main suffix array was sorted) are searched,
+       and their candidates checked, in parallel - each one with its own upper bound */
+    std::vector<std::pair<const SuffixArray*, size_t>> arrays;
+    for (size_t shard = 0; shard < _suffixArrayIndex->num_shards(); shard++)
+      arrays.emplace_back(&_suffixArrayIndex->get_shard(shard), _suffixArrayIndex->shard_offset(shard));
+    if (_suffixArrayIndex->get_delta_SuffixArray().num_suffixes() > 0)
+      arrays.emplace_back(&_suffixArrayIndex->get_delta_SuffixArray(), _suffixArrayIndex->delta_offset());
+
+    /* without a workspace, the candidates go to a hash map: a dense table would be allocated for each pattern */
+    if (workspace && workspace->candidate_tables.size() < arrays.size())
+      workspace->candidate_tables.resize(arrays.size());
+    /* the edit distance buffers are at least reused within the pattern */
+    std::vector<EditDistanceWorkspace> local_edit_distances;
+    auto& edit_distances = workspace ? workspace->edit_distances : local_edit_distances;
+    if (edit_distances.size() < arrays.size())
+      edit_distances.resize(arrays.size());
+
+    std::vector<std::vector<Candidate>> array_candidates(arrays.size());
+    parallel_for(arrays.size(), _suffixArrayIndex->num_shards(), [&](size_t i) {
+      NGramMatches nGramMatches(fuzzy, p_length, min_subseq_length, *arrays[i].first, arrays[i].second,
+                                workspace ? &workspace->candidate_tables[i] : nullptr);
+      _register_ngram_matches(*arrays[i].first, pattern_wids, edit_costs, nGramMatches);
+
+      LowestCosts lowest_costs(fuzzy, contrast_buffer);
+      const auto add_candidate = [&](unsigned s_id, unsigned longest_match, float cost, float cost_upper_bound) {
+        const size_t s_length = _suffixArrayIndex->sentence_length(s_id);
+        array_candidates[i].push_back(Candidate{s_id, longest_match, cost, cost_upper_bound});
+        if ((no_perfect && cost == 0 && (s_length == p_length)) || cost > cost_upper_bound)
+          return;
+        lowest_costs.push(cost);
+      };
 
-      for (size_t jt = it; jt < p_length; jt++)
-      {
-        ++subseq_length;
-        /*
-          the set of solution will be a decreasing range
-          pos-i     ngram
-          pos-i+1   ngram
-          pos-i+2   ngram   (n+1)gram
-          pos-i+3   ngram   (n+1)gram   (n+2)gram
-          pos-i+4   ngram   (n+1)gram
-          pos-i+5   ngram
-
-          and we will only keep the matches:
-          pos-i     ngram
-          pos-i+1   ngram
-          pos-i+2   (n+1)gram
-          pos-i+3   (n+2)gram
-          pos-i+4   (n+1)gram
-          pos-i+5   ngram
-        */
-        std::pair<size_t, size_t> range_suffixid = _suffixArrayIndex->get_SuffixArray().equal_range(pattern_wids.data() + it, subseq_length, previous_range_suffixid.first, previous_range_suffixid.second);
-
-        if (range_suffixid.first != range_suffixid.second)
-        {
-          /* do not register unigrams - yet */
-          if (subseq_length > 2)
+      /* with a batch pattern, the candidates are checked by groups in their order, the sentences without
+         intermediate tokens being compared at once with the upper bound of the group */
+      std::vector<std::pair<unsigned, unsigned>> group;
+      std::vector<const void*> group_sentences;
+      std::vector<int> group_lengths;
+      std::vector<float> group_max_costs;
+      std::vector<float> group_costs;
+      const auto check_group = [&]() {
+        const SuffixArray& suffix_array = *arrays[i].first;
+        const auto cost_upper_bound = lowest_costs.top();
+        group_sentences.clear();
+        group_lengths.clear();
+        for (const auto& candidate : group)
+          if (!_suffixArrayIndex->has_itoks(candidate.first))
           {
-            /* register (n-1) grams */
-            nGramMatches.register_suffix_range_match(previous_range_suffixid.first,
-                                                     range_suffixid.first,
-                                                     subseq_length - 1,
-                                                     edit_costs);
-            nGramMatches.register_suffix_range_match(range_suffixid.second,
-                                                     previous_range_suffixid.second,
-                                                     subseq_length - 1,
-                                                     edit_costs);
+            size_t s_length;
+            const size_t sentence_id = candidate.first - arrays[i].second;
+            if (suffix_array.token_bytes() == sizeof (uint16_t))
+              group_sentences.push_back(suffix_array.get_sentence<uint16_t>(sentence_id, &s_length));
+            else
+              group_sentences.push_back(suffix_array.get_sentence<unsigned>(sentence_id, &s_length));
+            group_lengths.push_back(s_length);
           }
-
-          previous_range_suffixid = std::move(range_suffixid);
-        }
+        group_max_costs.assign(group_lengths.size(), cost_upper_bound);
+        group_costs.resize(group_lengths.size());
+        if (suffix_array.token_bytes() == sizeof (uint16_t))
+          _edit_distances(reinterpret_cast<const uint16_t* const*>(group_sentences.data()),
+                          group_lengths.data(), group_max_costs.data(), group_lengths.size(),
+                          *batch_pattern, group_costs.data(), edit_distances[i]);
         else
+          _edit_distances(reinterpret_cast<const unsigned* const*>(group_sentences.data()),
+                          group_lengths.data(), group_max_costs.data(), group_lengths.size(),
+                          *batch_pattern, group_costs.data(), edit_distances[i]);
+
+        size_t batched = 0;
+        for (const auto& candidate : group)
         {
-          --subseq_length;
-          break;
+          if (!_suffixArrayIndex->has_itoks(candidate.first))
+            add_candidate(candidate.first, candidate.second, group_costs[batched++], cost_upper_bound);
+          else
+          {
+            const auto candidate_upper_bound = lowest_costs.top();
+            add_candidate(candidate.first, candidate.second,
+                          edit_distance(candidate.first, candidate_upper_bound, edit_distances[i]),
+                          candidate_upper_bound);
+          }
         }
-      }
-      if (subseq_length >= 2)
-        nGramMatches.register_suffix_range_match(previous_range_suffixid.first,
-                                                 previous_range_suffixid.second,
-                                                 subseq_length,
-                                                 edit_costs);
-    }
-
-    /* Consolidation of the results */
-
-    /* now explore for the best segments */
-
-    PatternCoverage pattern_coverage(pattern_wids);
-    std::vector<const char*> st(p_length+1);
-    std::vector<int> sn(p_length+1);
-    Tokens pattern_realtok = (Tokens)real;
-
-    real.get_itoks(st, sn);
-
-    // We track the lowest costs in order the call the edit distance with an upper bound
-    // and possibly return earlier. The default upper bound is FLT_MAX (i.e. no restriction).
-    // The restriction will only start when we pop this value from the heap.
-    std::priority_queue<float> lowest_costs;
-    lowest_costs.push(std::numeric_limits<float>::max());
+        group.clear();
+      };
 
-    for (const auto& pair : nGramMatches.get_longest_matches())
-    {
-      const auto s_id = pair.first;
-      const auto longest_match = pair.second;
-      size_t s_length = 0;
-      const auto* sentence_wids = _suffixArrayIndex->get_SuffixArray().get_sentence(s_id, &s_length);
-      const auto num_covered_words = (longest_match < p_length
-                                      ? pattern_coverage.count_covered_words(sentence_wids, s_length)
-                                      : p_length);
-
-      /* do not care checking sentences that do not have enough ngram matches for the fuzzy threshold */
-      if (!nGramMatches.theoretical_rejection_cover(p_length, s_length, num_covered_words, edit_costs))
+      for (const auto& pair : nGramMatches.get_longest_matches())
       {
-        const Costs costs(p_length, s_length, edit_costs);
+        const auto s_id = pair.first;
+        const auto longest_match = pair.second;
+        const size_t s_length = _suffixArrayIndex->sentence_length(s_id);
+        const auto num_covered_words = (longest_match < p_length
+                                        ? _suffixArrayIndex->visit_sentence(
+                                            s_id, [&pattern_coverage](const auto* sentence_wids, size_t s_length) {
+                                              return pattern_coverage.count_covered_words(sentence_wids, s_length);
+                                            })
+                                        : p_length);
+
+        /* do not care checking sentences that do not have enough ngram matches for the fuzzy threshold */
+        if (nGramMatches.theoretical_rejection_cover(p_length, s_length, num_covered_words, edit_costs))
+          continue;
 
         /* let us check the candidates */
-        const auto sentence_realtok = _suffixArrayIndex->real_tokens(s_id);
+        if (batch_pattern)
+        {
+          group.emplace_back(s_id, longest_match);
+          if (group.size() == BATCH_GROUP_SIZE)
+            check_group();
+          continue;
+        }
         const auto cost_upper_bound = lowest_costs.top();
-        float cost = _edit_distance(sentence_wids, sentence_realtok, s_length,
-                                    pattern_wids.data(), pattern_realtok, p_length,
-                                    st, sn,
-                                    idf_penalty, costs.diff_word*vocab_idf_penalty/idf_max,
-                                    edit_costs,
-                                    costs, cost_upper_bound);
+        add_candidate(s_id, longest_match, edit_distance(s_id, cost_upper_bound, edit_distances[i]),
+                      cost_upper_bound);
+      }
+      if (!group.empty())
+        check_group();
+    });
 
-        if ((no_perfect && cost == 0 && (s_length == p_length)) || cost > cost_upper_bound)
-          continue;
+    /* Consolidation of the results */
 
-        float score = int(10000-cost*100)/10000.0;
+    /* the candidates of all the arrays are replayed in the order of a single array: a cost lower than
+       the upper bound of its array is exact, and a greater one only needs to be computed again when
+       the global upper bound is greater - so that the matches are the ones of an unsharded index */
+    std::vector<Candidate> candidates;
+    for (const auto& array_candidate : array_candidates)
+      candidates.insert(candidates.end(), array_candidate.begin(), array_candidate.end());
+    if (array_candidates.size() > 1)
+      std::sort(candidates.begin(), candidates.end(),
+                [](const Candidate& a, const Candidate& b) {
+                  return a.longest_match > b.longest_match
+                    || (a.longest_match == b.longest_match && a.s_id < b.s_id);
+                });
+
+    LowestCosts lowest_costs(fuzzy, contrast_buffer);
+    for (const auto& candidate : candidates)
+    {
+      const auto s_id = candidate.s_id;
+      const size_t s_length = _suffixArrayIndex->sentence_length(s_id);
+      const auto cost_upper_bound = lowest_costs.top();
+      float cost = candidate.cost;
+      if (cost > candidate.cost_upper_bound && candidate.cost_upper_bound < cost_upper_bound)
+        cost = edit_distance(s_id, cost_upper_bound, edit_distances[0]);
+
+      if ((no_perfect && cost == 0 && (s_length == p_length)) || cost > cost_upper_bound)
+        continue;
 
-        lowest_costs.push(cost);
-        if (score < fuzzy || (contrast_buffer > 0 && lowest_costs.size() > size_t(contrast_buffer)))
-          lowest_costs.pop();
-        if (score >= fuzzy) {
-          Match m(sentence_wids, s_length);
-          m.score = score;
-          m.max_subseq = longest_match;
-          m.s_id = s_id;
-          m.id = _suffixArrayIndex->id(s_id);
-          result.push(m);
-        }
+      const float score = lowest_costs.push(cost);
+      if (score >= fuzzy) {
+        Match m(s_length);
+        m.score = score;
+        m.max_subseq = candidate.longest_match;
+        m.s_id = s_id;
+        m.id = _suffixArrayIndex->id(s_id);
+        result.push(m);
       }
     }
     /* Contrastive reranking */
     if (contrastive_factor > 0)
     {
-      std::list<Match> candidates;
+      /* the penalties of a candidate against the selected matches, reduced as the matches are selected */
+      struct ContrastiveCandidate
+      {
+        Match match;
+        float penalty_sum = 0;
+        float penalty_max = 0;
+      };
+      std::list<ContrastiveCandidate> candidates;
       while (!result.empty())
       {
-        auto match = result.top();
-        candidates.push_back(match);
+        candidates.push_back(ContrastiveCandidate{result.top()});
         result.pop();
       }
-      auto comp = [contrastive_factor](const Match& m1, const Match& m2) {
+      auto comp = [contrastive_factor](const ContrastiveCandidate& c1, const ContrastiveCandidate& c2) {
+          const Match& m1 = c1.match;
+          const Match& m2 = c2.match;
           return (m1.score - contrastive_factor * m1.penalty) < (m2.score - contrastive_factor * m2.penalty);
       };
-      /* for memoization optimization */
-      std::unordered_map<std::pair<int, int>, float, PairHasher> edit_cost_memory;
+      const EditCosts internal_edit_cost;
+      // number of selected matches already compared to the candidates
+      size_t compared = 0;
       while (!candidates.empty() && (number_of_matches == 0 || matches.size() < number_of_matches))
       {
-        EditCosts internal_edit_cost;
-        // rescore penalties of candidates
-        for (Match &match : candidates)
+        // rescore penalties of candidates with the new matches, each one being preprocessed once
+        for (; compared < matches.size(); compared++)
         {
-          std::vector<float> penalties;
-          for (Match &match_memory : matches)
+          const Match& match_memory = matches[compared];
+          const auto pattern = _suffixArrayIndex->visit_sentence(match_memory.s_id, [](const auto* s, size_t n) {
+            return BitParallelPattern(s, n);
+          });
+          for (auto& candidate : candidates)
           {
-            auto it = edit_cost_memory.find({match.s_id, match_memory.s_id});
-            float penalty;
-            if (it != edit_cost_memory.end()) {
-              penalty = it->second;
-            } else {
-              const Costs costs(match.length, match_memory.length, internal_edit_cost);
-              penalty = _edit_distance(
-                match.s, match.length,
-                match_memory.s, match_memory.length,
-                internal_edit_cost,
-                costs
-              );
-              edit_cost_memory.insert({{match.s_id, match_memory.s_id}, penalty});
-            }
+            Match& match = candidate.match;
+            const Costs costs(match.length, match_memory.length, internal_edit_cost);
+            float penalty = _suffixArrayIndex->visit_sentence(match.s_id, [&](const auto* s1, size_t n1) {
+              return _edit_distance(s1, n1, pattern, costs, &edit_distances[0]);
+            });
             penalty = int(10000 - penalty * 100) / 10000.0;
-            penalties.push_back(penalty);
-          }
-          if (!penalties.empty())
-          {
+            candidate.penalty_sum += penalty;
+            candidate.penalty_max = compared == 0 ? penalty : std::max(candidate.penalty_max, penalty);
             if (reduce == ContrastReduce::MAX)
             { // max
-              match.penalty = *std::max_element(penalties.cbegin(), penalties.cend());
+              match.penalty = candidate.penalty_max;
             } else
             { // mean
-              match.penalty = std::accumulate(penalties.cbegin(), penalties.cend(), 0.f) / penalties.size();
+              match.penalty = candidate.penalty_sum / (compared + 1);
             }
           }
         }
         auto it_max = std::max_element(candidates.begin(), candidates.end(), comp);
-        matches.push_back(*it_max);
+        matches.push_back(it_max->match);
         candidates.erase(it_max);
       }
     }
@@ -3,24 +3,57 @@
 #include <fstream>
 
 #include <boost/iostreams/filtering_streambuf.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
 
 #include <boost/archive/binary_oarchive.hpp>
 #include <boost/archive/binary_iarchive.hpp>
 
 #include <boost/current_function.hpp>
 
+#include <algorithm>
+#include <cstring>
+#include <memory>
 #include <stdexcept>
 
 namespace fuzzy
 {
+  /* the arrays of a memory mapped index are used as is: the file must come from a platform with
+     the same byte order and type sizes */
+  static std::vector<uint32_t> mapped_platform()
+  {
+    return {0x01020304, sizeof (unsigned), sizeof (unsigned short), sizeof (offset_t)};
+  }
+
+  MappedFileWriter
+  begin_mapped_fuzzy_matcher(std::ostream& os)
+  {
+    os.write("FMI", 3).write(&FuzzyMatch::mapped_version, 1);
+    MappedFileWriter writer(os, 4);
+    const auto platform = mapped_platform();
+    writer.write(platform.data(), platform.size());
+    return writer;
+  }
+
   void
-  export_binarized_fuzzy_matcher(const std::string& binarized_tm_filename, const FuzzyMatch& fuzzy_matcher)
+  export_binarized_fuzzy_matcher(const std::string& binarized_tm_filename,
+                                 const FuzzyMatch& fuzzy_matcher,
+                                 char format_version)
   {
+    if (format_version != FuzzyMatch::version && format_version != FuzzyMatch::mapped_version)
+      throw std::invalid_argument("Unsupported FMI format version");
+
     std::ofstream ofs;
     ofs.exceptions(std::ios_base::failbit | std::ios_base::badbit);
     ofs.open(binarized_tm_filename.c_str(), std::ios_base::binary);
 
-    ofs.write("FMI", 3).write(&fuzzy_matcher.version, 1);
+    if (format_version == FuzzyMatch::mapped_version)
+    {
+      auto writer = begin_mapped_fuzzy_matcher(ofs);
+      fuzzy_matcher.save_mapped(writer);
+      return;
+    }
+
+    ofs.write("FMI", 3).write(&format_version, 1);
 
     boost::iostreams::filtering_ostreambuf fos;
     fos.push(ofs);
@@ -38,10 +71,27 @@ namespace fuzzy
 
     char buffer[4];
     ifs.read(buffer, 4);
-    if (!strcmp(buffer, "FMI")) {
+    if (std::strncmp(buffer, "FMI", 3)) {
       throw std::runtime_error(std::string(BOOST_CURRENT_FUNCTION) + "invalid FMI file format");
     }
 
+    if (buffer[3] == FuzzyMatch::mapped_version)
+    {
+      ifs.close();
+      const auto mapping = std::make_shared<boost::iostreams::mapped_file_source>(binarized_tm_filename);
+      MappedFileReader reader(mapping->data(), mapping->size(), 4);
+
+      FlatArray<uint32_t> platform;
+      reader.read(platform);
+      const auto expected_platform = mapped_platform();
+      if (!std::equal(platform.begin(), platform.end(), expected_platform.begin(), expected_platform.end()))
+        throw std::runtime_error(std::string(BOOST_CURRENT_FUNCTION) + "FMI file built on an incompatible platform");
+
+      fuzzy_matcher.load_mapped(reader, mapping);
+      fuzzy_matcher._update_tokenizer();
+      return;
+    }
+
     boost::iostreams::filtering_istreambuf fis;
     fis.push(ifs);
 
@@ -0,0 +1,576 @@
+#include <fuzzy/index_builder.hh>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <limits>
+#include <queue>
+#include <stdexcept>
+
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <fuzzy/fuzzy_matcher_binarization.hh>
+#include <fuzzy/parallel.hh>
+
+namespace fuzzy
+{
+  /* memory used by the chunk suffix array while it is sorted: sentence buffer, suffixes and their
+     bucketed copy, LCP ranks and LCP/LLCP/RLCP arrays */
+  static const size_t CHUNK_BYTES_PER_TOKEN = 32;
+  static const size_t SPILL_BLOCK_SIZE = 1 << 20;
+
+  /* temporary file holding an array, removed with the object */
+  class SpillFile
+  {
+  public:
+    SpillFile(std::string path)
+      : _path(std::move(path))
+    {
+      _os.exceptions(std::ios_base::failbit | std::ios_base::badbit);
+      _os.open(_path.c_str(), std::ios_base::binary | std::ios_base::trunc);
+    }
+
+    ~SpillFile()
+    {
+      _os.exceptions(std::ios_base::goodbit);
+      _os.close();
+      std::remove(_path.c_str());
+    }
+
+    template <typename T>
+    void append(const T* data, size_t size)
+    {
+      _os.write(reinterpret_cast<const char*>(data), size * sizeof (T));
+      _num_bytes += size * sizeof (T);
+    }
+
+    template <typename T>
+    void append(const T& value)
+    {
+      append(&value, 1);
+    }
+
+    void close()
+    {
+      if (_os.is_open())
+        _os.close();
+    }
+
+    size_t num_bytes() const
+    {
+      return _num_bytes;
+    }
+
+    const std::string& path() const
+    {
+      return _path;
+    }
+
+    /* the file as one section of the index */
+    void copy_to(MappedFileWriter& writer)
+    {
+      close();
+      std::ifstream is;
+      is.exceptions(std::ios_base::failbit | std::ios_base::badbit);
+      is.open(_path.c_str(), std::ios_base::binary);
+
+      std::vector<char> buffer(std::min(_num_bytes, SPILL_BLOCK_SIZE));
+      writer.begin_section(_num_bytes);
+      for (size_t remaining = _num_bytes; remaining > 0; )
+      {
+        const size_t size = std::min(remaining, buffer.size());
+        is.read(buffer.data(), size);
+        writer.append(buffer.data(), size);
+        remaining -= size;
+      }
+      writer.end_section();
+    }
+
+  private:
+    std::string _path;
+    std::ofstream _os;
+    size_t _num_bytes = 0;
+  };
+
+  /* temporary files holding strings in the layout of FlatStrings */
+  class SpillStrings
+  {
+  public:
+    SpillStrings(const std::string& path)
+      : _offsets(path + ".offsets")
+      , _chars(path + ".chars")
+    {
+      _offsets.append(_num_chars);
+    }
+
+    void append(const std::string& string)
+    {
+      _chars.append(string.data(), string.size());
+      _num_chars += string.size();
+      _offsets.append(_num_chars);
+    }
+
+    void copy_to(MappedFileWriter& writer)
+    {
+      _offsets.copy_to(writer);
+      _chars.copy_to(writer);
+    }
+
+  private:
+    SpillFile _offsets;
+    SpillFile _chars;
+    uint64_t _num_chars = 0;
+  };
+
+  /* read only memory mapping of a temporary file */
+  template <typename T>
+  class SpillMapping
+  {
+  public:
+    SpillMapping(SpillFile& file)
+    {
+      file.close();
+      if (file.num_bytes() > 0)
+        _mapping.open(file.path());
+    }
+
+    const T* data() const
+    {
+      return reinterpret_cast<const T*>(_mapping.is_open() ? _mapping.data() : nullptr);
+    }
+
+  private:
+    boost::iostreams::mapped_file_source _mapping;
+  };
+
+  /* buffered reading of a run of sorted suffixes */
+  class RunReader
+  {
+  public:
+    RunReader(SpillFile& run, size_t buffer_size)
+      : _remaining(run.num_bytes() / sizeof (offset_t))
+      , _buffer(std::max<size_t>(buffer_size, 1))
+    {
+      run.close();
+      _is.exceptions(std::ios_base::failbit | std::ios_base::badbit);
+      _is.open(run.path().c_str(), std::ios_base::binary);
+    }
+
+    bool next(offset_t& suffix)
+    {
+      if (_position == _size)
+      {
+        if (_remaining == 0)
+          return false;
+        _size = std::min(_remaining, _buffer.size());
+        _is.read(reinterpret_cast<char*>(_buffer.data()), _size * sizeof (offset_t));
+        _remaining -= _size;
+        _position = 0;
+      }
+      suffix = _buffer[_position++];
+      return true;
+    }
+
+  private:
+    std::ifstream _is;
+    size_t _remaining;
+    std::vector<offset_t> _buffer;
+    size_t _size = 0;
+    size_t _position = 0;
+  };
+
+  IndexBuilder::IndexBuilder(const std::string& index_filename,
+                             int pt,
+                             size_t max_tokens_in_pattern,
+                             size_t memory_budget,
+                             size_t cached_tokens)
+    : _index_filename(index_filename)
+    , _pt(pt)
+    , _max_tokens_in_pattern(max_tokens_in_pattern)
+    , _memory_budget(memory_budget)
+    , _cached_tokens(cached_tokens)
+    , _tokenizer(pt, max_tokens_in_pattern)
+    , _sentence_buffer(new SpillFile(temp_filename("sentences")))
+    , _sentence_pos(new SpillFile(temp_filename("sentence_pos")))
+    , _ids(new SpillStrings(temp_filename("ids")))
+    , _tokens(new SpillStrings(temp_filename("tokens")))
+    , _itoks_begin(new SpillFile(temp_filename("itoks_begin")))
+    , _itoks_pos(new SpillFile(temp_filename("itoks_pos")))
+    , _itoks(new SpillStrings(temp_filename("itoks")))
+  {
+  }
+
+  IndexBuilder::~IndexBuilder() = default;
+
+  std::string
+  IndexBuilder::temp_filename(const std::string& name) const
+  {
+    return _index_filename + ".tmp." + name;
+  }
+
+  size_t
+  IndexBuilder::num_runs() const
+  {
+    return _runs.size();
+  }
+
+  size_t
+  IndexBuilder::prefix_cache_bytes() const
+  {
+    return _prefix_cache_bytes;
+  }
+
+  size_t
+  IndexBuilder::bigram_table_bytes() const
+  {
+    return (_bigram_index.size() * sizeof (offset_t)
+            + _bigram_second_words.size() * sizeof (unsigned)
+            + _bigram_starts.size() * sizeof (offset_t));
+  }
+
+  double
+  IndexBuilder::bigram_table_seconds() const
+  {
+    return _bigram_table_seconds;
+  }
+
+  size_t
+  IndexBuilder::add_tm_batch(const std::vector<std::string>& ids,
+                             const std::vector<std::string>& sentences,
+                             size_t num_threads)
+  {
+    if (ids.size() != sentences.size())
+      throw std::invalid_argument("add_tm_batch: ids and sentences must have the same size");
+
+    std::vector<Sentence> reals(sentences.size());
+    std::vector<Tokens> norms(sentences.size());
+    parallel_for(sentences.size(), num_threads, [this, &sentences, &reals, &norms](size_t i) {
+      _tokenizer._tokenize_and_normalize(sentences[i], reals[i], norms[i]);
+    });
+
+    size_t count = 0;
+    for (size_t i = 0; i < sentences.size(); i++)
+    {
+      if (norms[i].size()==0) {
+        std::cerr<<"WARNING: cannot index empty segment: "<<sentences[i]<<" ("<<ids[i]<<")"<<std::endl;
+        continue;
+      }
+      add_tm(ids[i], reals[i], norms[i]);
+      count++;
+
+      if (_chunk_tokens * CHUNK_BYTES_PER_TOKEN >= _memory_budget)
+        flush_chunk(num_threads);
+    }
+
+    return count;
+  }
+
+  /* same filter as SuffixArrayIndex::add_tm */
+  void
+  IndexBuilder::add_tm(const std::string& id, const Sentence& real, const Tokens& norm)
+  {
+    if (real.empty() || norm.size() > _max_tokens_in_pattern)
+      return;
+
+    const auto wids = _vocabIndexer.addWords(norm);
+    if (_buffer_size + wids.size() + 2 > std::numeric_limits<offset_t>::max())
+      throw std::length_error("Too many tokens for the index: build with LARGE_INDEX");
+
+    const offset_t pos = _buffer_size;
+    const unsigned length = wids.size();
+    const unsigned separator = VocabIndexer::SENTENCE_SEPARATOR;
+    _sentence_pos->append(pos);
+    _sentence_buffer->append(length);
+    _sentence_buffer->append(wids.data(), wids.size());
+    _sentence_buffer->append(separator);
+    _buffer_size += wids.size() + 2;
+    _chunk.add_sentence(wids);
+    _chunk_tokens += wids.size();
+
+    _ids->append(id);
+    _tokens->append(real.tokstring());
+    _itoks_begin->append(_num_itoks);
+    for (const auto& itok : real.itoks())
+    {
+      const uint64_t itok_pos = itok.first;
+      _itoks_pos->append(itok_pos);
+      _itoks->append(itok.second);
+      _num_itoks++;
+    }
+    _num_sentences++;
+  }
+
+  /* the chunk is sorted with the suffix offsets of the whole index, and written as a run */
+  void
+  IndexBuilder::flush_chunk(size_t num_threads)
+  {
+    if (_chunk.num_sentences() == 0)
+      return;
+
+    _chunk.sort(_vocabIndexer.size(), SortAlgorithm::BUCKET, num_threads);
+
+    _runs.emplace_back(new SpillFile(temp_filename("run" + std::to_string(_runs.size()))));
+    auto& run = *_runs.back();
+    std::vector<offset_t> block;
+    block.reserve(SPILL_BLOCK_SIZE / sizeof (offset_t));
+    for (size_t i = 0; i < _chunk.num_suffixes(); i++)
+    {
+      block.push_back(_chunk_offset + _chunk.get_suffix_offset(i));
+      if (block.size() == block.capacity() || i + 1 == _chunk.num_suffixes())
+      {
+        run.append(block.data(), block.size());
+        block.clear();
+      }
+    }
+    run.close();
+
+    _chunk = SuffixArray();
+    _chunk_tokens = 0;
+    _chunk_offset = _buffer_size;
+  }
+
+  void
+  IndexBuilder::finish(size_t num_threads)
+  {
+    flush_chunk(num_threads);
+    _itoks_begin->append(_num_itoks);
+
+    merge_runs();
+    compute_bigram_table();
+    write_index();
+
+    _runs.clear();
+    _sentence_buffer.reset();
+    _sentence_pos.reset();
+    _ids.reset();
+    _tokens.reset();
+    _itoks_begin.reset();
+    _itoks_pos.reset();
+    _itoks.reset();
+    _suffixes.reset();
+    _lcp.reset();
+    _llcp.reset();
+    _rlcp.reset();
+    _prefix_cache.reset();
+  }
+
+  /* k-way merge of the runs, in the order of SuffixArray::comp - the LCP array, the first word
+     buckets and the prefix cache are computed on the fly */
+  void
+  IndexBuilder::merge_runs()
+  {
+    const SpillMapping<unsigned> sentence_buffer(*_sentence_buffer);
+    // the suffixes end with the separator 0, lower than any token
+    const auto greater = [&sentence_buffer](const std::pair<offset_t, size_t>& a,
+                                            const std::pair<offset_t, size_t>& b) {
+      const auto* suffix_a = sentence_buffer.data() + a.first;
+      const auto* suffix_b = sentence_buffer.data() + b.first;
+      size_t i = 0;
+      while (suffix_a[i] == suffix_b[i] && suffix_a[i] != VocabIndexer::SENTENCE_SEPARATOR)
+        i++;
+      if (suffix_a[i] != suffix_b[i])
+        return suffix_a[i] > suffix_b[i];
+      return a.first > b.first;
+    };
+
+    std::vector<std::unique_ptr<RunReader>> readers;
+    std::priority_queue<std::pair<offset_t, size_t>,
+                        std::vector<std::pair<offset_t, size_t>>,
+                        decltype(greater)> heap(greater);
+    const size_t buffer_size = _memory_budget / 2 / std::max<size_t>(_runs.size(), 1) / sizeof (offset_t);
+    for (size_t i = 0; i < _runs.size(); i++)
+    {
+      readers.emplace_back(new RunReader(*_runs[i], buffer_size));
+      offset_t suffix;
+      if (readers.back()->next(suffix))
+        heap.emplace(suffix, i);
+    }
+
+    _suffixes.reset(new SpillFile(temp_filename("suffixes")));
+    _lcp.reset(new SpillFile(temp_filename("lcp")));
+    _prefix_cache.reset(new SpillFile(temp_filename("prefix_cache")));
+    _quickVocabAccess.assign(_vocabIndexer.size() + 1, 0);
+    std::vector<uint16_t> prefix(_cached_tokens);
+
+    const unsigned* previous = nullptr;
+    while (!heap.empty())
+    {
+      const auto top = heap.top();
+      heap.pop();
+      offset_t next;
+      if (readers[top.second]->next(next))
+        heap.emplace(next, top.second);
+
+      const auto suffix = top.first;
+      const auto* tokens = sentence_buffer.data() + suffix;
+      unsigned short lcp = 0;
+      while (previous && tokens[lcp] == previous[lcp] && tokens[lcp] != VocabIndexer::SENTENCE_SEPARATOR)
+        lcp++;
+
+      _suffixes->append(suffix);
+      _lcp->append(lcp);
+      if (_cached_tokens > 0)
+      {
+        SuffixArray::cache_prefix(tokens, _cached_tokens, prefix.data());
+        _prefix_cache->append(prefix.data(), prefix.size());
+      }
+      _quickVocabAccess[tokens[0] + 1]++;
+      previous = tokens;
+    }
+    for (size_t wid = 0; wid + 1 < _quickVocabAccess.size(); wid++)
+      _quickVocabAccess[wid + 1] += _quickVocabAccess[wid];
+    readers.clear();
+    _runs.clear();
+
+    // LLCP/RLCP only depend on the LCP array of each first word bucket
+    const SpillMapping<unsigned short> lcp(*_lcp);
+    _llcp.reset(new SpillFile(temp_filename("llcp")));
+    _rlcp.reset(new SpillFile(temp_filename("rlcp")));
+    std::vector<unsigned short> llcp;
+    std::vector<unsigned short> rlcp;
+    for (size_t wid = 0; wid + 1 < _quickVocabAccess.size(); wid++)
+    {
+      const size_t begin = _quickVocabAccess[wid];
+      const size_t bucket_size = _quickVocabAccess[wid + 1] - begin;
+      llcp.assign(bucket_size, 0);
+      rlcp.assign(bucket_size, 0);
+      SuffixArray::compute_lr_lcp(lcp.data() + begin, bucket_size, llcp.data(), rlcp.data());
+      _llcp->append(llcp.data(), bucket_size);
+      _rlcp->append(rlcp.data(), bucket_size);
+    }
+  }
+
+  /* one more pass on the merged suffixes: the table only holds the large buckets and stays in memory */
+  void
+  IndexBuilder::compute_bigram_table()
+  {
+    const auto start = std::chrono::steady_clock::now();
+    const SpillMapping<unsigned> sentence_buffer(*_sentence_buffer);
+    const SpillMapping<offset_t> suffixes(*_suffixes);
+    SuffixArray::compute_bigram_table(sentence_buffer.data(), suffixes.data(), _quickVocabAccess.data(),
+                                      _vocabIndexer.size(),
+                                      _bigram_index, _bigram_second_words, _bigram_starts);
+    _bigram_table_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  /* layout of RankBitVector::save_mapped for the sentence starts of the suffix array, without holding
+     the bit vector in memory */
+  static void
+  write_sentence_starts(MappedFileWriter& writer, const offset_t* sentence_pos, size_t num_sentences,
+                        size_t buffer_size)
+  {
+    writer.write_value<uint64_t>(buffer_size);
+
+    const size_t num_words = (buffer_size + 63) / 64;
+    writer.begin_section(num_words * sizeof (uint64_t));
+    size_t sentence_id = 0;
+    for (size_t word = 0; word < num_words; word++)
+    {
+      uint64_t bits = 0;
+      for (; sentence_id < num_sentences && sentence_pos[sentence_id] < (word + 1) * 64; sentence_id++)
+        bits |= uint64_t(1) << (sentence_pos[sentence_id] % 64);
+      writer.append(&bits, sizeof (bits));
+    }
+    writer.end_section();
+
+    const size_t num_ranks = buffer_size / 512 + 1;
+    writer.begin_section(num_ranks * sizeof (uint64_t));
+    sentence_id = 0;
+    for (size_t block = 0; block < num_ranks; block++)
+    {
+      while (sentence_id < num_sentences && sentence_pos[sentence_id] < block * 512)
+        sentence_id++;
+      const uint64_t rank = sentence_id;
+      writer.append(&rank, sizeof (rank));
+    }
+    writer.end_section();
+  }
+
+  /* the tokens on 2 bytes when they fit, as SuffixArray::shorten_tokens */
+  static void
+  write_sentence_buffer(MappedFileWriter& writer, SpillFile& sentence_buffer, size_t vocab_size)
+  {
+    const SpillMapping<unsigned> mapping(sentence_buffer);
+    const auto* tokens = mapping.data();
+    const size_t size = sentence_buffer.num_bytes() / sizeof (unsigned);
+    const unsigned max_short_token = std::numeric_limits<uint16_t>::max();
+    const bool short_tokens = (vocab_size <= size_t(max_short_token) + 1
+                               && std::all_of(tokens, tokens + size,
+                                              [max_short_token](unsigned token) {
+                                                return token <= max_short_token;
+                                              }));
+
+    writer.write_value<uint64_t>(short_tokens ? sizeof (uint16_t) : sizeof (unsigned));
+    if (!short_tokens)
+    {
+      writer.write(tokens, size);
+      return;
+    }
+
+    std::vector<uint16_t> block;
+    block.reserve(SPILL_BLOCK_SIZE / sizeof (uint16_t));
+    writer.begin_section(size * sizeof (uint16_t));
+    for (size_t i = 0; i < size; i++)
+    {
+      block.push_back(tokens[i]);
+      if (block.size() == block.capacity() || i + 1 == size)
+      {
+        writer.append(block.data(), block.size() * sizeof (uint16_t));
+        block.clear();
+      }
+    }
+    writer.end_section();
+  }
+
+  /* same layout as FuzzyMatch::save_mapped, with a sorted suffix array and an empty delta */
+  void
+  IndexBuilder::write_index()
+  {
+    std::ofstream ofs;
+    ofs.exceptions(std::ios_base::failbit | std::ios_base::badbit);
+    ofs.open(_index_filename.c_str(), std::ios_base::binary);
+
+    auto writer = begin_mapped_fuzzy_matcher(ofs);
+    writer.write_value<int64_t>(_pt);
+    writer.write_value<uint64_t>(_max_tokens_in_pattern);
+    _vocabIndexer.save_mapped(writer);
+
+    writer.write_value<uint64_t>(true);
+    _suffixes->copy_to(writer);
+    write_sentence_buffer(writer, *_sentence_buffer, _vocabIndexer.size());
+    _sentence_pos->copy_to(writer);
+    writer.write(_quickVocabAccess.data(), _quickVocabAccess.size());
+    {
+      const SpillMapping<offset_t> sentence_pos(*_sentence_pos);
+      write_sentence_starts(writer, sentence_pos.data(), _num_sentences, _buffer_size);
+    }
+    _lcp->copy_to(writer);
+    _llcp->copy_to(writer);
+    _rlcp->copy_to(writer);
+    writer.write_value<uint64_t>(_cached_tokens);
+    _prefix_cache->copy_to(writer);
+    _prefix_cache_bytes = _prefix_cache->num_bytes();
+    writer.write(_bigram_index.data(), _bigram_index.size());
+    writer.write(_bigram_second_words.data(), _bigram_second_words.size());
+    writer.write(_bigram_starts.data(), _bigram_starts.size());
+    // no length index, sentence listing nor suffix links: they need the sentence ids, or the rank, of all
+    // the suffixes in memory
+    writer.write_value<uint64_t>(false);
+    WaveletMatrix().save_mapped(writer);
+    writer.write_value<uint64_t>(false);
+    RangeMinimum().save_mapped(writer);
+    writer.write_value<uint64_t>(false);
+    writer.write<offset_t>(nullptr, 0);
+    RangeMinimum().save_mapped(writer);
+    writer.write<unsigned char>(nullptr, 0);
+    FMIndex().save_mapped(writer);
+    SuffixArray().save_mapped(writer);
+
+    _ids->copy_to(writer);
+    _tokens->copy_to(writer);
+    _itoks_begin->copy_to(writer);
+    _itoks_pos->copy_to(writer);
+    _itoks->copy_to(writer);
+  }
+}
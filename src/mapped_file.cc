@@ -0,0 +1,86 @@
+#include <fuzzy/mapped_file.hh>
+
+namespace fuzzy
+{
+  MappedFileWriter::MappedFileWriter(std::ostream& os, size_t position)
+    : _os(os)
+    , _position(position)
+  {
+    pad();
+  }
+
+  void
+  MappedFileWriter::pad()
+  {
+    static const char zeros[MAPPED_ALIGNMENT] = {0};
+    const size_t padding = (MAPPED_ALIGNMENT - _position % MAPPED_ALIGNMENT) % MAPPED_ALIGNMENT;
+    _os.write(zeros, padding);
+    _position += padding;
+  }
+
+  void
+  MappedFileWriter::begin_section(size_t num_bytes)
+  {
+    const uint64_t size = num_bytes;
+    _os.write(reinterpret_cast<const char*>(&size), sizeof (size));
+    _position += sizeof (size);
+    _section_end = _position + num_bytes;
+  }
+
+  void
+  MappedFileWriter::append(const void* data, size_t num_bytes)
+  {
+    if (_position + num_bytes > _section_end)
+      throw std::logic_error("mapped file section overflow");
+    _os.write(static_cast<const char*>(data), num_bytes);
+    _position += num_bytes;
+  }
+
+  void
+  MappedFileWriter::end_section()
+  {
+    if (_position != _section_end)
+      throw std::logic_error("incomplete mapped file section");
+    pad();
+  }
+
+  void
+  MappedFileWriter::write(const FlatStrings& strings)
+  {
+    write(strings.offsets);
+    write(strings.chars);
+  }
+
+  MappedFileReader::MappedFileReader(const char* data, size_t size, size_t position)
+    : _data(data)
+    , _size(size)
+    , _position((position + MAPPED_ALIGNMENT - 1) / MAPPED_ALIGNMENT * MAPPED_ALIGNMENT)
+  {
+  }
+
+  const char*
+  MappedFileReader::section(size_t* num_bytes)
+  {
+    uint64_t size = 0;
+    if (_position + sizeof (size) > _size)
+      throw std::runtime_error("corrupted FMI file: truncated section");
+    std::memcpy(&size, _data + _position, sizeof (size));
+    _position += sizeof (size);
+    if (size > _size - _position)
+      throw std::runtime_error("corrupted FMI file: truncated section");
+
+    const char* data = _data + _position;
+    _position += (size + MAPPED_ALIGNMENT - 1) / MAPPED_ALIGNMENT * MAPPED_ALIGNMENT;
+    *num_bytes = size;
+    return data;
+  }
+
+  void
+  MappedFileReader::read(FlatStrings& strings)
+  {
+    read(strings.offsets);
+    read(strings.chars);
+    if (!strings.offsets.empty() && strings.offsets.back() != strings.chars.size())
+      throw std::runtime_error("corrupted FMI file: invalid strings");
+  }
+}
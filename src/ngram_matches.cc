@@ -1,26 +1,98 @@
 #include <fuzzy/ngram_matches.hh>
 
+#include <algorithm>
 #include <cmath>
 
 namespace fuzzy
 {
+  // number of suffixes whose sentence ids and lengths are fetched together
+  static const size_t REGISTER_BLOCK_SIZE = 32;
+  /* the length index lists the accepted suffixes of the ranges of at least LENGTH_INDEX_MIN_RANGE suffixes
+     when they are less than 1 out of LENGTH_INDEX_LISTING_COST: listing one goes up the levels of the
+     wavelet matrix with binary searches, where the scan reads a few cache lines per suffix */
+  static const size_t LENGTH_INDEX_MIN_RANGE = 256;
+  static const size_t LENGTH_INDEX_LISTING_COST = 16;
+  /* the sentence listing replaces the scan of the ranges of at least SENTENCE_LISTING_MIN_RANGE suffixes */
+  static const size_t SENTENCE_LISTING_MIN_RANGE = 256;
+
+  CandidateTable::CandidateTable(uint32_t epoch)
+    : _epoch(epoch)
+  {
+  }
+
+  void
+  CandidateTable::reset(size_t num_sentences)
+  {
+    if (num_sentences > _epochs.size())
+    {
+      _longest_matches.resize(num_sentences);
+      _epochs.resize(num_sentences, 0);
+    }
+    _touched.clear();
+    // the stamps of the previous patterns are only erased when the epoch wraps around
+    if (++_epoch == 0)
+    {
+      std::fill(_epochs.begin(), _epochs.end(), 0);
+      _epoch = 1;
+    }
+  }
+
+  void
+  CandidateTable::update(unsigned sentence_id, unsigned match_length)
+  {
+    if (_epochs[sentence_id] != _epoch)
+    {
+      _epochs[sentence_id] = _epoch;
+      _longest_matches[sentence_id] = match_length;
+      _touched.push_back(sentence_id);
+    }
+    else if (match_length > _longest_matches[sentence_id])
+      _longest_matches[sentence_id] = match_length;
+  }
+
+  unsigned
+  CandidateTable::longest_match(unsigned sentence_id) const
+  {
+    return _longest_matches[sentence_id];
+  }
+
+  const std::vector<unsigned>&
+  CandidateTable::touched() const
+  {
+    return _touched;
+  }
+
   NGramMatches::NGramMatches(float fuzzy,
                              unsigned p_length,
                              unsigned min_seq_len,
-                             const SuffixArray& suffixArray)
+                             const SuffixArray& suffixArray,
+                             unsigned sentence_id_offset,
+                             CandidateTable* candidate_table)
     /* add a small epsilon to avoid rounding errors counting for an error */
     : fuzzy_threshold(fuzzy),
       _p_length(p_length),
       _min_seq_len(min_seq_len),
-      _suffixArray(suffixArray)
+      _suffixArray(suffixArray),
+      _sentence_id_offset(sentence_id_offset),
+      _candidate_table(candidate_table)
   {
+    if (_candidate_table)
+      _candidate_table->reset(_suffixArray.num_sentences());
   }
 
   std::vector<std::pair<unsigned, unsigned>>
   NGramMatches::get_longest_matches() const
   {
-    std::vector<std::pair<unsigned, unsigned>> sorted_matches(_longest_matches.begin(),
-                                                              _longest_matches.end());
+    std::vector<std::pair<unsigned, unsigned>> sorted_matches;
+    if (_candidate_table)
+    {
+      sorted_matches.reserve(_candidate_table->touched().size());
+      for (const auto local_sentence_id : _candidate_table->touched())
+        sorted_matches.emplace_back(_sentence_id_offset + local_sentence_id,
+                                    _candidate_table->longest_match(local_sentence_id));
+    }
+    else
+      sorted_matches.assign(_longest_matches.begin(), _longest_matches.end());
     std::sort(sorted_matches.begin(), sorted_matches.end(),
               [](const std::pair<unsigned, unsigned>& a, const std::pair<unsigned, unsigned>& b) {
                 return a.second > b.second || (a.second == b.second && a.first < b.first);
@@ -58,6 +130,98 @@ namespace fuzzy
     return theoretical_bound + 0.000005 < fuzzy_threshold;
   }
 
+  inline void
+  NGramMatches::set_rejection_costs(const EditCosts& edit_costs)
+  {
+    if (edit_costs.insert_cost != _rejection_costs[0]
+        || edit_costs.delete_cost != _rejection_costs[1]
+        || edit_costs.replace_cost != _rejection_costs[2])
+    {
+      _length_rejections.clear();
+      _accepted_lengths.clear();
+      _accepted_max_length = 0;
+      _rejection_costs[0] = edit_costs.insert_cost;
+      _rejection_costs[1] = edit_costs.delete_cost;
+      _rejection_costs[2] = edit_costs.replace_cost;
+    }
+  }
+
+  /* the rejection only depends on the sentence length for a pattern: -1 if not computed yet */
+  inline bool
+  NGramMatches::length_rejection(size_t s_length, const EditCosts& edit_costs)
+  {
+    set_rejection_costs(edit_costs);
+    if (s_length >= _length_rejections.size())
+      _length_rejections.resize(s_length + 1, -1);
+    auto& rejection = _length_rejections[s_length];
+    if (rejection < 0)
+      rejection = theoretical_rejection(_p_length, s_length, edit_costs);
+    return rejection;
+  }
+
+  /* usually a single interval around the pattern length */
+  const std::vector<std::pair<unsigned, unsigned>>&
+  NGramMatches::accepted_lengths(unsigned max_length, const EditCosts& edit_costs)
+  {
+    set_rejection_costs(edit_costs);
+    if (max_length != _accepted_max_length)
+    {
+      _accepted_lengths.clear();
+      _accepted_max_length = max_length;
+      bool accepted = false;
+      for (unsigned s_length = 0; s_length <= max_length; s_length++)
+      {
+        if (length_rejection(s_length, edit_costs))
+          accepted = false;
+        else if (accepted)
+          _accepted_lengths.back().second = s_length;
+        else
+        {
+          _accepted_lengths.emplace_back(s_length, s_length);
+          accepted = true;
+        }
+      }
+    }
+    return _accepted_lengths;
+  }
+
+  inline void
+  NGramMatches::register_sentence(unsigned local_sentence_id, unsigned match_length)
+  {
+    // Removed sentences never reach the edit distance
+    if (_suffixArray.is_removed(local_sentence_id))
+      return;
+
+    if (_candidate_table)
+    {
+      _candidate_table->update(local_sentence_id, match_length);
+      return;
+    }
+
+    // Get or create the PatternMatch corresponding to the sentence (of the suffix that matched)
+    const auto sentence_id = _sentence_id_offset + local_sentence_id;
+    auto& longest_match = _longest_matches.try_emplace(sentence_id, match_length).first.value();
+    longest_match = std::max(longest_match, match_length);
+  }
+
+  /* count is at most REGISTER_BLOCK_SIZE */
+  inline void
+  NGramMatches::register_sentences(const unsigned* sentence_ids,
+                                   size_t count,
+                                   unsigned match_length,
+                                   const EditCosts& edit_costs)
+  {
+    unsigned s_lengths[REGISTER_BLOCK_SIZE];
+    _suffixArray.get_sentence_lengths(sentence_ids, count, s_lengths);
+
+    for (size_t i = 0; i < count; i++)
+    {
+      // The size difference between the suffix and the pattern is too large for the suffix to be accepted
+      if (!length_rejection(s_lengths[i], edit_costs))
+        register_sentence(sentence_ids[i], match_length);
+    }
+  }
+
   void
   NGramMatches::register_suffix_range_match(size_t begin, size_t end, unsigned match_length, const EditCosts &edit_costs)
   {
@@ -65,20 +229,49 @@ namespace fuzzy
     if (match_length < _min_seq_len)
       return;
 
-    // For each suffix that matches at least match_length
-    for (auto i = begin; i < end; i++)
+    // Only the suffixes whose sentence length is accepted, when they are few
+    if (_suffixArray.has_length_index() && end - begin >= LENGTH_INDEX_MIN_RANGE)
     {
-      // The size difference between the suffix and the pattern is too large for the suffix to be accepted
-      const auto p_length = _p_length;
-      const auto s_length = _suffixArray.get_sentence_length(i);
+      const auto& length_index = _suffixArray.length_index();
+      const unsigned max_length = (uint64_t(1) << length_index.bits_per_value()) - 1;
+      const auto& windows = accepted_lengths(max_length, edit_costs);
+      size_t count = 0;
+      for (const auto& window : windows)
+        count += length_index.count(begin, end, window.first, window.second);
+      if (count * LENGTH_INDEX_LISTING_COST < end - begin)
+      {
+        for (const auto& window : windows)
+          length_index.report(begin, end, window.first, window.second, [&](size_t suffix_id) {
+            register_sentence(_suffixArray.get_suffix_view(suffix_id).sentence_id, match_length);
+          });
+        return;
+      }
+    }
 
-      if (theoretical_rejection(p_length, s_length, edit_costs))
-        continue;
+    unsigned sentence_ids[REGISTER_BLOCK_SIZE];
 
-      // Get or create the PatternMatch corresponding to the sentence (of the suffix that matched)
-      const auto sentence_id = _suffixArray.get_suffix_view(i).sentence_id;
-      auto& longest_match = _longest_matches.try_emplace(sentence_id, match_length).first.value();
-      longest_match = std::max(longest_match, match_length);
+    // Each sentence once, when the n-gram is repeated in the sentences
+    if (_suffixArray.has_sentence_listing() && end - begin >= SENTENCE_LISTING_MIN_RANGE)
+    {
+      size_t count = 0;
+      _suffixArray.visit_distinct_sentences(begin, end, [&](unsigned sentence_id) {
+        sentence_ids[count++] = sentence_id;
+        if (count == REGISTER_BLOCK_SIZE)
+        {
+          register_sentences(sentence_ids, count, match_length, edit_costs);
+          count = 0;
+        }
+      });
+      register_sentences(sentence_ids, count, match_length, edit_costs);
+      return;
+    }
+
+    // For each suffix that matches at least match_length, by blocks whose memory accesses overlap
+    for (auto block = begin; block < end; block += REGISTER_BLOCK_SIZE)
+    {
+      const size_t block_size = std::min(end - block, REGISTER_BLOCK_SIZE);
+      _suffixArray.get_sentence_ids(block, block + block_size, sentence_ids);
+      register_sentences(sentence_ids, block_size, match_length, edit_costs);
     }
   }
 }
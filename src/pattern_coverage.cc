@@ -1,6 +1,7 @@
 #include "fuzzy/pattern_coverage.hh"
 
 #include <algorithm>
+#include <cstdint>
 
 namespace fuzzy
 {
@@ -12,7 +13,8 @@ namespace fuzzy
       _words_count[word]++;
   }
 
-  size_t PatternCoverage::count_covered_words(const unsigned* sentence, size_t sentence_length) const
+  template <typename Token>
+  size_t PatternCoverage::count_covered_words(const Token* sentence, size_t sentence_length) const
   {
     size_t num_covered_words = 0;
 
@@ -27,4 +29,7 @@ namespace fuzzy
     return num_covered_words;
   }
 
+  template size_t PatternCoverage::count_covered_words(const unsigned*, size_t) const;
+  template size_t PatternCoverage::count_covered_words(const uint16_t*, size_t) const;
+
 }
@@ -0,0 +1,54 @@
+#include <fuzzy/range_minimum.hh>
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace fuzzy
+{
+  /* levels of minima are added until one fits in a block, which is then scanned directly */
+  RangeMinimum::RangeMinimum(std::vector<offset_t> values)
+  {
+    _values.vector().swap(values);
+    std::vector<offset_t> minima;
+    std::vector<uint64_t> level_starts(1, 0);
+    std::vector<offset_t> level(_values.begin(), _values.end());
+    while (level.size() > RANGE_MINIMUM_BLOCK)
+    {
+      std::vector<offset_t> next;
+      next.reserve((level.size() + RANGE_MINIMUM_BLOCK - 1) / RANGE_MINIMUM_BLOCK);
+      for (size_t block = 0; block < level.size(); block += RANGE_MINIMUM_BLOCK)
+        next.push_back(*std::min_element(level.begin() + block,
+                                         level.begin() + std::min(level.size(), block + RANGE_MINIMUM_BLOCK)));
+      minima.insert(minima.end(), next.begin(), next.end());
+      level_starts.push_back(minima.size());
+      level.swap(next);
+    }
+    _minima.vector().swap(minima);
+    _level_starts.vector().swap(level_starts);
+  }
+
+  void
+  RangeMinimum::save_mapped(MappedFileWriter& writer) const
+  {
+    writer.write(_values);
+    writer.write(_minima);
+    writer.write(_level_starts);
+  }
+
+  void
+  RangeMinimum::load_mapped(MappedFileReader& reader)
+  {
+    reader.read(_values);
+    reader.read(_minima);
+    reader.read(_level_starts);
+    // empty when written by the default constructor
+    bool valid = (_level_starts.empty()
+                  ? _values.empty() && _minima.empty()
+                  : _level_starts[0] == 0 && _level_starts.back() == _minima.size());
+    for (size_t level = 1; valid && level < _level_starts.size(); level++)
+      valid = (level_size(level)
+               == (level_size(level - 1) + RANGE_MINIMUM_BLOCK - 1) / RANGE_MINIMUM_BLOCK);
+    if (!valid)
+      throw std::runtime_error("corrupted FMI file: invalid range minimum");
+  }
+}
@@ -0,0 +1,152 @@
+#include <fuzzy/sais.hh>
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+namespace fuzzy
+{
+  static const unsigned EMPTY = std::numeric_limits<unsigned>::max();
+
+  /* bucket boundaries for each character: start of the bucket or end (exclusive) of the bucket */
+  static void
+  get_buckets(const unsigned* text, size_t n, std::vector<unsigned>& bkt, bool end)
+  {
+    std::fill(bkt.begin(), bkt.end(), 0);
+    for (size_t i = 0; i < n; i++)
+      bkt[text[i]]++;
+
+    unsigned sum = 0;
+    for (size_t c = 0; c < bkt.size(); c++)
+    {
+      sum += bkt[c];
+      bkt[c] = end ? sum : sum - bkt[c];
+    }
+  }
+
+  static void
+  induce_l(const unsigned* text, unsigned* sa, size_t n,
+           const std::vector<bool>& stype, std::vector<unsigned>& bkt)
+  {
+    get_buckets(text, n, bkt, false);
+    for (size_t i = 0; i < n; i++)
+    {
+      if (sa[i] == EMPTY || sa[i] == 0)
+        continue;
+      const unsigned j = sa[i] - 1;
+      if (!stype[j])
+        sa[bkt[text[j]]++] = j;
+    }
+  }
+
+  static void
+  induce_s(const unsigned* text, unsigned* sa, size_t n,
+           const std::vector<bool>& stype, std::vector<unsigned>& bkt)
+  {
+    get_buckets(text, n, bkt, true);
+    for (size_t i = n; i-- > 0; )
+    {
+      if (sa[i] == EMPTY || sa[i] == 0)
+        continue;
+      const unsigned j = sa[i] - 1;
+      if (stype[j])
+        sa[--bkt[text[j]]] = j;
+    }
+  }
+
+  void
+  sais(const unsigned* text, unsigned* sa, size_t n, size_t alphabet_size)
+  {
+    if (n == 0)
+      return;
+    if (n == 1)
+    {
+      sa[0] = 0;
+      return;
+    }
+
+    /* suffix types: S (true) if smaller than the next suffix, L (false) otherwise */
+    std::vector<bool> stype(n);
+    stype[n - 1] = true;
+    for (size_t i = n - 1; i-- > 0; )
+      stype[i] = text[i] < text[i + 1] || (text[i] == text[i + 1] && stype[i + 1]);
+
+    const auto is_lms = [&stype, n](size_t i) {
+      return i > 0 && i < n && stype[i] && !stype[i - 1];
+    };
+
+    std::vector<unsigned> bkt(alphabet_size);
+
+    /* stage 1: sort the LMS-substrings */
+    get_buckets(text, n, bkt, true);
+    std::fill(sa, sa + n, EMPTY);
+    for (size_t i = 1; i < n; i++)
+      if (is_lms(i))
+        sa[--bkt[text[i]]] = i;
+    induce_l(text, sa, n, stype, bkt);
+    induce_s(text, sa, n, stype, bkt);
+
+    /* compact the sorted LMS-substrings in the first n1 items of sa */
+    size_t n1 = 0;
+    for (size_t i = 0; i < n; i++)
+      if (is_lms(sa[i]))
+        sa[n1++] = sa[i];
+
+    /* name the LMS-substrings - names are stored at sa[n1 + pos/2] since LMS positions are at least 2 apart */
+    std::fill(sa + n1, sa + n, EMPTY);
+    unsigned name = 0;
+    size_t prev = n;
+    for (size_t i = 0; i < n1; i++)
+    {
+      const size_t pos = sa[i];
+      bool diff = false;
+      for (size_t d = 0; d < n; d++)
+      {
+        if (prev == n || pos + d == n || prev + d == n
+            || text[pos + d] != text[prev + d] || stype[pos + d] != stype[prev + d])
+        {
+          diff = true;
+          break;
+        }
+        if (d > 0 && (is_lms(pos + d) || is_lms(prev + d)))
+          break;
+      }
+      if (diff)
+      {
+        name++;
+        prev = pos;
+      }
+      sa[n1 + pos / 2] = name - 1;
+    }
+    for (size_t i = n, j = n; i-- > n1; )
+      if (sa[i] != EMPTY)
+        sa[--j] = sa[i];
+
+    /* stage 2: sort the reduced string, recursively if the names are not unique */
+    unsigned* sa1 = sa;
+    unsigned* s1 = sa + n - n1;
+    if (name < n1)
+      sais(s1, sa1, n1, name);
+    else
+      for (size_t i = 0; i < n1; i++)
+        sa1[s1[i]] = i;
+
+    /* stage 3: induce the final order from the sorted LMS-suffixes */
+    for (size_t i = 1, j = 0; i < n; i++)
+      if (is_lms(i))
+        s1[j++] = i;
+    for (size_t i = 0; i < n1; i++)
+      sa1[i] = s1[sa1[i]];
+    std::fill(sa + n1, sa + n, EMPTY);
+
+    get_buckets(text, n, bkt, true);
+    for (size_t i = n1; i-- > 0; )
+    {
+      const unsigned j = sa[i];
+      sa[i] = EMPTY;
+      sa[--bkt[text[j]]] = j;
+    }
+    induce_l(text, sa, n, stype, bkt);
+    induce_s(text, sa, n, stype, bkt);
+  }
+}
@@ -36,4 +36,23 @@ namespace fuzzy
   Sentence::operator Tokens() const {
     return split_string(_tokstring, '\t');
   } 
+
+  /* the same tokens as split_string: the last one is dropped when empty */
+  void SentenceView::assign(std::string_view tokstring, size_t length) {
+    tokens.clear();
+    for (size_t begin = 0; begin < tokstring.size();) {
+      size_t end = tokstring.find('\t', begin);
+      if (end == std::string_view::npos)
+        end = tokstring.size();
+      tokens.push_back(tokstring.substr(begin, end - begin));
+      begin = end + 1;
+    }
+    st.assign(length + 1, nullptr);
+    sn.assign(length + 1, 0);
+  }
+
+  void SentenceView::assign(const Sentence& sentence, size_t length) {
+    assign(sentence.tokstring(), length);
+    sentence.get_itoks(st, sn);
+  }
 }
@@ -2,25 +2,38 @@
 
 #include <fuzzy/ngram_matches.hh>
 #include <fuzzy/vocab_indexer.hh>
+#include <fuzzy/sais.hh>
+#include <fuzzy/parallel.hh>
 #include <cassert>
+#include <limits>
+#include <stdexcept>
 
 namespace fuzzy
 {
   unsigned
   SuffixArray::add_sentence(const std::vector<unsigned>& sentence)
   {
+    decompress();
+    widen_tokens();
+    auto& sentence_buffer = _sentence_buffer.vector();
+    if (_sentence_buffer.size() + sentence.size() + 2 > std::numeric_limits<offset_t>::max())
+      throw std::length_error("Too many tokens in the suffix array: build with LARGE_INDEX");
+
+    auto& suffixes = _suffixes.vector();
     size_t sidx = _sentence_pos.size();
-    _sentence_pos.push_back(_sentence_buffer.size());
+    _sentence_pos.vector().push_back(sentence_buffer.size());
 
     /* first token in sentence buffer is the sentence size */
-    _sentence_buffer.push_back(sentence.size());
+    sentence_buffer.push_back(sentence.size());
 
     for (size_t i = 0; i < sentence.size(); i++)
     {
-      _sentence_buffer.push_back(sentence[i]);
-      _suffixes.push_back(SuffixView{static_cast<unsigned int>(sidx), static_cast<unsigned short>(i+1)});
+      suffixes.push_back(sentence_buffer.size());
+      sentence_buffer.push_back(sentence[i]);
     }
-    _sentence_buffer.push_back(fuzzy::VocabIndexer::SENTENCE_SEPARATOR);
+    sentence_buffer.push_back(fuzzy::VocabIndexer::SENTENCE_SEPARATOR);
+    if (!_removed.empty())
+      _removed.push_back(false);
     _sorted = false;
 
     return sidx;
@@ -30,86 +43,1008 @@ namespace fuzzy
   std::ostream&
   SuffixArray::dump(std::ostream& os)const
   {
-    os << "   ===text===" << std::endl;
+    visit_tokens([this, &os](const auto* tokens) {
+      os << "   ===text===" << std::endl;
+
+      for (size_t i = 0; i < _sentence_pos.size(); i++)
+      {
+        size_t idx = _sentence_pos[i];
+        for (size_t j = 0; tokens[j+idx]; j++)
+          os << tokens[j+idx] << " ";
+        os << std::endl;
+      }
+
+      os << "   ===suffixes===" << std::endl;
+
+      for (size_t i = 0; i < num_suffixes(); i++)
+      {
+        const auto suffix = get_suffix_view(i);
+        os << i << "(" << suffix.sentence_id << "/" << suffix.subsentence_pos << "):: ";
+        size_t idx = _sentence_pos[suffix.sentence_id];
+        for (size_t j = suffix.subsentence_pos; tokens[idx+j]; j++)
+          os << tokens[idx+j] << " ";
+        os << std::endl;
+      }
+    });
+
+    return os;
+  }
+#endif
+
+  void
+  SuffixArray::save_mapped(MappedFileWriter& writer) const
+  {
+    writer.write_value<uint64_t>(_sorted);
+    writer.write(_suffixes);
+    writer.write_value<uint64_t>(token_bytes());
+    if (_short_tokens)
+      writer.write(_short_sentence_buffer);
+    else
+      writer.write(_sentence_buffer);
+    writer.write(_sentence_pos);
+    writer.write(_quickVocabAccess);
+    _sentence_starts.save_mapped(writer);
+    writer.write(_lcp);
+    writer.write(_llcp);
+    writer.write(_rlcp);
+    writer.write_value(_cached_tokens);
+    writer.write(_prefix_cache);
+    writer.write(_bigram_index);
+    writer.write(_bigram_second_words);
+    writer.write(_bigram_starts);
+    writer.write_value<uint64_t>(_index_lengths);
+    _length_index.save_mapped(writer);
+    writer.write_value<uint64_t>(_index_sentence_listing);
+    _previous_suffixes.save_mapped(writer);
+    writer.write_value<uint64_t>(_index_suffix_links);
+    writer.write(_suffix_links);
+    _lcp_minima.save_mapped(writer);
+
+    const std::vector<unsigned char> removed(_removed.begin(), _removed.end());
+    writer.write(removed.data(), removed.size());
+    _fm_index.save_mapped(writer);
+  }
+
+  void
+  SuffixArray::load_mapped(MappedFileReader& reader)
+  {
+    _sorted = reader.read_value<uint64_t>();
+    reader.read(_suffixes);
+    const auto token_bytes = reader.read_value<uint64_t>();
+    _short_tokens = token_bytes == sizeof (uint16_t);
+    if (_short_tokens)
+      reader.read(_short_sentence_buffer);
+    else if (token_bytes == sizeof (unsigned))
+      reader.read(_sentence_buffer);
+    else
+      throw std::runtime_error("corrupted FMI file: invalid token size");
+    reader.read(_sentence_pos);
+    reader.read(_quickVocabAccess);
+    _sentence_starts.load_mapped(reader);
+    reader.read(_lcp);
+    reader.read(_llcp);
+    reader.read(_rlcp);
+    _cached_tokens = reader.read_value<uint64_t>();
+    reader.read(_prefix_cache);
+    reader.read(_bigram_index);
+    reader.read(_bigram_second_words);
+    reader.read(_bigram_starts);
+    _index_lengths = reader.read_value<uint64_t>();
+    _length_index.load_mapped(reader);
+    _index_sentence_listing = reader.read_value<uint64_t>();
+    _previous_suffixes.load_mapped(reader);
+    _index_suffix_links = reader.read_value<uint64_t>();
+    reader.read(_suffix_links);
+    _lcp_minima.load_mapped(reader);
+
+    FlatArray<unsigned char> removed;
+    reader.read(removed);
+    _removed.assign(removed.begin(), removed.end());
+    _num_removed = std::count(_removed.begin(), _removed.end(), true);
+    _fm_index.load_mapped(reader);
+    _compressed = _fm_index.size() > 0;
+
+    if ((_sorted && _sentence_starts.size() != buffer_size())
+        || (!_removed.empty() && _removed.size() != _sentence_pos.size()))
+      throw std::runtime_error("corrupted FMI file: inconsistent suffix array");
+    if (_compressed)
+    {
+      if (!_sorted || _fm_index.size() + _sentence_pos.size() != buffer_size())
+        throw std::runtime_error("corrupted FMI file: inconsistent suffix array");
+      return;
+    }
+    if (_sorted && (_lcp.size() != _suffixes.size()
+                    || _llcp.size() != _suffixes.size() || _rlcp.size() != _suffixes.size()
+                    || _prefix_cache.size() != _suffixes.size() * _cached_tokens
+                    || _bigram_index.size() != _quickVocabAccess.size()
+                    || _bigram_starts.size() != _bigram_second_words.size()
+                    || (!_bigram_index.empty()
+                        && _bigram_index[_bigram_index.size() - 1] != _bigram_starts.size())
+                    || _length_index.size() != (_index_lengths ? _suffixes.size() : 0)
+                    || _previous_suffixes.size() != (_index_sentence_listing ? _suffixes.size() : 0)
+                    || _suffix_links.size() != (_index_suffix_links ? _suffixes.size() : 0)
+                    || _lcp_minima.size() != _suffix_links.size()))
+      throw std::runtime_error("corrupted FMI file: inconsistent suffix array");
+  }
+
+  void
+  SuffixArray::sort(size_t vocab_size, SortAlgorithm algorithm, size_t num_threads)
+  {
+    if (_sorted)
+      return;
+    // only sorted arrays have short tokens
+    assert(!_short_tokens);
+
+    if (algorithm == SortAlgorithm::SAIS)
+      sort_sais(vocab_size);
+    else
+      sort_buckets(vocab_size, num_threads);
+
+    _sorted = true;
+
+    compute_lcp();
+    compute_lr_lcp();
+    compute_sentence_starts();
+    shorten_tokens(vocab_size);
+    compute_prefix_cache();
+    compute_bigram_table();
+    compute_length_index();
+    compute_sentence_listing();
+    compute_suffix_links();
+  }
+
+  void
+  SuffixArray::cache_prefixes(size_t cached_tokens)
+  {
+    _cached_tokens = cached_tokens;
+    if (_sorted && !_compressed)
+      compute_prefix_cache();
+  }
+
+  void
+  SuffixArray::compute_prefix_cache()
+  {
+    auto& prefix_cache = _prefix_cache.vector();
+    prefix_cache.assign(_suffixes.size() * _cached_tokens, 0);
+    if (_cached_tokens == 0)
+      return;
+    visit_tokens([&](const auto* tokens) {
+      for (size_t i = 0; i < _suffixes.size(); i++)
+        cache_prefix(tokens + _suffixes[i], _cached_tokens, prefix_cache.data() + i * _cached_tokens);
+    });
+  }
+
+  void
+  SuffixArray::index_lengths(bool enable)
+  {
+    _index_lengths = enable;
+    if (_sorted && !_compressed)
+      compute_length_index();
+  }
+
+  void
+  SuffixArray::compute_length_index()
+  {
+    if (!_index_lengths || _suffixes.empty())
+    {
+      _length_index = WaveletMatrix();
+      return;
+    }
+    std::vector<unsigned> lengths(_suffixes.size());
+    unsigned max_length = 0;
+    for (size_t suffix_id = 0; suffix_id < _suffixes.size(); suffix_id++)
+    {
+      lengths[suffix_id] = sentence_length(get_sentence_id(_suffixes[suffix_id]));
+      max_length = std::max(max_length, lengths[suffix_id]);
+    }
+    unsigned bits = 1;
+    while (bits < 32 && (max_length >> bits) != 0)
+      bits++;
+    _length_index = WaveletMatrix(lengths, bits);
+  }
+
+  void
+  SuffixArray::index_sentence_listing(bool enable)
+  {
+    _index_sentence_listing = enable;
+    if (_sorted && !_compressed)
+      compute_sentence_listing();
+  }
 
-    for (size_t i = 0; i < _sentence_pos.size(); i++)
+  void
+  SuffixArray::compute_sentence_listing()
+  {
+    if (!_index_sentence_listing || _suffixes.empty())
     {
-      size_t idx = _sentence_pos[i];
-      for (size_t j = 0; _sentence_buffer[j+idx]; j++)
-        os << _sentence_buffer[j+idx] << " ";
-      os << std::endl;
+      _previous_suffixes = RangeMinimum();
+      return;
+    }
+    std::vector<offset_t> previous_suffixes(_suffixes.size());
+    std::vector<offset_t> last_suffixes(num_sentences(), 0);
+    for (size_t suffix_id = 0; suffix_id < _suffixes.size(); suffix_id++)
+    {
+      auto& last_suffix = last_suffixes[get_sentence_id(_suffixes[suffix_id])];
+      previous_suffixes[suffix_id] = last_suffix;
+      last_suffix = suffix_id + 1;
     }
+    _previous_suffixes = RangeMinimum(std::move(previous_suffixes));
+  }
 
-    os << "   ===suffixes===" << std::endl;
+  void
+  SuffixArray::index_suffix_links(bool enable)
+  {
+    _index_suffix_links = enable;
+    if (_sorted && !_compressed)
+      compute_suffix_links();
+  }
 
+  void
+  SuffixArray::compute_suffix_links()
+  {
+    if (!_index_suffix_links || _suffixes.empty())
+    {
+      _suffix_links = FlatArray<offset_t>();
+      _lcp_minima = RangeMinimum();
+      return;
+    }
+    // suffix id of each token in the sentence buffer
+    std::vector<offset_t> rank(buffer_size());
     for (size_t i = 0; i < _suffixes.size(); i++)
+      rank[_suffixes[i]] = i;
+
+    std::vector<offset_t> suffix_links(_suffixes.size());
+    visit_tokens([&](const auto* tokens) {
+      for (size_t i = 0; i < _suffixes.size(); i++)
+      {
+        const auto next = _suffixes[i] + 1;
+        suffix_links[i] = tokens[next] == 0 ? _suffixes.size() : rank[next];
+      }
+    });
+    _suffix_links.vector().swap(suffix_links);
+    _lcp_minima = RangeMinimum(std::vector<offset_t>(_lcp.begin(), _lcp.end()));
+  }
+
+  void
+  SuffixArray::compute_bigram_table()
+  {
+    if (_quickVocabAccess.empty())
     {
-      os << i << "(" << _suffixes[i].sentence_id << "/" << _suffixes[i].subsentence_pos << "):: ";
-      size_t idx = _sentence_pos[_suffixes[i].sentence_id];
-      for (size_t j = _suffixes[i].subsentence_pos; _sentence_buffer[idx+j]; j++)
-        os << _sentence_buffer[idx+j] << " ";
-      os << std::endl;
+      _bigram_index = FlatArray<offset_t>();
+      _bigram_second_words = FlatArray<unsigned>();
+      _bigram_starts = FlatArray<offset_t>();
+      return;
     }
+    const size_t vocab_size = _quickVocabAccess.size() - 1;
+    visit_tokens([&](const auto* tokens) {
+      compute_bigram_table(tokens, _suffixes.data(), _quickVocabAccess.data(), vocab_size,
+                           _bigram_index.vector(), _bigram_second_words.vector(), _bigram_starts.vector());
+    });
+  }
 
-    return os;
+  /* the word ids of a sorted array are stored on 2 bytes when they fit, which halves the sentence
+     buffer read by the binary searches - the sentence lengths must also fit */
+  void
+  SuffixArray::shorten_tokens(size_t vocab_size)
+  {
+    if (_short_tokens || vocab_size > size_t(std::numeric_limits<uint16_t>::max()) + 1)
+      return;
+
+    std::vector<uint16_t> short_sentence_buffer;
+    short_sentence_buffer.reserve(_sentence_buffer.size());
+    for (const auto token : _sentence_buffer)
+    {
+      if (token > std::numeric_limits<uint16_t>::max())
+        return;
+      short_sentence_buffer.push_back(token);
+    }
+    _short_sentence_buffer.vector().swap(short_sentence_buffer);
+    _sentence_buffer = FlatArray<unsigned>();
+    _short_tokens = true;
   }
-#endif
 
   void
-  SuffixArray::sort(size_t vocab_size)
+  SuffixArray::widen_tokens()
   {
-    if (_sorted)
+    if (!_short_tokens)
+      return;
+
+    _sentence_buffer.vector().assign(_short_sentence_buffer.begin(), _short_sentence_buffer.end());
+    _short_sentence_buffer = FlatArray<uint16_t>();
+    _short_tokens = false;
+  }
+
+  /* the token before each suffix is 0 at the start of a sentence, whose suffix is always sampled
+     to find the sentence of the suffixes without walking to the previous sentence */
+  void
+  SuffixArray::compress(size_t vocab_size)
+  {
+    assert(_sorted || _suffixes.empty());
+    if (_compressed)
+      return;
+
+    const size_t num_rows = _sentence_pos.size() + _suffixes.size();
+    std::vector<unsigned> bwt;
+    std::vector<bool> sampled(num_rows, false);
+    std::vector<offset_t> samples;
+    bwt.reserve(num_rows);
+    samples.reserve(num_rows / FM_INDEX_SAMPLE_RATE + _sentence_pos.size());
+    visit_tokens([&](const auto* tokens) {
+      for (size_t sentence_id = 0; sentence_id < _sentence_pos.size(); sentence_id++)
+      {
+        // the separator follows the last token, or the length of an empty sentence
+        const auto separator = _sentence_pos[sentence_id] + tokens[_sentence_pos[sentence_id]] + 1;
+        bwt.push_back(tokens[separator - 1]);
+      }
+      for (const auto offset : _suffixes)
+      {
+        const bool sentence_start = _sentence_starts[offset - 1];
+        bwt.push_back(sentence_start ? 0 : tokens[offset - 1]);
+        if (sentence_start || offset % FM_INDEX_SAMPLE_RATE == 0)
+        {
+          sampled[bwt.size() - 1] = true;
+          samples.push_back(offset);
+        }
+      }
+    });
+
+    _fm_index = FMIndex(bwt, vocab_size, sampled, std::move(samples));
+    _compressed = _fm_index.size() > 0;
+    if (!_compressed)
+      return;
+
+    _suffixes = FlatArray<offset_t>();
+    _quickVocabAccess = FlatArray<offset_t>();
+    _lcp = FlatArray<unsigned short>();
+    _llcp = FlatArray<unsigned short>();
+    _rlcp = FlatArray<unsigned short>();
+    _prefix_cache = FlatArray<uint16_t>();
+    _bigram_index = FlatArray<offset_t>();
+    _bigram_second_words = FlatArray<unsigned>();
+    _bigram_starts = FlatArray<offset_t>();
+    _length_index = WaveletMatrix();
+    _previous_suffixes = RangeMinimum();
+    _suffix_links = FlatArray<offset_t>();
+    _lcp_minima = RangeMinimum();
+  }
+
+  void
+  SuffixArray::decompress()
+  {
+    if (!_compressed)
+      return;
+
+    auto& suffixes = _suffixes.vector();
+    suffixes.reserve(num_suffixes());
+    for (size_t suffix_id = 0; suffix_id < num_suffixes(); suffix_id++)
+      suffixes.push_back(get_suffix_offset(suffix_id));
+
+    const auto vocab_size = _fm_index.alphabet_size();
+    _fm_index = FMIndex();
+    _compressed = false;
+    compute_quick_vocab_access(vocab_size);
+    compute_lcp();
+    compute_lr_lcp();
+    compute_prefix_cache();
+    compute_bigram_table();
+    compute_length_index();
+    compute_sentence_listing();
+    compute_suffix_links();
+  }
+
+  void
+  SuffixArray::merge(const SuffixArray& other, size_t vocab_size)
+  {
+    if (other._compressed || other._short_tokens)
+    {
+      SuffixArray decompressed(other);
+      decompressed.decompress();
+      decompressed.widen_tokens();
+      merge(decompressed, vocab_size);
       return;
+    }
+    decompress();
+    widen_tokens();
+    assert((_sorted || _suffixes.empty()) && (other._sorted || other._suffixes.empty()));
+    if (_sentence_buffer.size() + other._sentence_buffer.size() > std::numeric_limits<offset_t>::max())
+      throw std::length_error("Too many tokens to merge the suffix arrays: build with LARGE_INDEX");
+
+    const size_t sentence_offset = _sentence_pos.size();
+    const offset_t buffer_offset = _sentence_buffer.size();
+    auto& sentence_buffer = _sentence_buffer.vector();
+    auto& sentence_pos = _sentence_pos.vector();
+    sentence_buffer.insert(sentence_buffer.end(), other._sentence_buffer.begin(), other._sentence_buffer.end());
+    for (const auto pos : other._sentence_pos)
+      sentence_pos.push_back(buffer_offset + pos);
+
+    // the other suffixes being after in the sentence buffer, equal suffixes of this array come first
+    std::vector<offset_t> suffixes;
+    suffixes.reserve(_suffixes.size() + other._suffixes.size());
+    auto it = _suffixes.begin();
+    for (const auto other_suffix : other._suffixes)
+    {
+      const offset_t suffix = buffer_offset + other_suffix;
+      while (it != _suffixes.end() && comp(*it, suffix) < 0)
+        suffixes.push_back(*it++);
+      suffixes.push_back(suffix);
+    }
+    suffixes.insert(suffixes.end(), it, _suffixes.end());
+    _suffixes.vector().swap(suffixes);
+    std::vector<offset_t>().swap(suffixes);
+
+    if (!other._removed.empty())
+    {
+      _removed.resize(sentence_offset, false);
+      _removed.insert(_removed.end(), other._removed.begin(), other._removed.end());
+    }
+    else if (!_removed.empty())
+      _removed.resize(_sentence_pos.size(), false);
+    _num_removed += other._num_removed;
+
+    _sorted = true;
+    compute_quick_vocab_access(vocab_size);
+    compute_lcp();
+    compute_lr_lcp();
+    compute_sentence_starts();
+    shorten_tokens(vocab_size);
+    compute_prefix_cache();
+    compute_bigram_table();
+    compute_length_index();
+    compute_sentence_listing();
+    compute_suffix_links();
+  }
 
-    // word id => prefixes
-    std::vector<std::vector<SuffixView> > prefixes_by_word_id(vocab_size);
+  void
+  SuffixArray::remove_sentence(size_t sentence_id)
+  {
+    if (_removed.empty())
+      _removed.resize(_sentence_pos.size(), false);
+    if (!_removed[sentence_id])
+    {
+      _removed[sentence_id] = true;
+      _num_removed++;
+    }
+  }
 
-    // sort suffixes according to their first word id
-    for (const auto& suffix : _suffixes)
+  /* one pass on the sentences and one on the suffixes, that keep their order: the LCP of two
+     remaining neighbours is the minimum of the LCP between them */
+  void
+  SuffixArray::compact(size_t vocab_size)
+  {
+    if (_num_removed == 0)
     {
-      const auto wid = get_suffix(suffix)[0];
-      assert((size_t)wid < vocab_size);
+      std::vector<bool>().swap(_removed);
+      return;
+    }
+    decompress();
+    widen_tokens();
 
-      prefixes_by_word_id[wid].push_back(suffix);
+    const unsigned removed_id = std::numeric_limits<unsigned>::max();
+    std::vector<unsigned> new_ids(_sentence_pos.size(), removed_id);
+    std::vector<unsigned> sentence_buffer;
+    std::vector<offset_t> sentence_pos;
+    sentence_buffer.reserve(_sentence_buffer.size());
+    sentence_pos.reserve(_sentence_pos.size() - _num_removed);
+    for (size_t sentence_id = 0; sentence_id < _sentence_pos.size(); sentence_id++)
+    {
+      if (_removed[sentence_id])
+        continue;
+      const auto begin = _sentence_buffer.begin() + _sentence_pos[sentence_id];
+      new_ids[sentence_id] = sentence_pos.size();
+      sentence_pos.push_back(sentence_buffer.size());
+      sentence_buffer.insert(sentence_buffer.end(), begin, begin + *begin + 2);
+    }
+
+    // the suffixes keep their position in their sentence
+    const bool has_lcp = _sorted;
+    auto& suffixes = _suffixes.vector();
+    auto& lcps = _lcp.vector();
+    size_t num_suffixes = 0;
+    unsigned short lcp = std::numeric_limits<unsigned short>::max();
+    for (size_t i = 0; i < suffixes.size(); i++)
+    {
+      if (has_lcp)
+        lcp = std::min(lcp, lcps[i]);
+      const auto sentence_id = get_sentence_id(suffixes[i]);
+      const auto new_id = new_ids[sentence_id];
+      if (new_id == removed_id)
+        continue;
+      if (has_lcp)
+      {
+        lcps[num_suffixes] = num_suffixes == 0 ? 0 : lcp;
+        lcp = std::numeric_limits<unsigned short>::max();
+      }
+      suffixes[num_suffixes++] = sentence_pos[new_id] + (suffixes[i] - _sentence_pos[sentence_id]);
+    }
+    suffixes.resize(num_suffixes);
+    suffixes.shrink_to_fit();
+    if (has_lcp)
+    {
+      lcps.resize(num_suffixes);
+      lcps.shrink_to_fit();
     }
+    _sentence_buffer.vector().swap(sentence_buffer);
+    _sentence_pos.vector().swap(sentence_pos);
+    std::vector<unsigned>().swap(sentence_buffer);
+    std::vector<offset_t>().swap(sentence_pos);
 
-    _suffixes.clear();
-    _quickVocabAccess.clear();
-    _quickVocabAccess.resize(vocab_size + 1);
+    std::vector<bool>().swap(_removed);
+    _num_removed = 0;
 
-    // sort each bucket of suffixes
-    // we can then append it to the sorted suffix array
+    if (_sorted)
+    {
+      compute_quick_vocab_access(vocab_size);
+      compute_lr_lcp();
+      compute_sentence_starts();
+      shorten_tokens(vocab_size);
+      compute_prefix_cache();
+      compute_bigram_table();
+      compute_length_index();
+      compute_sentence_listing();
+      compute_suffix_links();
+    }
+  }
+
+  /* same passes as compact, the other sentences being the removed ones */
+  SuffixArray
+  SuffixArray::extract(size_t begin, size_t end, size_t vocab_size) const
+  {
+    if (_compressed)
+    {
+      SuffixArray decompressed(*this);
+      decompressed.decompress();
+      return decompressed.extract(begin, end, vocab_size);
+    }
+    assert(_sorted || _suffixes.empty());
+    SuffixArray part;
+    auto& sentence_pos = part._sentence_pos.vector();
+    const auto buffer_begin = begin < _sentence_pos.size() ? _sentence_pos[begin] : buffer_size();
+    const auto buffer_end = end < _sentence_pos.size() ? _sentence_pos[end] : buffer_size();
+    part._short_tokens = _short_tokens;
+    if (_short_tokens)
+      part._short_sentence_buffer.vector().assign(_short_sentence_buffer.begin() + buffer_begin,
+                                                  _short_sentence_buffer.begin() + buffer_end);
+    else
+      part._sentence_buffer.vector().assign(_sentence_buffer.begin() + buffer_begin,
+                                            _sentence_buffer.begin() + buffer_end);
+    sentence_pos.reserve(end - begin);
+    for (size_t sentence_id = begin; sentence_id < end; sentence_id++)
+      sentence_pos.push_back(_sentence_pos[sentence_id] - buffer_begin);
+
+    if (!_removed.empty())
+    {
+      part._removed.assign(_removed.begin() + begin, _removed.begin() + end);
+      part._num_removed = std::count(part._removed.begin(), part._removed.end(), true);
+    }
+
+    // the sentences of the part being contiguous, so are their suffixes in the sentence buffer
+    auto& suffixes = part._suffixes.vector();
+    auto& lcps = part._lcp.vector();
+    unsigned short lcp = std::numeric_limits<unsigned short>::max();
+    for (size_t i = 0; i < _suffixes.size(); i++)
+    {
+      lcp = std::min(lcp, _lcp[i]);
+      if (_suffixes[i] < buffer_begin || _suffixes[i] >= buffer_end)
+        continue;
+      lcps.push_back(suffixes.empty() ? 0 : lcp);
+      lcp = std::numeric_limits<unsigned short>::max();
+      suffixes.push_back(_suffixes[i] - buffer_begin);
+    }
+
+    part._sorted = true;
+    part.compute_quick_vocab_access(vocab_size);
+    part.compute_lr_lcp();
+    part.compute_sentence_starts();
+    part.shorten_tokens(vocab_size);
+    part._cached_tokens = _cached_tokens;
+    part.compute_prefix_cache();
+    part.compute_bigram_table();
+    part._index_lengths = _index_lengths;
+    part.compute_length_index();
+    part._index_sentence_listing = _index_sentence_listing;
+    part.compute_sentence_listing();
+    part._index_suffix_links = _index_suffix_links;
+    part.compute_suffix_links();
+    return part;
+  }
+
+  void
+  SuffixArray::sort_buckets(size_t vocab_size, size_t num_threads)
+  {
+    // dispatch the suffixes in buckets according to their first word id
+    compute_quick_vocab_access(vocab_size);
+
+    std::vector<offset_t> bucketed(_suffixes.size());
+    std::vector<offset_t> bucket_pos(_quickVocabAccess.begin(), _quickVocabAccess.end() - 1);
+    for (const auto suffix : _suffixes)
+      bucketed[bucket_pos[_sentence_buffer[suffix]]++] = suffix;
+    auto& suffixes = _suffixes.vector();
+    suffixes.swap(bucketed);
+    std::vector<offset_t>().swap(bucketed);
+
+    // ranges of _suffixes sharing the same first word id - they can be sorted independently
+    std::vector<std::pair<size_t, size_t>> buckets;
     for (size_t wid = 0; wid < vocab_size; wid++)
+      if (_quickVocabAccess[wid + 1] - _quickVocabAccess[wid] > 1)
+        buckets.emplace_back(_quickVocabAccess[wid], _quickVocabAccess[wid + 1]);
+
+    // when multithreaded, giant buckets (e.g. punctuations) are first split on their second word id,
+    // an ended suffix being smaller than any continuation
+    std::vector<std::pair<size_t, size_t>> giant_buckets;
+    if (num_threads > 1)
     {
-      _quickVocabAccess[wid] = _suffixes.size();
+      const size_t giant_size = std::max<size_t>(_suffixes.size() / (num_threads * 8), 2);
+      auto it = std::partition(buckets.begin(), buckets.end(),
+                               [giant_size](const std::pair<size_t, size_t>& bucket) {
+                                 return bucket.second - bucket.first <= giant_size;
+                               });
+      giant_buckets.assign(it, buckets.end());
+      buckets.erase(it, buckets.end());
+    }
+
+    // the separator ending a suffix is 0
+    const auto second_word = [this](offset_t suffix) {
+      return _sentence_buffer[suffix + 1];
+    };
 
-      // for all suffixes starting by this word id
-      if (!prefixes_by_word_id[wid].empty())
+    std::vector<std::vector<std::pair<size_t, size_t>>> sub_buckets(giant_buckets.size());
+    parallel_for(giant_buckets.size(), num_threads, [&](size_t i) {
+      const auto begin = suffixes.begin() + giant_buckets[i].first;
+      const auto end = suffixes.begin() + giant_buckets[i].second;
+      std::sort(begin, end, [&second_word](offset_t a, offset_t b) {
+        return second_word(a) < second_word(b);
+      });
+      for (auto it = begin; it != end; )
       {
-        std::sort(prefixes_by_word_id[wid].begin(), prefixes_by_word_id[wid].end(),
-                  [this](const SuffixView& a, const SuffixView& b) {
-                    return comp(a, b) < 0;
-                  });
-        std::copy(prefixes_by_word_id[wid].begin(), prefixes_by_word_id[wid].end(),
-                  back_inserter(_suffixes));
+        const auto next = std::upper_bound(it, end, *it, [&second_word](offset_t a, offset_t b) {
+          return second_word(a) < second_word(b);
+        });
+        if (next - it > 1)
+          sub_buckets[i].emplace_back(it - suffixes.begin(), next - suffixes.begin());
+        it = next;
       }
+    });
+    for (const auto& ranges : sub_buckets)
+      buckets.insert(buckets.end(), ranges.begin(), ranges.end());
+
+    // sort each range of suffixes in place, biggest ranges first for a better load balancing
+    std::sort(buckets.begin(), buckets.end(),
+              [](const std::pair<size_t, size_t>& a, const std::pair<size_t, size_t>& b) {
+                return a.second - a.first > b.second - b.first;
+              });
+    parallel_for(buckets.size(), num_threads, [this, &buckets, &suffixes](size_t i) {
+      std::sort(suffixes.begin() + buckets[i].first, suffixes.begin() + buckets[i].second,
+                [this](offset_t a, offset_t b) {
+                  return comp(a, b) < 0;
+                });
+    });
+  }
+
+  void
+  SuffixArray::sort_sais(size_t vocab_size)
+  {
+    const size_t num_sentences = _sentence_pos.size();
+    const size_t n = _suffixes.size() + num_sentences + 1;
+    if (n >= std::numeric_limits<unsigned>::max())
+      throw std::length_error("Too many tokens for suffix array construction: use the bucket sort");
+
+    /* each sentence is followed by its own separator: separators are ordered by sentence id and smaller
+       than any token so that a suffix ending first is smaller, and identical suffixes are ordered by
+       sentence id - which is the order defined by comp() */
+    const unsigned token_base = num_sentences + 1;
+    std::vector<unsigned> text;
+    text.reserve(n);
+    for (size_t sentence_id = 0; sentence_id < num_sentences; sentence_id++)
+    {
+      size_t length = 0;
+      const auto* sentence = get_sentence<unsigned>(sentence_id, &length);
+      for (size_t i = 0; i < length; i++)
+      {
+        assert((size_t)sentence[i] < vocab_size);
+        text.push_back(token_base + sentence[i]);
+      }
+      text.push_back(sentence_id + 1);
     }
+    text.push_back(0);
 
-    _quickVocabAccess[vocab_size] = _suffixes.size();
-    _sorted = true;
+    std::vector<unsigned> sa(n);
+    sais(text.data(), sa.data(), n, token_base + vocab_size);
+
+    // the text is no longer needed: reuse it for the inverse suffix array
+    for (size_t i = 0; i < n; i++)
+      text[sa[i]] = i;
+    std::vector<unsigned>().swap(sa);
+
+    // the sentinel and the separators are the first token_base suffixes
+    auto& suffixes = _suffixes.vector();
+    size_t text_pos = 0;
+    for (size_t sentence_id = 0; sentence_id < num_sentences; sentence_id++)
+    {
+      const size_t length = sentence_length(sentence_id);
+      for (size_t i = 0; i < length; i++)
+        suffixes[text[text_pos++] - token_base] = _sentence_pos[sentence_id] + i + 1;
+      text_pos++;
+    }
+
+    compute_quick_vocab_access(vocab_size);
+  }
+
+  void
+  SuffixArray::compute_quick_vocab_access(size_t vocab_size)
+  {
+    auto& quick_vocab_access = _quickVocabAccess.vector();
+    quick_vocab_access.assign(vocab_size + 1, 0);
+    visit_tokens([&](const auto* tokens) {
+      for (const auto suffix : _suffixes)
+      {
+        const auto wid = tokens[suffix];
+        assert((size_t)wid < vocab_size);
+        quick_vocab_access[wid + 1]++;
+      }
+    });
+    for (size_t wid = 0; wid < vocab_size; wid++)
+      quick_vocab_access[wid + 1] += quick_vocab_access[wid];
+  }
+
+  /* Kasai et al. linear LCP construction: the LCP of the suffix starting one token later in
+     the same sentence is at least the current LCP minus one */
+  void
+  SuffixArray::compute_lcp()
+  {
+    const size_t num_suffixes = _suffixes.size();
+    // suffix id of each token in the sentence buffer
+    std::vector<offset_t> rank(buffer_size());
+    for (size_t i = 0; i < num_suffixes; i++)
+      rank[_suffixes[i]] = i;
+
+    auto& lcps = _lcp.vector();
+    lcps.assign(num_suffixes, 0);
+    visit_tokens([&](const auto* tokens) {
+      for (size_t sentence_id = 0; sentence_id < _sentence_pos.size(); sentence_id++)
+      {
+        const size_t offset = _sentence_pos[sentence_id] + 1;
+        const size_t length = tokens[offset - 1];
+        const auto* sentence = tokens + offset;
+        size_t lcp = 0;
+        for (size_t i = 0; i < length; i++)
+        {
+          const size_t suffix_id = rank[offset + i];
+          if (suffix_id == 0)
+          {
+            lcp = 0;
+            continue;
+          }
+          // the previous suffix ends with the separator 0, which is not a token
+          const auto* previous = tokens + _suffixes[suffix_id - 1];
+          while (lcp < length - i && sentence[i + lcp] == previous[lcp])
+            lcp++;
+          lcps[suffix_id] = lcp;
+          if (lcp > 0)
+            lcp--;
+        }
+      }
+    });
+  }
+
+  void
+  SuffixArray::compute_lr_lcp()
+  {
+    auto& llcp = _llcp.vector();
+    auto& rlcp = _rlcp.vector();
+    llcp.assign(_suffixes.size(), 0);
+    rlcp.assign(_suffixes.size(), 0);
+    for (size_t wid = 0; wid + 1 < _quickVocabAccess.size(); wid++)
+    {
+      const size_t begin = _quickVocabAccess[wid];
+      const size_t end = _quickVocabAccess[wid + 1];
+      compute_lr_lcp(_lcp.data() + begin, end - begin, llcp.data() + begin, rlcp.data() + begin);
+    }
+  }
 
-    compute_sentence_length();
+  void
+  SuffixArray::compute_lr_lcp(const unsigned short* lcp, size_t bucket_size,
+                              unsigned short* llcp, unsigned short* rlcp)
+  {
+    if (bucket_size > 0)
+      compute_lr_lcp(lcp, llcp, rlcp, -1, bucket_size, bucket_size);
+  }
+
+  /* LCP of the suffixes left and right, filling the LLCP/RLCP of the binary search steps in between;
+     the virtual boundaries -1 and bucket_size of a bucket only share its first word */
+  unsigned short
+  SuffixArray::compute_lr_lcp(const unsigned short* lcp, unsigned short* llcp, unsigned short* rlcp,
+                              ptrdiff_t left, ptrdiff_t right, ptrdiff_t bucket_size)
+  {
+    if (right - left == 1)
+      return (left < 0 || right >= bucket_size) ? 1 : lcp[right];
+
+    const ptrdiff_t mid = (left + right) / 2;
+    llcp[mid] = compute_lr_lcp(lcp, llcp, rlcp, left, mid, bucket_size);
+    rlcp[mid] = compute_lr_lcp(lcp, llcp, rlcp, mid, right, bucket_size);
+    return std::min(llcp[mid], rlcp[mid]);
+  }
+
+  /* extend the known common prefix of the suffix and the ngram, and tell whether the suffix
+     is before the bound: lower bound is the first suffix starting with ngram or greater,
+     upper bound the first suffix greater than ngram and not starting with it - the suffix
+     ends with the separator 0, lower than any token of the ngram */
+  template <typename Token>
+  static inline bool
+  before_bound(const Token* suffix,
+               const unsigned* ngram, size_t length,
+               bool upper, size_t& lcp)
+  {
+    while (lcp < length && suffix[lcp] == ngram[lcp])
+      lcp++;
+    if (lcp == length)
+      return upper;
+    return suffix[lcp] < ngram[lcp];
+  }
+
+  /* same as before_bound on the cached tokens of the suffix, when they are enough to decide: the
+     tokens 1 to _cached_tokens, the first one being known when lcp > 0 */
+  inline bool
+  SuffixArray::cached_before_bound(size_t suffix_id, const unsigned* ngram, size_t length, bool upper,
+                                   size_t& lcp, bool& before) const
+  {
+    if (_cached_tokens == 0 || lcp == 0)
+      return false;
+    const auto* cache = _prefix_cache.data() + suffix_id * _cached_tokens;
+    for (; lcp <= _cached_tokens && lcp < length; lcp++)
+    {
+      const unsigned token = cache[lcp - 1];
+      if (token == PREFIX_CACHE_UNKNOWN)
+        return false;
+      if (token == ngram[lcp])
+        continue;
+      before = token < ngram[lcp];
+      return true;
+    }
+    if (lcp < length)
+      return false;
+    before = upper;
+    return true;
+  }
+
+  /* binary search in the bucket [begin, end) of ngram[0] (Manber & Myers): left_lcp and right_lcp are
+     the LCP of the ngram with the current boundaries, and the LLCP/RLCP of the middle suffix tell on
+     which side it is without comparing tokens, or from which token the comparison should start */
+  template <typename Token>
+  size_t
+  SuffixArray::bucket_bound(const Token* tokens, const unsigned* ngram, size_t length,
+                            size_t begin, size_t end, bool upper) const
+  {
+    ptrdiff_t left = (ptrdiff_t)begin - 1;
+    ptrdiff_t right = end;
+    size_t left_lcp = 1;
+    size_t right_lcp = 1;
+
+    while (right - left > 1)
+    {
+      const ptrdiff_t mid = (left + right) / 2;
+      size_t lcp;
+      if (left_lcp >= right_lcp)
+      {
+        if (_llcp[mid] > left_lcp)
+        {
+          left = mid;
+          continue;
+        }
+        if (_llcp[mid] < left_lcp)
+        {
+          right = mid;
+          right_lcp = _llcp[mid];
+          continue;
+        }
+        lcp = left_lcp;
+      }
+      else
+      {
+        if (_rlcp[mid] > right_lcp)
+        {
+          right = mid;
+          continue;
+        }
+        if (_rlcp[mid] < right_lcp)
+        {
+          left = mid;
+          left_lcp = _rlcp[mid];
+          continue;
+        }
+        lcp = right_lcp;
+      }
+
+      bool before;
+      if (!cached_before_bound(mid, ngram, length, upper, lcp, before))
+        before = before_bound(tokens + _suffixes[mid], ngram, length, upper, lcp);
+      if (before)
+      {
+        left = mid;
+        left_lcp = lcp;
+      }
+      else
+      {
+        right = mid;
+        right_lcp = lcp;
+      }
+    }
+
+    return right;
+  }
+
+  /* binary search in [begin, end) whose suffixes all start with ngram[0..matched_length), skipping
+     the prefix known to be shared by the ngram and both boundaries */
+  template <typename Token>
+  size_t
+  SuffixArray::bound(const Token* tokens, const unsigned* ngram, size_t length, size_t begin, size_t end,
+                     size_t matched_length, bool upper) const
+  {
+    size_t left_lcp = matched_length;
+    size_t right_lcp = matched_length;
+
+    while (begin < end)
+    {
+      const size_t mid = begin + (end - begin) / 2;
+      size_t lcp = std::min(left_lcp, right_lcp);
+      bool before;
+      if (!cached_before_bound(mid, ngram, length, upper, lcp, before))
+        before = before_bound(tokens + _suffixes[mid], ngram, length, upper, lcp);
+      if (before)
+      {
+        begin = mid + 1;
+        left_lcp = lcp;
+      }
+      else
+      {
+        end = mid;
+        right_lcp = lcp;
+      }
+    }
+
+    return begin;
+  }
+
+  /* narrows [min, max), the bucket of ngram[0], to the suffixes starting with ngram[0..2) if the
+     bucket is in the bigram table, or to the position where they would be */
+  bool
+  SuffixArray::bigram_range(const unsigned* ngram, size_t& min, size_t& max) const
+  {
+    if (_bigram_index.empty())
+      return false;
+    const size_t begin = _bigram_index[ngram[0]];
+    const size_t end = _bigram_index[ngram[0] + 1];
+    if (begin == end)
+      return false;
+    const auto* second_words = _bigram_second_words.data();
+    const size_t entry = std::lower_bound(second_words + begin, second_words + end, ngram[1]) - second_words;
+    const size_t bucket_end = max;
+    min = entry < end ? _bigram_starts[entry] : bucket_end;
+    if (entry < end && second_words[entry] == ngram[1])
+      max = entry + 1 < end ? _bigram_starts[entry + 1] : bucket_end;
+    else
+      max = min;
+    return true;
   }
 
   /**range of suffixe starting with ngram**/
   std::pair<size_t, size_t>
-  SuffixArray::equal_range(const unsigned* ngram, size_t length, size_t min, size_t max) const
+  SuffixArray::equal_range(const unsigned* ngram, size_t length, size_t min, size_t max,
+                           size_t matched_length) const
   {
     assert(_suffixes.empty() || _sorted);
+    assert(std::find(ngram, ngram + length, VocabIndexer::SENTENCE_SEPARATOR) == ngram + length);
 
     if (length == 0)
       return std::pair<size_t, size_t>(0, 0);
 
+    /* the FM-index always searches the whole n-gram */
+    if (_compressed)
+    {
+      const auto rows = _fm_index.backward_search(ngram, length);
+      if (rows.first >= rows.second)
+        return std::pair<size_t, size_t>(0, 0);
+      return std::pair<size_t, size_t>(rows.first - _sentence_pos.size(), rows.second - _sentence_pos.size());
+    }
+
     /* if not initialized */
     if (max == 0)
     {
@@ -124,96 +1059,96 @@ namespace fuzzy
       else
         max = _suffixes.size();
 
-      if (length == 1)
+      if (length == 1 || min == max)
         return std::pair<size_t, size_t>(min, max);
-    }
-
-    size_t      cur = (min + max) / 2;
-    std::pair<size_t, size_t> res;
-    int           r;
-    assert(min <= max);
-
-    while (max > min)
-    {
-      r = start_by(_suffixes[cur], ngram, length);
-
-      if (r == 0)
-        break;
 
-      if (r < 0)
+      if (bigram_range(ngram, min, max))
       {
-        //ngram> _suffixes[cur]
-        if (min < cur)
-          min = cur;
-        else
-          max = min; //not found
+        if (length == 2 || min == max)
+          return std::pair<size_t, size_t>(min, max);
+        return visit_tokens([&](const auto* tokens) {
+          const size_t lower = bound(tokens, ngram, length, min, max, 2, false);
+          const size_t upper = bound(tokens, ngram, length, lower, max, 2, true);
+          return std::pair<size_t, size_t>(lower, upper);
+        });
       }
-      else
-        max = cur;
 
-      cur = (min + max) / 2; //invariant: min<=cur<max
+      return visit_tokens([&](const auto* tokens) {
+        const size_t lower = bucket_bound(tokens, ngram, length, min, max, false);
+        const size_t upper = bucket_bound(tokens, ngram, length, min, max, true);
+        return std::pair<size_t, size_t>(lower, upper);
+      });
     }
 
-    if (max - min < 2)
-      return std::pair<size_t, size_t>(min, max); //empty range if min=max, or 1 elem range if min=max+1
-
-    // range of size bigger than 1: we must determine the exact boundaries
-    //find upperbound
-    size_t savecur = cur;
-    size_t savemin = min;
-    min = cur;
-    cur = (min + max) / 2;
-
-    while (cur > min)
-    {
-      //loop invariant : start_by(_suffixes[max], ngram)>0, start_by(_suffixes[min], ngram)==0
-      r = start_by(_suffixes[cur], ngram, length);
+    assert(min <= max && matched_length <= length);
+    const auto range = visit_tokens([&](const auto* tokens) {
+      const size_t lower = bound(tokens, ngram, length, min, max, matched_length, false);
+      const size_t upper = bound(tokens, ngram, length, lower, max, matched_length, true);
+      return std::pair<size_t, size_t>(lower, upper);
+    });
+    const size_t lower = range.first;
+    const size_t upper = range.second;
 
-      if (r == 0)
-        min = cur;
-      else //r>0 : ngram< _suffixes[cur]
-        max = cur;
-
-      cur = (min + max) / 2;
-    }
+    //postcondition on range:
+    assert(lower == upper || start_by(get_suffix_view(lower), ngram, length) == 0);
+    assert(lower == min || start_by(get_suffix_view(lower - 1), ngram, length) < 0);
+    assert(upper == max || start_by(get_suffix_view(upper), ngram, length) > 0);
+    return std::pair<size_t, size_t>(lower, upper);
+  }
 
-    res.second = max; //max is the highest index with  ngram< _suffixes[max]
-    //compute lower bound
-    min = savemin;
+  /* the suffixes being sorted, the first and last ones share the prefix common to the whole range */
+  size_t
+  SuffixArray::shared_prefix_length(const unsigned* ngram, size_t length, size_t min, size_t max,
+                                    size_t matched_length) const
+  {
+    assert(min < max && _sorted);
+    const auto first_offset = get_suffix_offset(min);
+    const auto last_offset = get_suffix_offset(max - 1);
+    return visit_tokens([&](const auto* tokens) {
+      const auto* first = tokens + first_offset;
+      const auto* last = tokens + last_offset;
 
-    if (start_by(_suffixes[min], ngram, length) == 0) //can happen if min=0, doesnt hurt to check in all cases
-      max = min; //the loop won't be executed
-    else
-      max = savecur;
+      size_t shared = matched_length;
+      while (shared < length && first[shared] == ngram[shared] && last[shared] == ngram[shared])
+        shared++;
+      return shared;
+    });
+  }
 
-    cur = (min + max) / 2; // max-min>1  ==> cur!=min
+  /* the suffixes [begin, end) sharing at least length tokens, the LCP interval is bounded by the nearest LCP
+     below length on both sides */
+  std::pair<size_t, size_t>
+  SuffixArray::lcp_interval(size_t begin, size_t end, size_t length) const
+  {
+    assert(begin < end && length > 0 && has_suffix_links());
+    return std::pair<size_t, size_t>(_lcp_minima.previous_below(begin + 1, length),
+                                     _lcp_minima.next_below(end, length));
+  }
 
-    while (cur > min)
+  /* the tokens following the shared ones are compared with the bounds of the range, and a binary
+     search narrows it when some suffixes do not share them */
+  size_t
+  SuffixArray::extend_prefix(const unsigned* pattern, size_t length, size_t matched_length,
+                             std::pair<size_t, size_t>& range) const
+  {
+    while (matched_length < length)
     {
-      //loop invariant : start_by(_suffixes[min], ngram)<0 ,  start_by(_suffixes[max], ngram)==0
-      r = start_by(_suffixes[cur], ngram, length);
-
-      if (r == 0)
-        max = cur;
-      else //r<0 : ngram> _suffixes[cur]
-        min = cur;
-
-      cur = (min + max) / 2;
+      matched_length = shared_prefix_length(pattern, length, range.first, range.second, matched_length);
+      if (matched_length == length)
+        break;
+      const auto next = equal_range(pattern, matched_length + 1, range.first, range.second, matched_length);
+      if (next.first == next.second)
+        break;
+      range = next;
+      matched_length++;
     }
-
-    res.first = max; //max is the lowest index with start_by(_suffixes[max], ngram)==0
-    //postcondition on range:
-    assert(res.second > res.first); //non empty range
-    assert(start_by(_suffixes[res.first], ngram, length) == 0);
-    assert(res.first == 0 || (start_by(_suffixes[res.first - 1], ngram, length) < 0));
-    assert(res.second == _suffixes.size() || start_by(_suffixes[res.second], ngram, length) > 0);
-    assert(res.second > 0 && (start_by(_suffixes[res.second - 1], ngram, length) == 0));
-    return res;
+    return matched_length;
   }
 
+  template <typename Token1, typename Token2>
   static int
-  compare_ngrams(const unsigned* v1, size_t v1_length,
-                 const unsigned* v2, size_t v2_length,
+  compare_ngrams(const Token1* v1, size_t v1_length,
+                 const Token2* v2, size_t v2_length,
                  bool equal_if_startby = false)
   {
     for (size_t i = 0; i < std::min(v1_length, v2_length); i++)
@@ -232,44 +1167,59 @@ namespace fuzzy
     return 0;
   }
 
+  /* the suffixes end with the separator 0, lower than any token: a suffix ending first is smaller */
   int
-  SuffixArray::comp(const SuffixView& a, const SuffixView& b) const
-  {
-    size_t length_a;
-    size_t length_b;
-    const auto* suffix_a = get_suffix(a, &length_a);
-    const auto* suffix_b = get_suffix(b, &length_b);
-    const auto c = compare_ngrams(suffix_a, length_a, suffix_b, length_b);
-
-    if (c != 0 || a.sentence_id == b.sentence_id)
-      return c;
-    else //same std::vector (c=0),but in different sentences: to have a total order relation we sort n sentence index (if they have the same index they are the same)
-      if (a.sentence_id < b.sentence_id) //the fact that the order is total just insure that there won't be platform-specifix difference in sorting due to the sort algo
-        return -1;
-      else
-        return 1;
+  SuffixArray::comp(offset_t a, offset_t b) const
+  {
+    assert(!_short_tokens);
+    const auto* suffix_a = _sentence_buffer.data() + a;
+    const auto* suffix_b = _sentence_buffer.data() + b;
+    size_t i = 0;
+    while (suffix_a[i] == suffix_b[i] && suffix_a[i] != VocabIndexer::SENTENCE_SEPARATOR)
+      i++;
+    if (suffix_a[i] != suffix_b[i])
+      return suffix_a[i] < suffix_b[i] ? -1 : 1;
+
+    // same suffix in different sentences: to have a total order relation we sort on the sentence index, in
+    // the order of the offsets - the fact that the order is total just insure that there won't be
+    // platform-specific difference in sorting due to the sort algo
+    if (a == b)
+      return 0;
+    return a < b ? -1 : 1;
   }
 
-  void SuffixArray::compute_sentence_length()
+  bool
+  SuffixArray::precedes(const SuffixView& a, const SuffixArray& other, const SuffixView& b) const
   {
-    _sentence_length.resize(_suffixes.size());
-    for (std::size_t suffix_id=0; suffix_id < _suffixes.size(); suffix_id++)
-    {
-      const auto sentence_id = _suffixes[suffix_id].sentence_id;
-      _sentence_length[suffix_id] = _sentence_buffer[_sentence_pos[sentence_id]];
-    }
+    return visit_sentence(a.sentence_id, [&](const auto* sentence_a, size_t length_a) {
+      return other.visit_sentence(b.sentence_id, [&](const auto* sentence_b, size_t length_b) {
+        const size_t prefix_a = a.subsentence_pos - 1;
+        const size_t prefix_b = b.subsentence_pos - 1;
+        return compare_ngrams(sentence_a + prefix_a, length_a - prefix_a,
+                              sentence_b + prefix_b, length_b - prefix_b) <= 0;
+      });
+    });
+  }
+
+  void SuffixArray::compute_sentence_starts()
+  {
+    std::vector<uint64_t> words((buffer_size() + 63) / 64, 0);
+    for (const auto pos : _sentence_pos)
+      words[pos / 64] |= uint64_t(1) << (pos % 64);
+    _sentence_starts = RankBitVector(std::move(words), buffer_size());
   }
 
   int
   SuffixArray::start_by(const SuffixView& p, const unsigned* ngram, size_t length) const
   {
-    size_t suffix_length;
-    const auto* suffix = get_suffix(p, &suffix_length);
-    return compare_ngrams(suffix,
-                          suffix_length,
-                          ngram,
-                          length,
-                          /*equal_if_startby=*/true);
+    return visit_sentence(p.sentence_id, [&](const auto* sentence, size_t sentence_length) {
+      const size_t prefix_length = p.subsentence_pos - 1;
+      return compare_ngrams(sentence + prefix_length,
+                            sentence_length - prefix_length,
+                            ngram,
+                            length,
+                            /*equal_if_startby=*/true);
+    });
   }
 
 }
@@ -3,7 +3,9 @@
 namespace fuzzy
 {
   SuffixArrayIndex::SuffixArrayIndex(size_t max_tokens_in_pattern)
-    : _max_tokens_in_pattern(max_tokens_in_pattern)
+    : _shards(1)
+    , _shard_offsets(2, 0)
+    , _max_tokens_in_pattern(max_tokens_in_pattern)
   {
   }
 
@@ -13,10 +15,18 @@ namespace fuzzy
                            const Tokens& norm_tokens,
                            bool sort)
   {
+    materialize();
     if (!real_tokens.empty() && norm_tokens.size() <= _max_tokens_in_pattern) // patterns greater than this size would be ignored in match
     {
       std::vector<unsigned> tokens_idx = _vocabIndexer.addWords(norm_tokens);
-      _suffixArray.add_sentence(tokens_idx);
+      /* once the main suffix array is sorted, new sentences go to the delta to avoid sorting it again */
+      if (_shards.back().is_sorted() && _shards.back().num_suffixes() > 0)
+        _delta.add_sentence(tokens_idx);
+      else
+      {
+        _shards.back().add_sentence(tokens_idx);
+        _shard_offsets.back()++;
+      }
 
       _ids.push_back(id);
 
@@ -24,25 +34,239 @@ namespace fuzzy
     }
 
     if (sort)
-      _suffixArray.sort(_vocabIndexer.size());
+      this->sort();
 
     return _ids.size();
   }
 
-  std::string
-  SuffixArrayIndex::sentence(size_t sindex) const
+  void
+  SuffixArrayIndex::sort(SortAlgorithm algorithm, size_t num_threads)
   {
-    std::string sent =">";
-    size_t slength = 0;
-    const auto* sentence = _suffixArray.get_sentence(sindex, &slength);
+    for (auto& shard : _shards)
+      shard.sort(_vocabIndexer.size(), algorithm, num_threads);
+    if (_delta.num_sentences() == 0)
+      return;
+
+    _delta.sort(_vocabIndexer.size(), algorithm, num_threads);
+
+    if (_delta.num_suffixes() * DELTA_MERGE_RATIO > _shards.back().num_suffixes())
+      merge_delta();
+  }
+
+  /* linear merge of the sorted delta into the main suffix array - its last shard, whose sentence
+     ids come just before the delta ones */
+  void
+  SuffixArrayIndex::merge_delta()
+  {
+    if (_delta.num_sentences() == 0)
+      return;
+    const bool compressed = is_compressed();
+    _shards.back().merge(_delta, _vocabIndexer.size());
+    _delta = SuffixArray();
+    if (compressed)
+      _shards.back().compress(_vocabIndexer.size());
+    update_shard_offsets();
+  }
+
+  void
+  SuffixArrayIndex::compress()
+  {
+    sort();
+    for (auto& shard : _shards)
+      shard.compress(_vocabIndexer.size());
+  }
+
+  size_t
+  SuffixArrayIndex::cache_prefixes(size_t cached_tokens)
+  {
+    sort();
+    size_t num_bytes = 0;
+    for (auto& shard : _shards)
+    {
+      shard.cache_prefixes(cached_tokens);
+      num_bytes += shard.prefix_cache_bytes();
+    }
+    return num_bytes;
+  }
+
+  size_t
+  SuffixArrayIndex::index_lengths(bool enable)
+  {
+    sort();
+    size_t num_bytes = 0;
+    for (auto& shard : _shards)
+    {
+      shard.index_lengths(enable);
+      num_bytes += shard.length_index_bytes();
+    }
+    return num_bytes;
+  }
+
+  size_t
+  SuffixArrayIndex::index_sentence_listing(bool enable)
+  {
+    sort();
+    size_t num_bytes = 0;
+    for (auto& shard : _shards)
+    {
+      shard.index_sentence_listing(enable);
+      num_bytes += shard.sentence_listing_bytes();
+    }
+    return num_bytes;
+  }
+
+  size_t
+  SuffixArrayIndex::index_suffix_links(bool enable)
+  {
+    sort();
+    size_t num_bytes = 0;
+    for (auto& shard : _shards)
+    {
+      shard.index_suffix_links(enable);
+      num_bytes += shard.suffix_links_bytes();
+    }
+    return num_bytes;
+  }
+
+  bool
+  SuffixArrayIndex::is_compressed() const
+  {
+    return _shards[0].is_compressed();
+  }
+
+  void
+  SuffixArrayIndex::shard(size_t num_shards)
+  {
+    if (num_shards == 0)
+      throw std::invalid_argument("the number of shards must be positive");
+
+    sort();
+    merge_delta();
+    const bool compressed = is_compressed();
+    if (_shards.size() > 1)
+      _shards.assign(1, merged_shards());
+
+    const auto& main = _shards[0];
+    const size_t num_sentences = main.num_sentences();
+    num_shards = std::max<size_t>(1, std::min(num_shards, num_sentences));
+    if (num_shards == 1)
+    {
+      update_shard_offsets();
+      return;
+    }
+    if (compressed)
+      _shards[0].decompress();
+
+    /* the sentence boundaries are placed on the token count, which the search time follows */
+    std::vector<SuffixArray> shards;
+    shards.reserve(num_shards);
+    const size_t num_tokens = main.num_suffixes();
+    size_t begin = 0;
+    size_t tokens = 0;
+    for (size_t s_id = 0; s_id < num_sentences; s_id++)
+    {
+      tokens += main.sentence_length(s_id);
+      if (tokens * num_shards >= num_tokens * (shards.size() + 1) && shards.size() + 1 < num_shards)
+      {
+        shards.push_back(main.extract(begin, s_id + 1, _vocabIndexer.size()));
+        begin = s_id + 1;
+      }
+    }
+    shards.push_back(main.extract(begin, num_sentences, _vocabIndexer.size()));
+    _shards.swap(shards);
+    if (compressed)
+      compress();
+    update_shard_offsets();
+  }
+
+  SuffixArray
+  SuffixArrayIndex::merged_shards() const
+  {
+    SuffixArray merged = _shards[0];
+    for (size_t shard = 1; shard < _shards.size(); shard++)
+      merged.merge(_shards[shard], _vocabIndexer.size());
+    if (is_compressed())
+      merged.compress(_vocabIndexer.size());
+    return merged;
+  }
+
+  void
+  SuffixArrayIndex::update_shard_offsets()
+  {
+    _shard_offsets.resize(_shards.size() + 1);
+    _shard_offsets[0] = 0;
+    for (size_t shard = 0; shard < _shards.size(); shard++)
+      _shard_offsets[shard + 1] = _shard_offsets[shard] + _shards[shard].num_sentences();
+  }
 
-    for (size_t j = 0; j < slength; j++)
+  size_t
+  SuffixArrayIndex::remove_tm(const std::string& id)
+  {
+    materialize();
+    size_t count = 0;
+    for (size_t s_id = 0; s_id < _ids.size(); s_id++)
     {
-      const std::string& form = _vocabIndexer.getWord(sentence[j]);
-      if (!sent.empty())
-        sent += " ";
-      sent += form;
+      if (_ids[s_id] != id || is_removed(s_id))
+        continue;
+
+      _vocabIndexer.removeWords(visit_sentence(s_id, [](const auto* sentence, size_t length) {
+        return std::vector<unsigned>(sentence, sentence + length);
+      }));
+      const auto shard = find_shard(s_id);
+      if (shard < _shards.size())
+        _shards[shard].remove_sentence(s_id - _shard_offsets[shard]);
+      else
+        _delta.remove_sentence(s_id - delta_offset());
+      count++;
     }
+    return count;
+  }
+
+  void
+  SuffixArrayIndex::compact()
+  {
+    if (num_removed() == 0)
+      return;
+
+    materialize();
+    size_t num_sentences = 0;
+    for (size_t s_id = 0; s_id < _ids.size(); s_id++)
+    {
+      if (is_removed(s_id))
+        continue;
+      if (num_sentences != s_id)
+      {
+        _ids[num_sentences] = std::move(_ids[s_id]);
+        _real_tokens[num_sentences] = std::move(_real_tokens[s_id]);
+      }
+      num_sentences++;
+    }
+    _ids.resize(num_sentences);
+    _real_tokens.resize(num_sentences);
+
+    const bool compressed = is_compressed();
+    for (auto& shard : _shards)
+      shard.compact(_vocabIndexer.size());
+    _delta.compact(_vocabIndexer.size());
+    _vocabIndexer.purgeUnusedWords();
+    if (compressed)
+      compress();
+    update_shard_offsets();
+  }
+
+  std::string
+  SuffixArrayIndex::sentence(size_t sindex) const
+  {
+    std::string sent =">";
+    visit_sentence(sindex, [this, &sent](const auto* sentence, size_t slength) {
+      for (size_t j = 0; j < slength; j++)
+      {
+        const std::string form = _vocabIndexer.getWord(sentence[j]);
+        if (!sent.empty())
+          sent += " ";
+        sent += form;
+      }
+    });
 
     return sent;
   }
@@ -50,23 +274,161 @@ namespace fuzzy
 #ifndef NDEBUG
   std::ostream& SuffixArrayIndex::dump(std::ostream& os) const {
     os << "=== Vocabulary ==="<<std::endl;
-    _vocabIndexer.dump(os, _suffixArray.num_sentences()) << std::endl;
-    os << "=== Suffix Array ==="<<std::endl;
-    _suffixArray.dump(os) << std::endl;
+    _vocabIndexer.dump(os, size()) << std::endl;
+    for (const auto& shard : _shards)
+    {
+      os << "=== Suffix Array ==="<<std::endl;
+      shard.dump(os) << std::endl;
+    }
+    os << "=== Delta Suffix Array ==="<<std::endl;
+    _delta.dump(os) << std::endl;
     return os;
   }
 #endif
 
 
-  const Sentence &SuffixArrayIndex::real_tokens(size_t s_id) const
+  Sentence
+  SuffixArrayIndex::real_tokens(size_t s_id) const
   {
-    return _real_tokens[s_id];
+    if (!_mapped)
+      return _real_tokens[s_id];
+
+    Sentence real_tokens;
+    // the tab separated tokens are pushed at once
+    real_tokens.push_back(_mapped_tokens[s_id]);
+    for (auto i = _mapped_itoks_begin[s_id]; i < _mapped_itoks_begin[s_id + 1]; i++)
+      real_tokens.set_itok(_mapped_itoks_pos[i], _mapped_itoks[i]);
+    return real_tokens;
   }
 
-  const std::string&
-  SuffixArrayIndex::id(unsigned int index)
-  { 
-    return _ids[index];
+  void
+  SuffixArrayIndex::real_tokens(size_t s_id, SentenceView& view) const
+  {
+    if (!_mapped)
+    {
+      view.assign(_real_tokens[s_id], sentence_length(s_id));
+      return;
+    }
+
+    view.assign(_mapped_tokens.view(s_id), sentence_length(s_id));
+    for (auto i = _mapped_itoks_begin[s_id]; i < _mapped_itoks_begin[s_id + 1]; i++)
+      view.set_itok(_mapped_itoks_pos[i], _mapped_itoks.view(i));
+  }
+
+  bool
+  SuffixArrayIndex::has_itoks(size_t s_id) const
+  {
+    if (!_mapped)
+      return !_real_tokens[s_id].itoks().empty();
+    return _mapped_itoks_begin[s_id] != _mapped_itoks_begin[s_id + 1];
+  }
+
+  std::string
+  SuffixArrayIndex::id(unsigned int index) const
+  {
+    return _mapped ? _mapped_ids[index] : _ids[index];
+  }
+
+  void
+  SuffixArrayIndex::save_mapped(MappedFileWriter& writer) const
+  {
+    writer.write_value<uint64_t>(_max_tokens_in_pattern);
+    _vocabIndexer.save_mapped(writer);
+    if (_shards.size() > 1)
+      merged_shards().save_mapped(writer);
+    else
+      _shards[0].save_mapped(writer);
+    _delta.save_mapped(writer);
+
+    if (_mapped)
+    {
+      writer.write(_mapped_ids);
+      writer.write(_mapped_tokens);
+      writer.write(_mapped_itoks_begin);
+      writer.write(_mapped_itoks_pos);
+      writer.write(_mapped_itoks);
+      return;
+    }
+
+    std::vector<std::string> tokens;
+    std::vector<uint64_t> itoks_begin;
+    std::vector<uint64_t> itoks_pos;
+    std::vector<std::string> itoks;
+    tokens.reserve(_real_tokens.size());
+    itoks_begin.reserve(_real_tokens.size() + 1);
+    for (const auto& real_tokens : _real_tokens)
+    {
+      tokens.push_back(real_tokens.tokstring());
+      itoks_begin.push_back(itoks_pos.size());
+      for (const auto& itok : real_tokens.itoks())
+      {
+        itoks_pos.push_back(itok.first);
+        itoks.push_back(itok.second);
+      }
+    }
+    itoks_begin.push_back(itoks_pos.size());
+
+    writer.write(FlatStrings(_ids));
+    writer.write(FlatStrings(tokens));
+    writer.write(itoks_begin.data(), itoks_begin.size());
+    writer.write(itoks_pos.data(), itoks_pos.size());
+    writer.write(FlatStrings(itoks));
+  }
+
+  void
+  SuffixArrayIndex::load_mapped(MappedFileReader& reader, std::shared_ptr<const void> mapping)
+  {
+    _max_tokens_in_pattern = reader.read_value<uint64_t>();
+    _vocabIndexer.load_mapped(reader);
+    _shards.assign(1, SuffixArray());
+    _shards[0].load_mapped(reader);
+    _delta.load_mapped(reader);
+    update_shard_offsets();
+    reader.read(_mapped_ids);
+    reader.read(_mapped_tokens);
+    reader.read(_mapped_itoks_begin);
+    reader.read(_mapped_itoks_pos);
+    reader.read(_mapped_itoks);
+
+    const size_t num_sentences = _mapped_ids.size();
+    if (_mapped_tokens.size() != num_sentences
+        || _shards[0].num_sentences() + _delta.num_sentences() != num_sentences
+        || _mapped_itoks_begin.size() != num_sentences + 1
+        || _mapped_itoks_pos.size() != _mapped_itoks.size()
+        || _mapped_itoks_begin.back() != _mapped_itoks.size())
+      throw std::runtime_error("corrupted FMI file: inconsistent index");
+
+    std::vector<std::string>().swap(_ids);
+    std::vector<Sentence>().swap(_real_tokens);
+    _mapping = std::move(mapping);
+    _mapped = true;
+  }
+
+  void
+  SuffixArrayIndex::copy_mapped(std::vector<std::string>& ids, std::vector<Sentence>& real_tokens) const
+  {
+    ids = _mapped_ids.to_vector();
+    real_tokens.clear();
+    real_tokens.reserve(ids.size());
+    for (size_t s_id = 0; s_id < ids.size(); s_id++)
+      real_tokens.push_back(this->real_tokens(s_id));
+  }
+
+  /* the suffix arrays and the vocabulary copy their own arrays when they are modified:
+     the mapping stays alive as long as the index */
+  void
+  SuffixArrayIndex::materialize()
+  {
+    if (!_mapped)
+      return;
+
+    copy_mapped(_ids, _real_tokens);
+    _mapped_ids = FlatStrings();
+    _mapped_tokens = FlatStrings();
+    _mapped_itoks_begin = FlatArray<uint64_t>();
+    _mapped_itoks_pos = FlatArray<uint64_t>();
+    _mapped_itoks = FlatStrings();
+    _mapped = false;
   }
 
 }
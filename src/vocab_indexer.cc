@@ -1,6 +1,7 @@
 #include <fuzzy/vocab_indexer.hh>
 
 #include <cmath>
+#include <stdexcept>
 #include <unordered_set>
 
 using namespace std;
@@ -22,20 +23,94 @@ namespace fuzzy
 #ifndef NDEBUG
   std::ostream&  VocabIndexer::dump(std::ostream& os, size_t nsentences) const
   {
-    for (size_t i = 1; i < forms.size(); i++)
-      os << i << "\t" << forms[i] << "\t" << sfreq[i] << "\t"<<std::log(nsentences*1.0/sfreq[i])<<endl;
+    for (size_t i = 1; i < size(); i++)
+      os << i << "\t" << getWord(i) << "\t" << sfreq[i] << "\t"<<std::log(nsentences*1.0/sfreq[i])<<endl;
 
     return os;
   }
 #endif
 
+  /* FNV-1a */
+  static uint64_t hash_word(const char* word, size_t length)
+  {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++)
+    {
+      hash ^= (unsigned char)word[i];
+      hash *= 1099511628211ULL;
+    }
+    return hash;
+  }
+
   size_t VocabIndexer::size() const
   {
-    return forms.size();
+    return _mapped ? _mapped_forms.size() : forms.size();
+  }
+
+  void VocabIndexer::save_mapped(MappedFileWriter& writer) const
+  {
+    if (_mapped)
+    {
+      writer.write(_mapped_forms);
+      writer.write(sfreq);
+      writer.write(_mapped_slots);
+      return;
+    }
+
+    const FlatStrings flat_forms(forms);
+    size_t num_slots = 2;
+    while (num_slots < 2 * form2index.size())
+      num_slots *= 2;
+    std::vector<index_t> slots(num_slots, 0);
+    for (const auto& pair : form2index)
+    {
+      size_t slot = hash_word(pair.first.data(), pair.first.size()) & (num_slots - 1);
+      while (slots[slot])
+        slot = (slot + 1) & (num_slots - 1);
+      slots[slot] = pair.second + 1;
+    }
+
+    writer.write(flat_forms);
+    writer.write(sfreq);
+    writer.write(slots.data(), slots.size());
+  }
+
+  void VocabIndexer::load_mapped(MappedFileReader& reader)
+  {
+    reader.read(_mapped_forms);
+    reader.read(sfreq);
+    reader.read(_mapped_slots);
+    if (sfreq.size() != _mapped_forms.size()
+        || _mapped_slots.empty() || (_mapped_slots.size() & (_mapped_slots.size() - 1)))
+      throw std::runtime_error("corrupted FMI file: inconsistent vocabulary");
+    for (const auto slot : _mapped_slots)
+      if (slot > _mapped_forms.size())
+        throw std::runtime_error("corrupted FMI file: inconsistent vocabulary");
+
+    std::vector<std::string>().swap(forms);
+    std::unordered_map<std::string, index_t>().swap(form2index);
+    _mapped = true;
+  }
+
+  void VocabIndexer::materialize()
+  {
+    if (!_mapped)
+      return;
+
+    forms = _mapped_forms.to_vector();
+    for (const auto slot : _mapped_slots)
+      if (slot)
+        form2index.emplace(forms[slot - 1], slot - 1);
+    sfreq.vector();
+
+    _mapped_forms = FlatStrings();
+    _mapped_slots = FlatArray<index_t>();
+    _mapped = false;
   }
 
   VocabIndexer::index_t VocabIndexer::addWord(const std::string& word)
   {
+    materialize();
     const auto it = form2index.find(word);
 
     if (it != form2index.end())
@@ -44,13 +119,27 @@ namespace fuzzy
     {
       form2index.emplace(word, forms.size());
       forms.push_back(word);
-      sfreq.push_back(0);
+      sfreq.vector().push_back(0);
       return ((index_t)forms.size() - 1);
     }
   }
 
   VocabIndexer::index_t VocabIndexer::getIndex(const std::string& word) const
   {
+    if (_mapped)
+    {
+      const size_t mask = _mapped_slots.size() - 1;
+      for (size_t slot = hash_word(word.data(), word.size()) & mask; _mapped_slots[slot]; slot = (slot + 1) & mask)
+      {
+        const index_t index = _mapped_slots[slot] - 1;
+        const auto begin = _mapped_forms.offsets[index];
+        const auto length = _mapped_forms.offsets[index + 1] - begin;
+        if (length == word.size() && word.compare(0, length, _mapped_forms.chars.data() + begin, length) == 0)
+          return index;
+      }
+      return VOCAB_UNK;
+    }
+
     const auto it = form2index.find(word);
 
     if (it != form2index.end())
@@ -72,6 +161,7 @@ namespace fuzzy
 
   std::vector<VocabIndexer::index_t> VocabIndexer::addWords(const std::vector<std::string>& ngram)
   {
+    materialize();
     std::unordered_set<index_t> vocab_set;
     std::vector<index_t> res;
     res.reserve(ngram.size());
@@ -82,22 +172,45 @@ namespace fuzzy
       res.push_back(idx);
     }
 
+    auto& frequencies = sfreq.vector();
     for(auto idx: vocab_set) {
-      sfreq[idx]++;
+      frequencies[idx]++;
     }
 
     return res;
   }
 
-  const std::string& VocabIndexer::getWord(index_t ind) const
+  void VocabIndexer::removeWords(const std::vector<index_t>& ngram)
+  {
+    const std::unordered_set<index_t> vocab_set(ngram.begin(), ngram.end());
+
+    materialize();
+    auto& frequencies = sfreq.vector();
+    for(auto idx: vocab_set) {
+      frequencies[idx]--;
+    }
+  }
+
+  void VocabIndexer::purgeUnusedWords()
+  {
+    materialize();
+    for (index_t idx = VOCAB_UNK + 1; idx < (index_t)forms.size(); idx++) {
+      if (sfreq[idx] == 0 && !forms[idx].empty()) {
+        form2index.erase(forms[idx]);
+        forms[idx].clear();
+      }
+    }
+  }
+
+  std::string VocabIndexer::getWord(index_t ind) const
   {
-    if (ind >= (index_t)forms.size())
+    if (ind >= (index_t)size())
       return vocab_unk_word;
 
-    return forms[ind];
+    return _mapped ? _mapped_forms[ind] : forms[ind];
   }
 
-  const std::vector<unsigned> &VocabIndexer::getSFreq() const {
+  const FlatArray<unsigned> &VocabIndexer::getSFreq() const {
     return sfreq;
   }
 }
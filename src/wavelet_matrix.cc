@@ -0,0 +1,125 @@
+#include <fuzzy/wavelet_matrix.hh>
+
+#include <stdexcept>
+
+namespace fuzzy
+{
+  RankBitVector::RankBitVector(const std::vector<bool>& bits)
+    : _size(bits.size())
+  {
+    auto& words = _words.vector();
+    words.assign((_size + 63) / 64, 0);
+    for (size_t i = 0; i < _size; i++)
+      if (bits[i])
+        words[i / 64] |= uint64_t(1) << (i % 64);
+    compute_ranks();
+  }
+
+  RankBitVector::RankBitVector(std::vector<uint64_t> words, size_t size)
+    : _size(size)
+  {
+    words.resize((_size + 63) / 64, 0);
+    _words.vector().swap(words);
+    compute_ranks();
+  }
+
+  /* one more rank than blocks, so that rank1(size()) is valid */
+  void
+  RankBitVector::compute_ranks()
+  {
+    auto& ranks = _ranks.vector();
+    ranks.assign(_size / 512 + 1, 0);
+    uint64_t rank = 0;
+    for (size_t word = 0; word < _words.size(); word++)
+    {
+      if (word % 8 == 0)
+        ranks[word / 8] = rank;
+      rank += popcount64(_words[word]);
+    }
+    if (_words.size() % 8 == 0 && _words.size() / 8 < ranks.size())
+      ranks[_words.size() / 8] = rank;
+  }
+
+  void
+  RankBitVector::save_mapped(MappedFileWriter& writer) const
+  {
+    writer.write_value(_size);
+    writer.write(_words);
+    writer.write(_ranks);
+  }
+
+  void
+  RankBitVector::load_mapped(MappedFileReader& reader)
+  {
+    _size = reader.read_value<uint64_t>();
+    reader.read(_words);
+    reader.read(_ranks);
+    if (_words.size() != (_size + 63) / 64 || _ranks.size() != _size / 512 + 1)
+      throw std::runtime_error("corrupted FMI file: invalid bit vector");
+  }
+
+  /* each level is built from the values stably sorted on the bits of the previous levels:
+     the values whose bit is 0 first */
+  WaveletMatrix::WaveletMatrix(const std::vector<unsigned>& values, unsigned bits_per_value)
+    : _size(values.size())
+    , _bits(bits_per_value)
+  {
+    std::vector<uint64_t> words((_size * _bits + 63) / 64, 0);
+    auto& zeros = _zeros.vector();
+    zeros.resize(_bits);
+
+    std::vector<unsigned> current(values);
+    std::vector<unsigned> next(_size);
+    for (size_t level = 0; level < _bits; level++)
+    {
+      const unsigned shift = _bits - 1 - level;
+      size_t num_zeros = 0;
+      for (size_t i = 0; i < _size; i++)
+      {
+        if ((current[i] >> shift) & 1)
+        {
+          const size_t bit = level * _size + i;
+          words[bit / 64] |= uint64_t(1) << (bit % 64);
+        }
+        else
+          num_zeros++;
+      }
+      zeros[level] = num_zeros;
+
+      size_t zero = 0;
+      size_t one = num_zeros;
+      for (size_t i = 0; i < _size; i++)
+        next[((current[i] >> shift) & 1) ? one++ : zero++] = current[i];
+      current.swap(next);
+    }
+
+    _levels = RankBitVector(std::move(words), _size * _bits);
+    auto& level_ones = _level_ones.vector();
+    level_ones.resize(_bits);
+    for (size_t level = 0; level < _bits; level++)
+      level_ones[level] = _levels.rank1(level * _size);
+  }
+
+  void
+  WaveletMatrix::save_mapped(MappedFileWriter& writer) const
+  {
+    writer.write_value(_size);
+    writer.write_value(_bits);
+    _levels.save_mapped(writer);
+    writer.write(_level_ones);
+    writer.write(_zeros);
+  }
+
+  void
+  WaveletMatrix::load_mapped(MappedFileReader& reader)
+  {
+    _size = reader.read_value<uint64_t>();
+    _bits = reader.read_value<uint64_t>();
+    _levels.load_mapped(reader);
+    reader.read(_level_ones);
+    reader.read(_zeros);
+    if (_bits > 32 || _levels.size() != _size * _bits
+        || _level_ones.size() != _bits || _zeros.size() != _bits)
+      throw std::runtime_error("corrupted FMI file: invalid wavelet matrix");
+  }
+}
@@ -1,8 +1,11 @@
 #include <gtest/gtest.h>
 
+#include <fuzzy/edit_distance.hh>
 #include <fuzzy/fuzzy_match.hh>
 #include <fuzzy/fuzzy_matcher_binarization.hh>
+#include <fuzzy/index_builder.hh>
 #include <iostream>
+#include <tuple>
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string.hpp> 
 #include <boost/lexical_cast.hpp>
@@ -631,6 +634,1163 @@ TEST(FuzzyMatchTest, contrastive_buffer) {
   }
 }
 
+static std::string read_file(const std::string& path) {
+  std::ifstream ifs(path, std::ios_base::binary);
+  return std::string(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+}
+
+TEST(FuzzyMatchTest, bit_parallel_edit_distance) {
+  std::srand(11);
+  for (int i = 0; i < 500; i++) {
+    // up to 3 blocks of 64 pattern tokens
+    std::vector<unsigned> pattern(std::rand() % 200);
+    std::vector<uint16_t> sentence(std::rand() % 200);
+    const unsigned vocab_size = 2 + std::rand() % 20;
+    for (auto& token : pattern)
+      token = 1 + std::rand() % vocab_size;
+    for (auto& token : sentence)
+      token = 1 + std::rand() % vocab_size;
+
+    std::vector<std::vector<int>> distances(sentence.size() + 1, std::vector<int>(pattern.size() + 1));
+    for (size_t j = 0; j <= pattern.size(); j++)
+      distances[0][j] = j;
+    for (size_t k = 1; k <= sentence.size(); k++) {
+      distances[k][0] = k;
+      for (size_t j = 1; j <= pattern.size(); j++)
+        distances[k][j] = std::min({distances[k - 1][j] + 1,
+                                    distances[k][j - 1] + 1,
+                                    distances[k - 1][j - 1] + (sentence[k - 1] != pattern[j - 1])});
+    }
+    const fuzzy::BitParallelPattern bit_parallel(pattern.data(), pattern.size());
+    EXPECT_EQ(bit_parallel.distance(sentence.data(), sentence.size()), distances[sentence.size()][pattern.size()]);
+
+    // the same cost as the dynamic programming, to the last bit - which returns its row minimum
+    // when given a max fuzzyness and an empty pattern
+    if (pattern.empty())
+      continue;
+    const fuzzy::EditCosts edit_costs;
+    const fuzzy::Costs costs(sentence.size(), pattern.size(), edit_costs);
+    EXPECT_EQ(fuzzy::_edit_distance(sentence.data(), sentence.size(), pattern.data(), pattern.size(),
+                                    edit_costs, costs),
+              fuzzy::_edit_distance(sentence.data(), sentence.size(), pattern.data(), pattern.size(),
+                                    edit_costs, costs, 1e30));
+  }
+
+  // a pattern preprocessed once gives the distance of each call to the sentences compared to it
+  const std::vector<unsigned> pattern{1, 2, 3, 1, 2, 4, 5, 1};
+  const fuzzy::BitParallelPattern bit_parallel(pattern.data(), pattern.size());
+  const fuzzy::EditCosts edit_costs;
+  fuzzy::EditDistanceWorkspace workspace;
+  for (int i = 0; i < 100; i++) {
+    std::vector<unsigned> sentence(std::rand() % 20);
+    for (auto& token : sentence)
+      token = 1 + std::rand() % 6;
+    const fuzzy::Costs costs(sentence.size(), pattern.size(), edit_costs);
+    EXPECT_EQ(fuzzy::_edit_distance(sentence.data(), sentence.size(), bit_parallel, costs, &workspace),
+              fuzzy::_edit_distance(sentence.data(), sentence.size(), pattern.data(), pattern.size(),
+                                    edit_costs, costs));
+  }
+}
+
+TEST(FuzzyMatchTest, add_tm_batch) {
+  std::vector<std::string> ids;
+  std::vector<std::string> sentences;
+  std::ifstream ifs(get_data("tm1"));
+  std::string srcLine;
+  while (getline(ifs, srcLine)) {
+    ids.push_back(boost::lexical_cast<std::string>(ids.size()+1)+"="+srcLine);
+    sentences.push_back(srcLine);
+  }
+
+  fuzzy::FuzzyMatch sequential(fuzzy::FuzzyMatch::pt_tag | fuzzy::FuzzyMatch::pt_nbr);
+  testing::internal::CaptureStderr();
+  for (size_t i = 0; i < sentences.size(); i++)
+    sequential.add_tm(ids[i], sentences[i], false);
+  std::string sequential_warnings = testing::internal::GetCapturedStderr();
+  sequential.sort();
+  fuzzy::export_binarized_fuzzy_matcher(get_temp("sequential.fmi"), sequential);
+
+  fuzzy::FuzzyMatch batch(fuzzy::FuzzyMatch::pt_tag | fuzzy::FuzzyMatch::pt_nbr);
+  testing::internal::CaptureStderr();
+  size_t count = batch.add_tm_batch(ids, sentences, 4, true);
+  std::string batch_warnings = testing::internal::GetCapturedStderr();
+  fuzzy::export_binarized_fuzzy_matcher(get_temp("batch.fmi"), batch);
+
+  EXPECT_EQ(count, sentences.size());
+  EXPECT_EQ(sequential_warnings, batch_warnings);
+  EXPECT_EQ(read_file(get_temp("sequential.fmi")), read_file(get_temp("batch.fmi")));
+}
+
+static std::vector<std::vector<unsigned>> random_sentences(size_t vocab_size, int num_sentences) {
+  std::vector<std::vector<unsigned>> sentences;
+  std::srand(42);
+  for (int i = 0; i < num_sentences; i++) {
+    std::vector<unsigned> sentence;
+    const int length = 1 + std::rand() % 12;
+    for (int j = 0; j < length; j++)
+      // low-entropy sentences for long common prefixes - 0 is the sentence separator
+      sentence.push_back(1 + std::rand() % (i % 3 ? vocab_size - 1 : 2));
+    sentences.push_back(sentence);
+    if (i % 10 == 0) // identical sentences are ordered by sentence id
+      sentences.push_back(sentence);
+  }
+  return sentences;
+}
+
+/* corpus of the index tests: the lines of tm1 if with_tm1, followed by random sentences of the words
+   w1, w2... */
+static std::vector<std::string> tm_sentences(bool with_tm1, size_t vocab_size, int num_random_sentences) {
+  std::vector<std::string> sentences;
+  if (with_tm1) {
+    std::ifstream ifs(get_data("tm1"));
+    std::string line;
+    while (getline(ifs, line))
+      sentences.push_back(line);
+  }
+  for (const auto& wids : random_sentences(vocab_size, num_random_sentences)) {
+    std::string sentence;
+    for (const auto wid : wids)
+      sentence += (sentence.empty() ? "w" : " w") + std::to_string(wid);
+    sentences.push_back(sentence);
+  }
+  return sentences;
+}
+
+static std::string sentence_id(size_t i) {
+  return boost::lexical_cast<std::string>(i+1);
+}
+
+/* one sentence out of step */
+static std::vector<std::string> sample_patterns(const std::vector<std::string>& sentences, size_t step) {
+  std::vector<std::string> patterns;
+  for (size_t i = 0; i < sentences.size(); i += step)
+    patterns.push_back(sentences[i]);
+  return patterns;
+}
+
+/* the same sentences [begin, end) added to both indexes */
+static void add_sentences(fuzzy::FuzzyMatch& expected, fuzzy::FuzzyMatch& actual,
+                          const std::vector<std::string>& sentences, size_t begin, size_t end,
+                          bool index_sort) {
+  for (size_t i = begin; i < end; i++) {
+    expected.add_tm(sentence_id(i), sentences[i], index_sort);
+    actual.add_tm(sentence_id(i), sentences[i], index_sort);
+  }
+}
+
+static void expect_same_matches(const fuzzy::FuzzyMatch& expected_matcher,
+                                const fuzzy::FuzzyMatch& actual_matcher,
+                                const std::vector<std::string>& patterns,
+                                float vocab_idf_penalty = 0) {
+  // the actual matches without a workspace, and with one reused across patterns and indexes
+  static fuzzy::FuzzyMatch::Workspace workspace;
+  for (const auto& pattern : patterns) {
+    std::vector<fuzzy::FuzzyMatch::Match> expected;
+    expected_matcher.match(pattern, 0.5, 5, false, expected, 3, 0.3, vocab_idf_penalty);
+    for (auto* actual_workspace : {static_cast<fuzzy::FuzzyMatch::Workspace*>(nullptr), &workspace}) {
+      std::vector<fuzzy::FuzzyMatch::Match> actual;
+      actual_matcher.match(pattern, 0.5, 5, false, actual, 3, 0.3, vocab_idf_penalty,
+                           fuzzy::EditCosts(), 0, fuzzy::ContrastReduce::MEAN, -1, actual_workspace);
+      ASSERT_EQ(expected.size(), actual.size());
+      for (size_t j = 0; j < expected.size(); j++) {
+        EXPECT_EQ(expected[j].id, actual[j].id);
+        EXPECT_EQ(expected[j].score, actual[j].score);
+      }
+    }
+  }
+}
+
+/* the best subsequence of each pattern */
+static void expect_same_subsequences(const fuzzy::FuzzyMatch& expected_matcher,
+                                     const fuzzy::FuzzyMatch& actual_matcher,
+                                     const std::vector<std::string>& patterns) {
+  for (const auto& pattern : patterns) {
+    std::vector<fuzzy::FuzzyMatch::Match> expected;
+    std::vector<fuzzy::FuzzyMatch::Match> actual;
+    expected_matcher.subsequence(pattern, 1, true, expected, 2, 0);
+    actual_matcher.subsequence(pattern, 1, true, actual, 2, 0);
+    ASSERT_EQ(expected.size(), actual.size());
+    if (!expected.empty()) {
+      EXPECT_EQ(expected[0].id, actual[0].id);
+    }
+  }
+}
+
+static void expect_same_suffix_array(const fuzzy::SuffixArray& expected, const fuzzy::SuffixArray& actual,
+                                     size_t vocab_size) {
+  ASSERT_EQ(expected.num_suffixes(), actual.num_suffixes());
+  for (size_t i = 0; i < expected.num_suffixes(); i++) {
+    EXPECT_EQ(expected.get_suffix_view(i).sentence_id, actual.get_suffix_view(i).sentence_id);
+    EXPECT_EQ(expected.get_suffix_view(i).subsentence_pos, actual.get_suffix_view(i).subsentence_pos);
+  }
+  for (unsigned wid = 1; wid < vocab_size; wid++)
+    EXPECT_EQ(expected.equal_range(&wid, 1), actual.equal_range(&wid, 1));
+}
+
+TEST(FuzzyMatchTest, bit_parallel_lcs) {
+  const std::vector<fuzzy::EditCosts> all_edit_costs{
+    {1, 0, 1}, {1, 0, 3}, {0, 1, 1}, {0, 0.5, 2}, {1, 1, 2}, {0.5, 1, 2}, {1, 1, 3}, {0.3, 0.7, 1}};
+  const std::vector<float> factors{0, 0.5, 0.9, 1, 1.5};
+  std::srand(13);
+  for (int i = 0; i < 500; i++) {
+    std::vector<unsigned> pattern(1 + std::rand() % 200);
+    std::vector<uint16_t> sentence(1 + std::rand() % 200);
+    const unsigned vocab_size = 2 + std::rand() % 20;
+    for (auto& token : pattern)
+      token = 1 + std::rand() % vocab_size;
+    for (auto& token : sentence)
+      token = 1 + std::rand() % vocab_size;
+
+    std::vector<std::vector<int>> lengths(sentence.size() + 1, std::vector<int>(pattern.size() + 1, 0));
+    for (size_t k = 1; k <= sentence.size(); k++)
+      for (size_t j = 1; j <= pattern.size(); j++)
+        lengths[k][j] = (sentence[k - 1] == pattern[j - 1]
+                         ? lengths[k - 1][j - 1] + 1
+                         : std::max(lengths[k - 1][j], lengths[k][j - 1]));
+    const fuzzy::BitParallelPattern bit_parallel(pattern.data(), pattern.size());
+    EXPECT_EQ(bit_parallel.lcs_length(sentence.data(), sentence.size()), lengths[sentence.size()][pattern.size()]);
+
+    // the same cost as the dynamic programming on real tokens without differences, to the last bit
+    fuzzy::Tokens pattern_tokens;
+    fuzzy::Tokens sentence_tokens;
+    for (const auto token : pattern)
+      pattern_tokens.push_back(std::to_string(token));
+    for (const auto token : sentence)
+      sentence_tokens.push_back(std::to_string(token));
+    const std::vector<const char*> st(pattern.size() + 1, nullptr);
+    const std::vector<int> sn(pattern.size() + 1, 0);
+    for (const auto& edit_costs : all_edit_costs) {
+      ASSERT_TRUE(edit_costs.is_lcs());
+      const fuzzy::Costs costs(pattern.size(), sentence.size(), edit_costs);
+      const float exact = fuzzy::_edit_distance(sentence.data(), fuzzy::Sentence(sentence_tokens), sentence.size(),
+                                                pattern.data(), pattern_tokens, pattern.size(),
+                                                st, sn, {}, 0, edit_costs, costs);
+      EXPECT_EQ(fuzzy::_lcs_edit_distance(sentence.data(), sentence.size(), pattern.data(), bit_parallel,
+                                          edit_costs, costs),
+                exact);
+      // within a bound, the cost is exact, and above it, it is only known to be larger
+      const float max_cost = exact * factors[std::rand() % factors.size()];
+      const float cost = fuzzy::_lcs_edit_distance(sentence.data(), sentence.size(), pattern.data(), bit_parallel,
+                                                   edit_costs, costs, max_cost);
+      if (exact <= max_cost)
+        EXPECT_EQ(cost, exact);
+      else
+        EXPECT_GT(cost, max_cost);
+    }
+  }
+
+  // the matches are the ones of the dynamic programming, which is used when the numbers are normalized:
+  // the words have no digits
+  std::vector<std::string> sentences;
+  for (const auto& wids : random_sentences(8, 1000)) {
+    std::string sentence;
+    for (const auto wid : wids)
+      sentence += (sentence.empty() ? "w" : " w") + std::string(1, 'a' + wid);
+    sentences.push_back(sentence);
+  }
+  fuzzy::FuzzyMatch expected(fuzzy::FuzzyMatch::pt_nbr);
+  fuzzy::FuzzyMatch actual;
+  for (size_t i = 0; i < sentences.size(); i++) {
+    expected.add_tm(std::to_string(i), sentences[i], false);
+    actual.add_tm(std::to_string(i), sentences[i], false);
+  }
+  expected.sort();
+  actual.sort();
+  for (const auto& edit_costs : {fuzzy::EditCosts(1, 0, 1), fuzzy::EditCosts(0.5, 1, 2)}) {
+    for (size_t i = 0; i < sentences.size(); i += 7) {
+      std::vector<fuzzy::FuzzyMatch::Match> expected_matches;
+      std::vector<fuzzy::FuzzyMatch::Match> actual_matches;
+      expected.match(sentences[i], 0.5, 10, false, expected_matches, 2, 0, 0, edit_costs);
+      actual.match(sentences[i], 0.5, 10, false, actual_matches, 2, 0, 0, edit_costs);
+      ASSERT_EQ(expected_matches.size(), actual_matches.size());
+      for (size_t j = 0; j < expected_matches.size(); j++) {
+        EXPECT_EQ(expected_matches[j].id, actual_matches[j].id);
+        EXPECT_EQ(expected_matches[j].score, actual_matches[j].score);
+      }
+    }
+  }
+}
+
+TEST(FuzzyMatchTest, banded_edit_distance) {
+  const std::vector<fuzzy::EditCosts> all_edit_costs{{1, 1, 1}, {1, 2, 1}, {1, 0, 1}, {0.5, 1, 2}};
+  std::srand(17);
+  for (int i = 0; i < 500; i++) {
+    std::vector<unsigned> pattern(1 + std::rand() % 100);
+    std::vector<uint16_t> sentence(1 + std::rand() % 100);
+    const unsigned vocab_size = 2 + std::rand() % 20;
+    for (auto& token : pattern)
+      token = 1 + std::rand() % vocab_size;
+    for (auto& token : sentence)
+      token = 1 + std::rand() % vocab_size;
+    fuzzy::Tokens pattern_tokens;
+    fuzzy::Tokens sentence_tokens;
+    for (const auto token : pattern)
+      pattern_tokens.push_back(std::to_string(token));
+    for (const auto token : sentence)
+      sentence_tokens.push_back(std::to_string(token));
+    const std::vector<const char*> st(pattern.size() + 1, nullptr);
+    const std::vector<int> sn(pattern.size() + 1, 0);
+
+    // the cost within the bound is exact, and a greater one stays above it
+    for (const auto& edit_costs : all_edit_costs) {
+      const fuzzy::Costs costs(pattern.size(), sentence.size(), edit_costs);
+      const float cost = fuzzy::_edit_distance(sentence.data(), sentence.size(), pattern.data(), pattern.size(),
+                                               edit_costs, costs);
+      const float real_cost = fuzzy::_edit_distance(sentence.data(), fuzzy::Sentence(sentence_tokens),
+                                                    sentence.size(), pattern.data(), pattern_tokens,
+                                                    pattern.size(), st, sn, {}, 0, edit_costs, costs);
+      EXPECT_EQ(cost, real_cost);
+      for (const float bound : {cost, cost * 0.5f, cost * 0.9f, cost * 1.5f, 0.f}) {
+        const float banded = fuzzy::_edit_distance(sentence.data(), sentence.size(),
+                                                    pattern.data(), pattern.size(),
+                                                    edit_costs, costs, bound);
+        const float real_banded = fuzzy::_edit_distance(sentence.data(), fuzzy::Sentence(sentence_tokens),
+                                                        sentence.size(), pattern.data(), pattern_tokens,
+                                                        pattern.size(), st, sn, {}, 0, edit_costs, costs,
+                                                        bound);
+        if (cost <= bound) {
+          EXPECT_EQ(banded, cost);
+          EXPECT_EQ(real_banded, cost);
+        } else {
+          EXPECT_GT(banded, bound);
+          EXPECT_GT(real_banded, bound);
+        }
+      }
+    }
+  }
+}
+
+TEST(FuzzyMatchTest, edit_distance_workspace) {
+  const fuzzy::EditCosts edit_costs(1, 2, 1);
+  fuzzy::EditDistanceWorkspace workspace;
+  std::srand(19);
+  for (int i = 0; i < 300; i++) {
+    // pattern and sentence of various lengths, with case differences and intermediate tokens
+    std::vector<unsigned> pattern(std::rand() % 100);
+    std::vector<unsigned> sentence(std::rand() % 100);
+    fuzzy::Tokens pattern_tokens;
+    fuzzy::Sentence real;
+    for (auto& token : pattern) {
+      token = 1 + std::rand() % 10;
+      pattern_tokens.push_back("w" + std::to_string(token));
+    }
+    for (auto& token : sentence) {
+      token = 1 + std::rand() % 10;
+      real.push_back((std::rand() % 4 ? "w" : "W") + std::to_string(token));
+    }
+    for (size_t k = 0; k <= sentence.size(); k++)
+      if (std::rand() % 5 == 0)
+        real.set_itok(k, "<b>");
+    std::vector<const char*> st(pattern.size() + 1, nullptr);
+    std::vector<int> sn(pattern.size() + 1, 0);
+    for (size_t j = 0; j <= pattern.size(); j++)
+      if (std::rand() % 5 == 0) {
+        st[j] = "<i>";
+        sn[j] = 3;
+      }
+
+    workspace.sentence.assign(real, sentence.size());
+    EXPECT_EQ(std::vector<std::string>(workspace.sentence.tokens.begin(), workspace.sentence.tokens.end()),
+              (fuzzy::Tokens)real);
+
+    // the buffers left by the previous sentences change nothing
+    const fuzzy::Costs costs(pattern.size(), sentence.size(), edit_costs);
+    EXPECT_EQ(fuzzy::_edit_distance(sentence.data(), real, sentence.size(),
+                                    pattern.data(), pattern_tokens, pattern.size(),
+                                    st, sn, {}, 0, edit_costs, costs, 30, &workspace),
+              fuzzy::_edit_distance(sentence.data(), real, sentence.size(),
+                                    pattern.data(), pattern_tokens, pattern.size(),
+                                    st, sn, {}, 0, edit_costs, costs, 30));
+    EXPECT_EQ(fuzzy::_edit_distance(sentence.data(), sentence.size(), pattern.data(), pattern.size(),
+                                    fuzzy::EditCosts(), costs, std::numeric_limits<float>::max(), &workspace),
+              fuzzy::_edit_distance(sentence.data(), sentence.size(), pattern.data(), pattern.size(),
+                                    fuzzy::EditCosts(), costs));
+  }
+}
+
+TEST(FuzzyMatchTest, batch_edit_distance) {
+  const std::vector<fuzzy::EditCosts> all_edit_costs{{1, 1, 1}, {1, 2, 1}, {0.5, 1, 2}, {2, 2, 2}};
+  EXPECT_FALSE(fuzzy::BatchPattern::supports(fuzzy::EditCosts(1, 0.01, 1)));
+  fuzzy::EditDistanceWorkspace workspace;
+  std::srand(23);
+  for (int i = 0; i < 100; i++) {
+    std::vector<unsigned> pattern(1 + std::rand() % 60);
+    const unsigned vocab_size = 2 + std::rand() % 20;
+    for (auto& token : pattern)
+      token = 1 + std::rand() % vocab_size;
+    // more sentences than lanes, some of them empty
+    std::vector<std::vector<uint16_t>> sentences(1 + std::rand() % 30);
+    std::vector<const uint16_t*> sentence_ptrs;
+    std::vector<int> lengths;
+    for (auto& sentence : sentences) {
+      sentence.resize(std::rand() % 80);
+      for (auto& token : sentence)
+        token = 1 + std::rand() % vocab_size;
+      sentence_ptrs.push_back(sentence.data());
+      lengths.push_back(sentence.size());
+    }
+
+    // the cost within the bound is exact, and a greater one stays above it
+    for (const auto& edit_costs : all_edit_costs) {
+      const fuzzy::BatchPattern batch_pattern(pattern.data(), pattern.size(), edit_costs);
+      std::vector<float> exact_costs;
+      std::vector<float> max_costs;
+      for (const auto& sentence : sentences) {
+        const fuzzy::Costs costs(pattern.size(), sentence.size(), edit_costs);
+        exact_costs.push_back(fuzzy::_edit_distance(sentence.data(), sentence.size(),
+                                                    pattern.data(), pattern.size(), edit_costs, costs));
+        const float factors[] = {0.f, 0.5f, 0.9f, 1.f, 1.5f};
+        max_costs.push_back(std::rand() % 6 == 0
+                            ? std::numeric_limits<float>::max()
+                            : exact_costs.back() * factors[std::rand() % 5]);
+      }
+      std::vector<float> costs(sentences.size());
+      fuzzy::_edit_distances(sentence_ptrs.data(), lengths.data(), max_costs.data(), sentences.size(),
+                             batch_pattern, costs.data(), workspace);
+      for (size_t j = 0; j < sentences.size(); j++) {
+        if (exact_costs[j] <= max_costs[j])
+          EXPECT_EQ(costs[j], exact_costs[j]);
+        else
+          EXPECT_GT(costs[j], max_costs[j]);
+      }
+    }
+  }
+}
+
+TEST(FuzzyMatchTest, incremental_add_tm) {
+  const auto sentences = tm_sentences(true, 8, 300);
+  const auto patterns = sample_patterns(sentences, 7);
+
+  // the second half goes to the delta, merged from time to time
+  testing::internal::CaptureStderr();
+  fuzzy::FuzzyMatch full;
+  fuzzy::FuzzyMatch incremental;
+  add_sentences(full, incremental, sentences, 0, sentences.size() / 2, false);
+  incremental.sort();
+  for (size_t i = sentences.size() / 2; i < sentences.size(); i++) {
+    full.add_tm(sentence_id(i), sentences[i], false);
+    incremental.add_tm(sentence_id(i), sentences[i], true);
+  }
+  full.sort();
+  testing::internal::GetCapturedStderr();
+
+  for (const auto& pattern : patterns) {
+    std::vector<fuzzy::FuzzyMatch::Match> expected;
+    std::vector<fuzzy::FuzzyMatch::Match> actual;
+    full.match(pattern, 0.5, 5, false, expected);
+    incremental.match(pattern, 0.5, 5, false, actual);
+    ASSERT_EQ(expected.size(), actual.size());
+    for (size_t j = 0; j < expected.size(); j++) {
+      EXPECT_EQ(expected[j].id, actual[j].id);
+      EXPECT_EQ(expected[j].score, actual[j].score);
+    }
+  }
+  expect_same_subsequences(full, incremental, patterns);
+
+  // once merged, the index is the one built at once
+  incremental.merge_delta();
+  fuzzy::export_binarized_fuzzy_matcher(get_temp("full.fmi"), full);
+  fuzzy::export_binarized_fuzzy_matcher(get_temp("incremental.fmi"), incremental);
+  EXPECT_EQ(read_file(get_temp("full.fmi")), read_file(get_temp("incremental.fmi")));
+}
+
+TEST(FuzzyMatchTest, remove_tm) {
+  auto sentences = tm_sentences(false, 8, 300);
+  sentences.push_back("only in a confidential segment");
+  const auto removed = [&sentences](size_t i) { return i % 5 == 0 || i + 1 == sentences.size(); };
+
+  fuzzy::FuzzyMatch expected;
+  for (size_t i = 0; i < sentences.size(); i++)
+    if (!removed(i))
+      expected.add_tm(sentence_id(i), sentences[i], false);
+  expected.sort();
+
+  // the last sentences are in the delta
+  fuzzy::FuzzyMatch actual;
+  for (size_t i = 0; i < sentences.size(); i++)
+    actual.add_tm(sentence_id(i), sentences[i], i + 10 >= sentences.size());
+  size_t count = 0;
+  size_t expected_count = 0;
+  for (size_t i = 0; i < sentences.size(); i++) {
+    if (removed(i)) {
+      count += actual.remove_tm(sentence_id(i));
+      expected_count++;
+    }
+  }
+  EXPECT_EQ(count, expected_count);
+  EXPECT_EQ(actual.remove_tm(sentence_id(0)), 0);
+
+  expect_same_matches(expected, actual, sentences);
+  expect_same_matches(expected, actual, sentences, 1);
+
+  // tombstones are saved with the index
+  fuzzy::export_binarized_fuzzy_matcher(get_temp("removed.fmi"), actual);
+  fuzzy::FuzzyMatch reloaded;
+  fuzzy::import_binarized_fuzzy_matcher(get_temp("removed.fmi"), reloaded);
+  expect_same_matches(expected, reloaded, sentences, 1);
+
+  actual.compact();
+  expect_same_matches(expected, actual, sentences, 1);
+  std::vector<fuzzy::FuzzyMatch::Match> matches;
+  actual.match(sentences.back(), 0.5, 5, false, matches);
+  EXPECT_TRUE(matches.empty());
+}
+
+TEST(FuzzyMatchTest, compact_kept_sentences) {
+  // the sentences before the removed one stay in place, with their id and real tokens
+  const int pt = fuzzy::FuzzyMatch::pt_tag | fuzzy::FuzzyMatch::pt_nbr | fuzzy::FuzzyMatch::pt_cas;
+  const std::vector<std::string> sentences{"The Cat sat on 3 mats .",
+                                           "A Dog slept on 12 <b>rugs</b> .",
+                                           "the cat sat on 4 mats .",
+                                           "a dog slept on 11 rugs ."};
+  fuzzy::FuzzyMatch expected(pt);
+  fuzzy::FuzzyMatch actual(pt);
+  for (size_t i = 0; i < sentences.size(); i++) {
+    if (i != 2)
+      expected.add_tm("id" + std::to_string(i), sentences[i], false);
+    actual.add_tm("id" + std::to_string(i), sentences[i], false);
+  }
+  expected.sort();
+  actual.sort();
+  EXPECT_EQ(actual.remove_tm("id2"), 1);
+  actual.compact();
+
+  for (const std::string pattern : {"the cat sat on 5 mats .", "a dog slept on 12 rugs ."}) {
+    std::vector<fuzzy::FuzzyMatch::Match> expected_matches;
+    std::vector<fuzzy::FuzzyMatch::Match> actual_matches;
+    expected.match(pattern, 0.3, 5, false, expected_matches);
+    actual.match(pattern, 0.3, 5, false, actual_matches);
+    ASSERT_FALSE(expected_matches.empty());
+    ASSERT_EQ(expected_matches.size(), actual_matches.size());
+    for (size_t j = 0; j < expected_matches.size(); j++) {
+      EXPECT_EQ(expected_matches[j].id, actual_matches[j].id);
+      EXPECT_EQ(expected_matches[j].score, actual_matches[j].score);
+    }
+  }
+}
+
+TEST(FuzzyMatchTest, sharded_index) {
+  const auto sentences = tm_sentences(true, 8, 300);
+  const size_t num_sentences = sentences.size() - 10;
+  const auto patterns = sample_patterns(sentences, 7);
+
+  testing::internal::CaptureStderr();
+  fuzzy::FuzzyMatch expected;
+  fuzzy::FuzzyMatch actual;
+  add_sentences(expected, actual, sentences, 0, num_sentences, false);
+  testing::internal::GetCapturedStderr();
+  expected.sort();
+  actual.shard(4);
+
+  expect_same_matches(expected, actual, patterns);
+  expect_same_matches(expected, actual, patterns, 1);
+  for (const auto& pattern : patterns) {
+    std::vector<fuzzy::FuzzyMatch::Match> expected_matches;
+    std::vector<fuzzy::FuzzyMatch::Match> actual_matches;
+    expected.match(pattern, 0.3, 4, true, expected_matches, 2, 0, 0, fuzzy::EditCosts(), 0.5, fuzzy::ContrastReduce::MEAN, 8);
+    actual.match(pattern, 0.3, 4, true, actual_matches, 2, 0, 0, fuzzy::EditCosts(), 0.5, fuzzy::ContrastReduce::MEAN, 8);
+    ASSERT_EQ(expected_matches.size(), actual_matches.size());
+    for (size_t j = 0; j < expected_matches.size(); j++)
+      EXPECT_EQ(expected_matches[j].id, actual_matches[j].id);
+  }
+  expect_same_subsequences(expected, actual, patterns);
+
+  // the new sentences go to the delta, and the removed ones can be in any shard
+  add_sentences(expected, actual, sentences, num_sentences, sentences.size(), true);
+  for (size_t i = 0; i < sentences.size(); i += 11) {
+    expected.remove_tm(sentence_id(i));
+    actual.remove_tm(sentence_id(i));
+  }
+  expect_same_matches(expected, actual, patterns, 1);
+
+  // the shards are merged in the saved index
+  expected.compact();
+  actual.compact();
+  expect_same_matches(expected, actual, patterns);
+  expected.merge_delta();
+  actual.merge_delta();
+  fuzzy::export_binarized_fuzzy_matcher(get_temp("unsharded.fmi"), expected);
+  fuzzy::export_binarized_fuzzy_matcher(get_temp("sharded.fmi"), actual);
+  EXPECT_EQ(read_file(get_temp("unsharded.fmi")), read_file(get_temp("sharded.fmi")));
+}
+
+TEST(FuzzyMatchTest, fm_index) {
+  const auto sentences = tm_sentences(true, 8, 300);
+  const size_t num_sentences = sentences.size() - 10;
+  const auto patterns = sample_patterns(sentences, 7);
+
+  testing::internal::CaptureStderr();
+  fuzzy::FuzzyMatch expected;
+  fuzzy::FuzzyMatch actual;
+  add_sentences(expected, actual, sentences, 0, num_sentences, false);
+  testing::internal::GetCapturedStderr();
+  expected.sort();
+  actual.compress();
+
+  expect_same_matches(expected, actual, patterns);
+  expect_same_subsequences(expected, actual, patterns);
+
+  // the index stays compressed with a delta, removed sentences and shards
+  add_sentences(expected, actual, sentences, num_sentences, sentences.size(), true);
+  for (size_t i = 0; i < sentences.size(); i += 11) {
+    expected.remove_tm(sentence_id(i));
+    actual.remove_tm(sentence_id(i));
+  }
+  actual.shard(3);
+  expect_same_matches(expected, actual, patterns, 1);
+
+  for (const char version : {fuzzy::FuzzyMatch::version, fuzzy::FuzzyMatch::mapped_version}) {
+    const auto file = get_temp(std::string("fm_index.v") + version + ".fmi");
+    fuzzy::export_binarized_fuzzy_matcher(file, actual, version);
+    fuzzy::FuzzyMatch loaded;
+    fuzzy::import_binarized_fuzzy_matcher(file, loaded);
+    expect_same_matches(expected, loaded, patterns);
+  }
+
+  // compaction rebuilds the suffixes before compressing them again
+  expected.compact();
+  actual.compact();
+  expect_same_matches(expected, actual, patterns);
+}
+
+TEST(FuzzyMatchTest, mapped_index) {
+  const int pt = fuzzy::FuzzyMatch::pt_tag | fuzzy::FuzzyMatch::pt_nbr | fuzzy::FuzzyMatch::pt_cas;
+  auto sentences = tm_sentences(true, 0, 0);
+
+  // with a delta and a removed sentence
+  fuzzy::FuzzyMatch expected(pt);
+  for (size_t i = 0; i < sentences.size(); i++)
+    expected.add_tm(sentence_id(i), sentences[i], i + 5 >= sentences.size());
+  expected.remove_tm(sentence_id(1));
+  fuzzy::export_binarized_fuzzy_matcher(get_temp("tm1.v2.fmi"), expected, fuzzy::FuzzyMatch::mapped_version);
+
+  fuzzy::FuzzyMatch mapped;
+  fuzzy::import_binarized_fuzzy_matcher(get_temp("tm1.v2.fmi"), mapped);
+  expect_same_matches(expected, mapped, sentences, 1);
+
+  // a mapped index can be saved back in both formats
+  fuzzy::export_binarized_fuzzy_matcher(get_temp("tm1.v1.fmi"), mapped);
+  fuzzy::FuzzyMatch reloaded;
+  fuzzy::import_binarized_fuzzy_matcher(get_temp("tm1.v1.fmi"), reloaded);
+  expect_same_matches(expected, reloaded, sentences, 1);
+  fuzzy::export_binarized_fuzzy_matcher(get_temp("tm1.v2.copy.fmi"), mapped, fuzzy::FuzzyMatch::mapped_version);
+  EXPECT_EQ(read_file(get_temp("tm1.v2.fmi")), read_file(get_temp("tm1.v2.copy.fmi")));
+
+  // and modified, its arrays being copied
+  expected.add_tm("new", "a new sentence with some <tag>tags</tag>");
+  mapped.add_tm("new", "a new sentence with some <tag>tags</tag>");
+  expected.remove_tm(sentence_id(2));
+  mapped.remove_tm(sentence_id(2));
+  sentences.push_back("a new sentence with some <tag>tags</tag>");
+  expect_same_matches(expected, mapped, sentences, 1);
+  mapped.compact();
+  expected.compact();
+  expect_same_matches(expected, mapped, sentences, 1);
+}
+
+TEST(FuzzyMatchTest, index_builder) {
+  const int pt = fuzzy::FuzzyMatch::pt_tag | fuzzy::FuzzyMatch::pt_nbr | fuzzy::FuzzyMatch::pt_cas;
+  const auto sentences = tm_sentences(true, 50, 500);
+  std::vector<std::string> ids;
+  for (size_t i = 0; i < sentences.size(); i++)
+    ids.push_back(sentence_id(i));
+
+  fuzzy::FuzzyMatch in_memory(pt);
+  in_memory.add_tm_batch(ids, sentences);
+  in_memory.sort();
+  const size_t prefix_cache_bytes = in_memory.cache_prefixes(2);
+  fuzzy::export_binarized_fuzzy_matcher(get_temp("in_memory.fmi"), in_memory, fuzzy::FuzzyMatch::mapped_version);
+
+  // a tiny memory budget gives many runs
+  fuzzy::IndexBuilder builder(get_temp("out_of_core.fmi"), pt, fuzzy::DEFAULT_MAX_TOKENS_IN_PATTERN, 32768, 2);
+  for (size_t i = 0; i < sentences.size(); i += 100) {
+    const size_t end = std::min(i + 100, sentences.size());
+    builder.add_tm_batch(std::vector<std::string>(ids.begin() + i, ids.begin() + end),
+                         std::vector<std::string>(sentences.begin() + i, sentences.begin() + end),
+                         2);
+  }
+  EXPECT_GT(builder.num_runs(), 2);
+  builder.finish();
+  EXPECT_EQ(builder.prefix_cache_bytes(), prefix_cache_bytes);
+
+  EXPECT_EQ(read_file(get_temp("in_memory.fmi")), read_file(get_temp("out_of_core.fmi")));
+  fuzzy::FuzzyMatch out_of_core;
+  fuzzy::import_binarized_fuzzy_matcher(get_temp("out_of_core.fmi"), out_of_core);
+  expect_same_matches(in_memory, out_of_core, std::vector<std::string>(sentences.begin(), sentences.begin() + 20), 1);
+}
+
+TEST(FuzzyMatchTest, sais_sort) {
+  const size_t vocab_size = 8;
+  fuzzy::SuffixArray bucket_sorted;
+  fuzzy::SuffixArray sais_sorted;
+  for (const auto& sentence : random_sentences(vocab_size, 200)) {
+    bucket_sorted.add_sentence(sentence);
+    sais_sorted.add_sentence(sentence);
+  }
+  bucket_sorted.sort(vocab_size, fuzzy::SortAlgorithm::BUCKET);
+  sais_sorted.sort(vocab_size, fuzzy::SortAlgorithm::SAIS);
+  expect_same_suffix_array(bucket_sorted, sais_sorted, vocab_size);
+}
+
+TEST(FuzzyMatchTest, parallel_sort) {
+  const size_t vocab_size = 8;
+  fuzzy::SuffixArray sequential;
+  fuzzy::SuffixArray parallel;
+  for (const auto& sentence : random_sentences(vocab_size, 500)) {
+    sequential.add_sentence(sentence);
+    parallel.add_sentence(sentence);
+  }
+  sequential.sort(vocab_size, fuzzy::SortAlgorithm::BUCKET, 1);
+  parallel.sort(vocab_size, fuzzy::SortAlgorithm::BUCKET, 4);
+  expect_same_suffix_array(sequential, parallel, vocab_size);
+}
+
+TEST(FuzzyMatchTest, lcp_equal_range) {
+  const size_t vocab_size = 8;
+  fuzzy::SuffixArray suffix_array;
+  for (const auto& sentence : random_sentences(vocab_size, 300))
+    suffix_array.add_sentence(sentence);
+  suffix_array.sort(vocab_size);
+  ASSERT_EQ(suffix_array.token_bytes(), sizeof (uint16_t));
+
+  const auto starts_with = [&suffix_array](size_t suffix_id, const std::vector<unsigned>& ngram) {
+    size_t length = 0;
+    const auto* suffix = suffix_array.get_suffix<uint16_t>(suffix_array.get_suffix_view(suffix_id), &length);
+    return length >= ngram.size() && std::equal(ngram.begin(), ngram.end(), suffix);
+  };
+
+  std::srand(7);
+  for (int i = 0; i < 2000; i++) {
+    std::vector<unsigned> ngram;
+    const int length = 1 + std::rand() % 6;
+    for (int j = 0; j < length; j++)
+      ngram.push_back(1 + std::rand() % (i % 2 ? vocab_size - 1 : 2));
+
+    std::pair<size_t, size_t> expected(0, 0);
+    size_t suffix_id = 0;
+    while (suffix_id < suffix_array.num_suffixes() && !starts_with(suffix_id, ngram))
+      suffix_id++;
+    if (suffix_id < suffix_array.num_suffixes()) {
+      expected.first = suffix_id;
+      while (suffix_id < suffix_array.num_suffixes() && starts_with(suffix_id, ngram))
+        suffix_id++;
+      expected.second = suffix_id;
+    }
+
+    const auto range = suffix_array.equal_range(ngram.data(), ngram.size());
+    EXPECT_EQ(range.second - range.first, expected.second - expected.first);
+    if (expected.first != expected.second) {
+      EXPECT_EQ(range, expected);
+    }
+
+    // narrowing the range of the (n-1)-gram
+    if (length > 1) {
+      const auto previous = suffix_array.equal_range(ngram.data(), ngram.size() - 1);
+      if (previous.first != previous.second) {
+        const auto narrowed = suffix_array.equal_range(ngram.data(), ngram.size(),
+                                                       previous.first, previous.second, ngram.size() - 1);
+        EXPECT_EQ(narrowed.second - narrowed.first, expected.second - expected.first);
+        if (expected.first != expected.second) {
+          EXPECT_EQ(narrowed, expected);
+        }
+      }
+    }
+  }
+}
+
+TEST(FuzzyMatchTest, shared_prefix_length) {
+  const size_t vocab_size = 8;
+  fuzzy::SuffixArray suffix_array;
+  for (const auto& sentence : random_sentences(vocab_size, 300))
+    suffix_array.add_sentence(sentence);
+  suffix_array.sort(vocab_size);
+
+  std::srand(11);
+  for (int i = 0; i < 1000; i++) {
+    std::vector<unsigned> ngram;
+    for (int j = 0; j < 8; j++)
+      ngram.push_back(1 + std::rand() % 2);
+    const auto range = suffix_array.equal_range(ngram.data(), 2);
+    if (range.first == range.second)
+      continue;
+
+    // extend the bigram as long as the range does not change
+    size_t expected = 2;
+    while (expected < ngram.size()) {
+      const auto next = suffix_array.equal_range(ngram.data(), expected + 1);
+      if (next != range)
+        break;
+      expected++;
+    }
+    EXPECT_EQ(suffix_array.shared_prefix_length(ngram.data(), ngram.size(), range.first, range.second, 2),
+              expected);
+  }
+}
+
+TEST(FuzzyMatchTest, range_minimum_below) {
+  std::srand(19);
+  for (const size_t size : {0, 1, 31, 32, 33, 1100, 40000}) {
+    std::vector<fuzzy::offset_t> values(size);
+    for (auto& value : values)
+      value = std::rand() % 100;
+    const fuzzy::RangeMinimum range_minimum(values);
+    for (int i = 0; i < 200; i++) {
+      const size_t position = size == 0 ? 0 : std::rand() % (size + 1);
+      // bounds from the smallest value, for values below it far from the position
+      const fuzzy::offset_t bound = std::rand() % 3 == 0 ? 1 : std::rand() % 100;
+      size_t next = position;
+      while (next < size && values[next] >= bound)
+        next++;
+      size_t previous = position;
+      while (previous > 0 && values[previous - 1] >= bound)
+        previous--;
+      EXPECT_EQ(range_minimum.next_below(position, bound), next);
+      EXPECT_EQ(range_minimum.previous_below(position, bound), previous == 0 ? size : previous - 1);
+    }
+  }
+}
+
+TEST(FuzzyMatchTest, suffix_links) {
+  const size_t vocab_size = 4;
+  fuzzy::SuffixArray searched;
+  for (const auto& sentence : random_sentences(vocab_size, 1500))
+    searched.add_sentence(sentence);
+  searched.sort(vocab_size);
+  fuzzy::SuffixArray linked(searched);
+  linked.index_suffix_links();
+  ASSERT_TRUE(linked.has_suffix_links());
+  ASSERT_FALSE(searched.has_suffix_links());
+
+  // the same ranges as with the binary searches at each position, in the same order, empty ones included
+  std::srand(17);
+  for (int i = 0; i < 500; i++) {
+    std::vector<unsigned> pattern(1 + std::rand() % 40);
+    for (auto& token : pattern)
+      token = 1 + std::rand() % (i % 2 ? vocab_size - 1 : 2);
+    std::vector<std::tuple<size_t, size_t, size_t>> expected;
+    std::vector<std::tuple<size_t, size_t, size_t>> actual;
+    searched.visit_longest_prefixes(pattern.data(), pattern.size(), [&expected](size_t begin, size_t end, size_t length) {
+      expected.emplace_back(begin, end, length);
+    });
+    linked.visit_longest_prefixes(pattern.data(), pattern.size(), [&actual](size_t begin, size_t end, size_t length) {
+      actual.emplace_back(begin, end, length);
+    });
+    EXPECT_EQ(expected, actual);
+  }
+
+  // same matches, also once saved and modified
+  const auto sentences = tm_sentences(true, vocab_size, 1500);
+  const auto patterns = sample_patterns(sentences, 13);
+  fuzzy::FuzzyMatch expected;
+  fuzzy::FuzzyMatch actual;
+  add_sentences(expected, actual, sentences, 0, sentences.size(), false);
+  expected.sort();
+  EXPECT_GT(actual.index_suffix_links(), 0);
+  expect_same_matches(expected, actual, patterns);
+  expect_same_subsequences(expected, actual, patterns);
+
+  fuzzy::export_binarized_fuzzy_matcher(get_temp("links.fmi"), actual, fuzzy::FuzzyMatch::mapped_version);
+  fuzzy::FuzzyMatch mapped;
+  fuzzy::import_binarized_fuzzy_matcher(get_temp("links.fmi"), mapped);
+  expect_same_matches(expected, mapped, patterns);
+  mapped.remove_tm(sentence_id(0));
+  expected.remove_tm(sentence_id(0));
+  mapped.compact();
+  expected.compact();
+  expect_same_matches(expected, mapped, patterns);
+}
+
+TEST(FuzzyMatchTest, short_tokens) {
+  const size_t vocab_size = 8;
+  const size_t large_vocab_size = 70000;
+  fuzzy::SuffixArray short_tokens;
+  fuzzy::SuffixArray tokens;
+  for (const auto& sentence : random_sentences(vocab_size, 300)) {
+    short_tokens.add_sentence(sentence);
+    tokens.add_sentence(sentence);
+  }
+  short_tokens.sort(vocab_size);
+  tokens.sort(large_vocab_size);
+  EXPECT_EQ(short_tokens.token_bytes(), sizeof (uint16_t));
+  EXPECT_EQ(tokens.token_bytes(), sizeof (unsigned));
+  expect_same_suffix_array(tokens, short_tokens, vocab_size);
+
+  std::srand(13);
+  for (int i = 0; i < 500; i++) {
+    std::vector<unsigned> ngram;
+    for (int j = 0; j < 4; j++)
+      ngram.push_back(1 + std::rand() % 2);
+    const auto range = tokens.equal_range(ngram.data(), 2);
+    EXPECT_EQ(short_tokens.equal_range(ngram.data(), 2), range);
+    EXPECT_EQ(short_tokens.equal_range(ngram.data(), 4, range.first, range.second, 2),
+              tokens.equal_range(ngram.data(), 4, range.first, range.second, 2));
+  }
+
+  // the tokens are stored on 4 bytes again while the array is modified
+  const std::vector<unsigned> sentence{large_vocab_size - 1, 1, 2};
+  short_tokens.add_sentence(sentence);
+  EXPECT_EQ(short_tokens.token_bytes(), sizeof (unsigned));
+  short_tokens.sort(large_vocab_size);
+  EXPECT_EQ(short_tokens.token_bytes(), sizeof (unsigned));
+  tokens.add_sentence(sentence);
+  tokens.sort(large_vocab_size);
+  expect_same_suffix_array(tokens, short_tokens, vocab_size);
+}
+
+TEST(FuzzyMatchTest, prefix_cache) {
+  // word ids not fitting in the cache are read from the sentence buffer
+  const unsigned large_wid = 70000;
+  const size_t vocab_size = large_wid + 8;
+  fuzzy::SuffixArray suffix_array;
+  for (auto sentence : random_sentences(8, 300)) {
+    for (auto& wid : sentence)
+      if (wid == 3)
+        wid = large_wid + wid;
+    suffix_array.add_sentence(sentence);
+  }
+  suffix_array.sort(vocab_size);
+  fuzzy::SuffixArray cached(suffix_array);
+  cached.cache_prefixes(3);
+  EXPECT_EQ(cached.prefix_cache_bytes(), cached.num_suffixes() * 3 * sizeof (uint16_t));
+
+  std::srand(17);
+  for (int i = 0; i < 1000; i++) {
+    std::vector<unsigned> ngram;
+    const int length = 1 + std::rand() % 6;
+    for (int j = 0; j < length; j++) {
+      const unsigned wid = 1 + std::rand() % (i % 2 ? 7 : 2);
+      ngram.push_back(wid == 3 ? large_wid + wid : wid);
+    }
+    const auto range = suffix_array.equal_range(ngram.data(), length);
+    EXPECT_EQ(cached.equal_range(ngram.data(), length), range);
+    if (length > 2 && range.first < range.second) {
+      EXPECT_EQ(cached.equal_range(ngram.data(), length, range.first, range.second, 1), range);
+    }
+  }
+
+  // the cache follows the modifications of the suffix array
+  cached.add_sentence({1, 2, 1});
+  suffix_array.add_sentence({1, 2, 1});
+  cached.sort(vocab_size);
+  suffix_array.sort(vocab_size);
+  EXPECT_EQ(cached.prefix_cache_bytes(), cached.num_suffixes() * 3 * sizeof (uint16_t));
+  expect_same_suffix_array(suffix_array, cached, 8);
+}
+
+namespace fuzzy {
+  struct CandidateTableTest {
+    static CandidateTable at_epoch(uint32_t epoch) {
+      return CandidateTable(epoch);
+    }
+  };
+}
+
+TEST(FuzzyMatchTest, candidate_table) {
+  // the epoch wraps around at the third pattern
+  auto table = fuzzy::CandidateTableTest::at_epoch(std::numeric_limits<uint32_t>::max() - 2);
+  table.reset(5);
+  table.update(3, 2);
+  table.update(3, 4);
+  table.update(1, 1);
+  table.update(3, 3);
+  EXPECT_EQ(table.touched(), std::vector<unsigned>({3, 1}));
+  EXPECT_EQ(table.longest_match(3), 4);
+  EXPECT_EQ(table.longest_match(1), 1);
+
+  // a larger array, whose first sentences were matched by the previous pattern
+  table.reset(10);
+  table.update(7, 3);
+  table.update(3, 1);
+  EXPECT_EQ(table.touched(), std::vector<unsigned>({7, 3}));
+  EXPECT_EQ(table.longest_match(3), 1);
+
+  // a smaller array: the stamps of the previous patterns, and the ones never set, are not valid
+  table.reset(4);
+  EXPECT_TRUE(table.touched().empty());
+  table.update(0, 2);
+  table.update(3, 2);
+  table.update(2, 5);
+  EXPECT_EQ(table.touched(), std::vector<unsigned>({0, 3, 2}));
+  EXPECT_EQ(table.longest_match(3), 2);
+
+  for (int i = 0; i < 3; i++) {
+    table.reset(8);
+    table.update(7, i);
+    table.update(0, 1);
+    EXPECT_EQ(table.touched(), std::vector<unsigned>({7, 0}));
+    EXPECT_EQ(table.longest_match(7), i);
+  }
+}
+
+TEST(FuzzyMatchTest, sentence_ids) {
+  const size_t vocab_size = 8;
+  fuzzy::SuffixArray suffix_array;
+  for (const auto& sentence : random_sentences(vocab_size, 300))
+    suffix_array.add_sentence(sentence);
+
+  const auto check = [&suffix_array]() {
+    std::vector<unsigned> sentence_ids(suffix_array.num_suffixes());
+    std::vector<unsigned> lengths(suffix_array.num_suffixes());
+    suffix_array.get_sentence_ids(0, suffix_array.num_suffixes(), sentence_ids.data());
+    suffix_array.get_sentence_lengths(sentence_ids.data(), sentence_ids.size(), lengths.data());
+    for (size_t suffix_id = 0; suffix_id < suffix_array.num_suffixes(); suffix_id++) {
+      EXPECT_EQ(sentence_ids[suffix_id], suffix_array.get_suffix_view(suffix_id).sentence_id);
+      EXPECT_EQ(lengths[suffix_id], suffix_array.get_sentence_length(suffix_id));
+    }
+  };
+  check();
+  suffix_array.sort(vocab_size);
+  check();
+  suffix_array.compress(vocab_size);
+  check();
+}
+
+TEST(FuzzyMatchTest, length_index) {
+  const size_t vocab_size = 8;
+  fuzzy::SuffixArray suffix_array;
+  for (const auto& sentence : random_sentences(vocab_size, 300))
+    suffix_array.add_sentence(sentence);
+  suffix_array.sort(vocab_size);
+  suffix_array.index_lengths();
+  ASSERT_TRUE(suffix_array.has_length_index());
+  const auto& length_index = suffix_array.length_index();
+
+  std::srand(5);
+  for (int i = 0; i < 200; i++) {
+    const size_t begin = std::rand() % suffix_array.num_suffixes();
+    const size_t end = begin + std::rand() % (suffix_array.num_suffixes() - begin + 1);
+    const unsigned min_length = 1 + std::rand() % 12;
+    const unsigned max_length = min_length + std::rand() % 4;
+    std::vector<size_t> expected;
+    for (size_t suffix_id = begin; suffix_id < end; suffix_id++) {
+      const unsigned length = suffix_array.get_sentence_length(suffix_id);
+      if (length >= min_length && length <= max_length)
+        expected.push_back(suffix_id);
+    }
+    std::vector<size_t> reported;
+    length_index.report(begin, end, min_length, max_length, [&reported](size_t suffix_id) {
+      reported.push_back(suffix_id);
+    });
+    std::sort(reported.begin(), reported.end());
+    EXPECT_EQ(length_index.count(begin, end, min_length, max_length), expected.size());
+    EXPECT_EQ(reported, expected);
+  }
+
+  // same matches, the long patterns skipping most of the suffixes of their n-grams
+  auto sentences = tm_sentences(false, vocab_size, 1500);
+  // a few long sentences, whose length is rare
+  for (size_t i = 0; i + 2 < 60; i += 3)
+    sentences.push_back(sentences[i] + " " + sentences[i + 1] + " " + sentences[i + 2]);
+  auto patterns = sample_patterns(sentences, 13);
+  patterns.insert(patterns.end(), sentences.end() - 20, sentences.end());
+  fuzzy::FuzzyMatch expected;
+  fuzzy::FuzzyMatch actual;
+  add_sentences(expected, actual, sentences, 0, sentences.size(), false);
+  expected.sort();
+  EXPECT_GT(actual.index_lengths(), 0);
+  expect_same_matches(expected, actual, patterns);
+  for (const auto& pattern : patterns) {
+    std::vector<fuzzy::FuzzyMatch::Match> expected_matches;
+    std::vector<fuzzy::FuzzyMatch::Match> actual_matches;
+    expected.match(pattern, 0.8, 5, false, expected_matches, 2, 0);
+    actual.match(pattern, 0.8, 5, false, actual_matches, 2, 0);
+    ASSERT_EQ(expected_matches.size(), actual_matches.size());
+    for (size_t j = 0; j < expected_matches.size(); j++)
+      EXPECT_EQ(expected_matches[j].id, actual_matches[j].id);
+  }
+  actual.remove_tm(sentence_id(0));
+  expected.remove_tm(sentence_id(0));
+  expect_same_matches(expected, actual, patterns);
+}
+
+TEST(FuzzyMatchTest, sentence_listing) {
+  // few words, so that the n-grams are repeated in the sentences
+  const size_t vocab_size = 3;
+  fuzzy::SuffixArray suffix_array;
+  for (const auto& sentence : random_sentences(vocab_size, 400))
+    suffix_array.add_sentence(sentence);
+  suffix_array.sort(vocab_size);
+  suffix_array.index_sentence_listing();
+  ASSERT_TRUE(suffix_array.has_sentence_listing());
+
+  std::srand(7);
+  for (int i = 0; i < 300; i++) {
+    const size_t begin = std::rand() % suffix_array.num_suffixes();
+    const size_t end = begin + std::rand() % (suffix_array.num_suffixes() - begin + 1);
+    std::vector<unsigned> expected;
+    for (size_t suffix_id = begin; suffix_id < end; suffix_id++)
+      expected.push_back(suffix_array.get_suffix_view(suffix_id).sentence_id);
+    std::sort(expected.begin(), expected.end());
+    expected.erase(std::unique(expected.begin(), expected.end()), expected.end());
+    std::vector<unsigned> listed;
+    suffix_array.visit_distinct_sentences(begin, end, [&listed](unsigned sentence_id) {
+      listed.push_back(sentence_id);
+    });
+    std::sort(listed.begin(), listed.end());
+    EXPECT_EQ(listed, expected);
+  }
+
+  // same matches, also once saved and modified
+  const auto sentences = tm_sentences(false, vocab_size, 1500);
+  const auto patterns = sample_patterns(sentences, 13);
+  fuzzy::FuzzyMatch expected;
+  fuzzy::FuzzyMatch actual;
+  add_sentences(expected, actual, sentences, 0, sentences.size(), false);
+  expected.sort();
+  EXPECT_GT(actual.index_sentence_listing(), 0);
+  expect_same_matches(expected, actual, patterns);
+  expect_same_matches(expected, actual, patterns, 1);
+
+  fuzzy::export_binarized_fuzzy_matcher(get_temp("listing.fmi"), actual, fuzzy::FuzzyMatch::mapped_version);
+  fuzzy::FuzzyMatch mapped;
+  fuzzy::import_binarized_fuzzy_matcher(get_temp("listing.fmi"), mapped);
+  expect_same_matches(expected, mapped, patterns);
+  mapped.remove_tm(sentence_id(0));
+  expected.remove_tm(sentence_id(0));
+  mapped.compact();
+  expected.compact();
+  expect_same_matches(expected, mapped, patterns);
+}
+
+TEST(FuzzyMatchTest, bigram_table) {
+  const size_t vocab_size = 8;
+  fuzzy::SuffixArray suffix_array;
+  for (const auto& sentence : random_sentences(vocab_size, 1500))
+    suffix_array.add_sentence(sentence);
+  suffix_array.sort(vocab_size);
+  // the buckets of the words 1 and 2 are in the table
+  EXPECT_GT(suffix_array.bigram_table_bytes(), (vocab_size + 1) * sizeof (fuzzy::offset_t));
+
+  const auto starts_with = [&suffix_array](size_t suffix_id, const std::vector<unsigned>& ngram) {
+    size_t length = 0;
+    const auto* suffix = suffix_array.get_suffix<uint16_t>(suffix_array.get_suffix_view(suffix_id), &length);
+    return length >= ngram.size() && std::equal(ngram.begin(), ngram.end(), suffix);
+  };
+
+  std::srand(11);
+  for (int i = 0; i < 500; i++) {
+    std::vector<unsigned> ngram;
+    const int length = 2 + std::rand() % 4;
+    for (int j = 0; j < length; j++)
+      ngram.push_back(1 + std::rand() % (i % 2 ? vocab_size - 1 : 2));
+
+    size_t count = 0;
+    for (size_t suffix_id = 0; suffix_id < suffix_array.num_suffixes(); suffix_id++)
+      count += starts_with(suffix_id, ngram);
+    const auto range = suffix_array.equal_range(ngram.data(), ngram.size());
+    EXPECT_EQ(range.second - range.first, count);
+    for (size_t suffix_id = range.first; suffix_id < range.second; suffix_id++)
+      EXPECT_TRUE(starts_with(suffix_id, ngram));
+  }
+
+  // rebuilt with the suffix array
+  const auto bytes = suffix_array.bigram_table_bytes();
+  suffix_array.compress(vocab_size);
+  EXPECT_EQ(suffix_array.bigram_table_bytes(), 0);
+  suffix_array.decompress();
+  EXPECT_EQ(suffix_array.bigram_table_bytes(), bytes);
+}
+
 int main(int argc, char *argv[]) {
   testing::InitGoogleTest(&argc, argv);
   assert(argc == 2);